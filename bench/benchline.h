@@ -0,0 +1,64 @@
+/**
+ * Synthetic lines of the benchmarks (microbench and macrobench).
+ * The line is the same for the same number of segments and seed.
+ */
+#ifndef BENCHLINE_H
+#define BENCHLINE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <cmath>
+#include <random>
+#include <string>
+#include <memory>
+#include "RailLine.h"
+////////////////////////////////////////////////////////////////////////////////
+// Mean length of the segments of make_line (m)
+const double BENCH_SEG_LENGTH = 272.5;
+//-----------------------------------------------------------------------------
+// Line of n segments: a station every 10 segments and at the end, the
+// others 50-500 m with 40-90 km/h, some on gradients or curves
+//-----------------------------------------------------------------------------
+inline std::shared_ptr<RailLine> make_line(size_t n, unsigned seed) {
+    std::mt19937 rnd(seed);
+    std::uniform_real_distribution<double> len(50, 500);
+    std::uniform_int_distribution<int> sp(8, 18);
+    std::uniform_int_distribution<int> kind(0, 9);
+    std::shared_ptr<RailLine> line = std::make_shared<RailLine>();
+    double d = 0;
+    for (size_t i = 0; i < n; i++) {
+        Segment seg;
+        seg.id = seg.last_id = (int)i + 1;
+        seg.distance = d;
+        if (i % 10 == 0 || i == n - 1) {
+            seg.type = SegmentType::Station;
+            seg.length = 250;
+            seg.speed = 30;
+        } else {
+            seg.length = std::floor(len(rnd));
+            seg.speed = 5 * sp(rnd);
+            int k = kind(rnd);
+            if (k < 2) seg.gradient = (k == 0) ? 0.5 : -0.5;
+            else if (k == 2) seg.radius = 400;
+        }
+        seg.head_only = (seg.gradient == 0 && seg.radius == 0);
+        line->segs.push_back(seg);
+        d += seg.length;
+    }
+    line->touch();
+    return line;
+}
+//-----------------------------------------------------------------------------
+// Line file (loadsegdata format) of the segments of line
+//-----------------------------------------------------------------------------
+inline bool write_line_file(const std::shared_ptr<RailLine>& line, const std::string& fname) {
+    FILE* fp = fopen(fname.c_str(), "wt");
+    if (fp == NULL) return false;
+    for (const auto& s : line->segs) {
+        fprintf(fp, "%d\t%.0f\t%.0f\t%d\t%.0f\t%g\t%.0f\n", s.id, s.distance, s.length,
+            s.type, s.speed, s.gradient, s.radius);
+    }
+    fclose(fp);
+    return true;
+}
+
+#endif
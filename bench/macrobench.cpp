@@ -0,0 +1,175 @@
+/**
+ * End-to-end scaling benchmark.
+ * Each point runs the whole pipeline (params and line load, prepare_run,
+ * main_run loop, output and SVG) for all trains with RunControl::run_batch.
+ * The points are the product of line lengths, numbers of trains and
+ * numbers of worker threads. The lines are made by make_line of benchline.h
+ * (as in microbench). The memory of each point is the peak of each pool of
+ * memory:: during the point; the peak RSS is of the whole process.
+ * Usage: macrobench output.json [-l 10,100,1000] [-n 1,4,16] [-j 1,2,4] [-nosvg]
+ * Temporary files are written in the current directory and removed.
+ */
+#ifndef GITVERSION
+	#define GITVERSION "a"
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "nlohmann/json.hpp"
+#include "RunControl.h"
+#include "Parallel.h"
+#include "Memory.h"
+#include "benchline.h"
+///////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+//-----------------------------------------------------------------------------
+// Peak resident set size of this process so far (KB)
+//-----------------------------------------------------------------------------
+static long peak_rss_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return (long)(pmc.PeakWorkingSetSize / 1024);
+    return 0;
+#else
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+#endif
+}
+//-----------------------------------------------------------------------------
+// Parse "1,2,3"
+//-----------------------------------------------------------------------------
+static std::vector<int> parse_list(const char* str) {
+    std::vector<int> v;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) v.push_back(atoi(item.c_str()));
+    }
+    return v;
+}
+//-----------------------------------------------------------------------------
+// Params file of n trains on the line
+//-----------------------------------------------------------------------------
+static void write_params(const std::string& fname, const std::string& line_fname, int n) {
+    json j;
+    j["line"] = json::array({{{"id", 1}, {"type", "file"}, {"fname", line_fname}}});
+    j["speedtraction"] = json::array({{
+        {"id", 1}, {"name", "Speed-traction"}, {"labels", {"speed", "traction"}},
+        {"units", {"km/s", "kgf"}},
+        {"data", {{0,348880}, {30,348880}, {35,325360}, {40,299880}, {50,239120}, {60,192080},
+                  {67,162680}, {70,150920}, {75,141120}, {80,123480}, {90,94080}, {100,64680}}}
+    }});
+    json trains = json::array();
+    for (int i = 0; i < n; i++) {
+        trains.push_back({
+            {"id", i + 1}, {"name", "Train " + std::to_string(i + 1)}, {"maxspeed", 70 + 10 * (i % 4)},
+            {"length", 200}, {"WM", 205}, {"WT", 261}, {"nCars", 10}, {"sptrindex", 1},
+            {"lineindex", 1}, {"acceleration", 0.7 + 0.05 * (i % 6)},
+            {"resistance", {{"model", "JNR_EMU"}, {"params", {1.32, 0.0164, 0.028, 0.0078}}}}
+        });
+    }
+    j["train"] = trains;
+    std::ofstream fo(fname);
+    fo << j.dump(1, '\t');
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: macrobench output.json [-l 10,100,1000] [-n 1,4,16] [-j 1,2,4] [-nosvg]\n");
+        return 1;
+    }
+    std::vector<int> lengths = {10, 100, 1000};
+    std::vector<int> fleets = {1, 4, 16};
+    std::vector<int> threads = {1, 2, 4, hardware_threads()};
+    bool svg = true;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) lengths = parse_list(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) fleets = parse_list(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = parse_list(argv[++i]);
+        else if (strcmp(argv[i], "-nosvg") == 0) svg = false;
+    }
+    using clock = std::chrono::steady_clock;
+    json results = json::array();
+    for (int km : lengths) {
+        std::string line_fname = "macrobench-" + std::to_string(km) + ".data";
+        std::shared_ptr<RailLine> line = make_line(std::max(2L, std::lround(km * 1000 / BENCH_SEG_LENGTH)), 1);
+        int n_segs = (int)line->segs.size();
+        if (!write_line_file(line, line_fname)) {
+            fprintf(stderr, "Cannot create file %s\n", line_fname.c_str());
+            return 1;
+        }
+        line.reset();
+        for (int n : fleets) {
+            std::string params_fname = "macrobench-" + std::to_string(km) + "-" + std::to_string(n) + ".json";
+            write_params(params_fname, line_fname, n);
+            for (int nt : threads) {
+                memory::reset_peaks();
+                auto t0 = clock::now();
+                RunControl ctrl;
+                if (ctrl.read_params(params_fname.c_str()) == false) {
+                    fprintf(stderr, "Cannot read %s\n", params_fname.c_str());
+                    return 1;
+                }
+                auto t1 = clock::now();
+                int n_fail = ctrl.run_batch("macrobench-out", svg ? "macrobench-out" : NULL, nt);
+                auto t2 = clock::now();
+                double load_s = std::chrono::duration<double>(t1 - t0).count();
+                double run_s = std::chrono::duration<double>(t2 - t1).count();
+                double sim_s = 0;
+                long bytes = 0;
+                for (const auto& stat : ctrl.batch_stats) {
+                    sim_s += stat.sim_time;
+                    bytes += stat.bytes;
+                    std::string f = "macrobench-out-" + std::to_string(stat.train_id);
+                    remove((f + ".tsv").c_str());
+                    remove((f + ".svg").c_str());
+                }
+                double wall = load_s + run_s;
+                json mem = json::object();
+                int64_t mem_total = 0;
+                for (int p = 0; p < memory::nPool; p++) {
+                    mem[memory::pool_name[p]] = memory::peak((memory::Pool)p);
+                    mem_total += memory::peak((memory::Pool)p);
+                }
+                json r = {
+                    {"line_km", km}, {"segments", n_segs}, {"trains", n}, {"threads", nt},
+                    {"wall_s", wall}, {"load_s", load_s}, {"run_s", run_s},
+                    {"sim_s", sim_s}, {"sim_s_per_wall_s", (wall > 0) ? sim_s / wall : 0.0},
+                    {"memory_peak", mem}, {"bytes_written", bytes}, {"failures", n_fail}
+                };
+                fprintf(stderr, "%6d km %4d trains %3d threads: %8.3f s, %10.0f sim-s/s, %lld KB in the pools\n",
+                    km, n, nt, wall, (wall > 0) ? sim_s / wall : 0.0, (long long)(mem_total / 1024));
+                results.push_back(r);
+            }
+            remove(params_fname.c_str());
+        }
+        remove(line_fname.c_str());
+    }
+    json root = {
+        {"version", GITVERSION}, {"hardware_threads", hardware_threads()},
+        {"svg", svg}, {"peak_rss_kb", peak_rss_kb()},
+        {"note", "memory_peak: the peak bytes of each pool during the point; peak_rss_kb: of the whole process"},
+        {"results", results}
+    };
+    std::ofstream fo(argv[1]);
+    if (!fo) {
+        fprintf(stderr, "Cannot create file %s\n", argv[1]);
+        return 1;
+    }
+    fo << root.dump(2) << std::endl;
+    return 0;
+}
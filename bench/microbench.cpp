@@ -0,0 +1,266 @@
+/**
+ * Microbenchmarks of the simulation hot paths.
+ * Usage: microbench [output.json] [seconds per benchmark]
+ * The result is a JSON object. Each item of "results" has the name of the
+ * function, the size of the input (table size, number of segments or rows),
+ * the number of iterations and ns/op.
+ */
+#ifndef GITVERSION
+	#define GITVERSION "a"
+#endif
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <memory>
+#include "common.h"
+#include "Lookup.h"
+#include "motor.h"
+#include "RailLine.h"
+#include "train.h"
+#include "SVGConv.h"
+#include "benchline.h"
+///////////////////////////////////////////////////////////////////////////////
+// Access to the private functions of Train
+///////////////////////////////////////////////////////////////////////////////
+class TrainBench {
+public:
+    struct State {
+        double total_time, distance, speed, accel, force, power, total_power, acc_tm;
+        TrainStatus status;
+        bool entered;
+        SegmentList::const_iterator seg_it;
+    };
+    static void step(const Train& t, double g, double r, double* v, double* x, double* a) {
+        t.step(g, r, v, x, a, false);
+    }
+    static double min_speed(const Train& t, double x1, double x2) {
+        return t.get_min_speed(x1, x2);
+    }
+    static int update(Train& t) { return t.update(); }
+    static State save(const Train& t) {
+        State s = {t.total_time, t.distance, t.speed, t.accel, t.force, t.power,
+                   t.total_power, t.acc_tm, t.status, t.entered, t.seg_it};
+        return s;
+    }
+    static void restore(Train& t, const State& s) {
+        t.total_time = s.total_time; t.distance = s.distance; t.speed = s.speed;
+        t.accel = s.accel; t.force = s.force; t.power = s.power;
+        t.total_power = s.total_power; t.acc_tm = s.acc_tm;
+        t.status = s.status; t.entered = s.entered; t.seg_it = s.seg_it;
+    }
+};
+///////////////////////////////////////////////////////////////////////////////
+struct BenchResult {
+    std::string name;
+    size_t size;
+    size_t iterations;
+    double ns_per_op;
+};
+static std::vector<BenchResult> results;
+static double min_time = 0.2;     // seconds per benchmark
+static volatile double sink = 0;  // keeps the results alive
+//-----------------------------------------------------------------------------
+// Run f(i) in batches until the batch takes min_time
+//-----------------------------------------------------------------------------
+template<class F>
+void bench(const char* name, size_t size, F&& f) {
+    using clock = std::chrono::steady_clock;
+    size_t n = 1;
+    while (true) {
+        double acc = 0;
+        auto t0 = clock::now();
+        for (size_t i = 0; i < n; i++) acc += f(i);
+        double el = std::chrono::duration<double>(clock::now() - t0).count();
+        sink = sink + acc;
+        if (el >= min_time || n >= ((size_t)1 << 32)) {
+            results.push_back({name, size, n, el * 1e9 / n});
+            fprintf(stderr, "%-28s %8zu %12.1f ns/op\n", name, size, el * 1e9 / n);
+            return;
+        }
+        if (el <= 0) n *= 16;
+        else n = (size_t)(n * std::min(16.0, 1.2 * min_time / el)) + 1;
+    }
+}
+//-----------------------------------------------------------------------------
+// Synthetic data
+//-----------------------------------------------------------------------------
+static const double sptr_table[][2] = {
+    {0,348880}, {30,348880}, {35,325360}, {40,299880}, {50,239120}, {60,192080},
+    {67,162680}, {70,150920}, {75,141120}, {80,123480}, {90,94080}, {100,64680}
+};
+
+static std::shared_ptr<SpeedTraction> make_traction(size_t n) {
+    std::vector<LookupItem> items(n);
+    size_t m = sizeof(sptr_table) / sizeof(sptr_table[0]);
+    for (size_t i = 0; i < n; i++) {
+        double x = 100.0 * i / (n - 1);
+        Lookup l;
+        l.init(m, sptr_table);
+        items[i] = LookupItem(x, l.midval(x) * GRAV_ACC);
+    }
+    std::shared_ptr<SpeedTraction> sptr = std::make_shared<SpeedTraction>();
+    sptr->set_data(items.data(), (int)n);
+    return sptr;
+}
+static std::shared_ptr<Train> make_train(std::shared_ptr<RailLine> line) {
+    std::shared_ptr<Train> train = std::make_shared<Train>();
+    train->set_speed_traction(make_traction(12));
+    train->set_line(line);
+    train->prepare_run();
+    return train;
+}
+
+static std::string write_result_file(size_t rows) {
+    std::string fname = "microbench_result.tmp";
+    FILE* fp = fopen(fname.c_str(), "wt");
+    fprintf(fp, "status\ttime\tdistance\tspeed\taccel\tforce\tpower\n");
+    for (size_t i = 0; i < rows; i++) {
+        double t = i / 16.0;
+        int status = (int)((i / 500) % 4);
+        fprintf(fp, "%d\t%.3f\t%.2f\t%.1f\t%.3f\t%.0f\t%.1f\n", status, t, 10.0 * t,
+            60 + 20 * std::sin(i / 300.0), 0.1, 1000.0, 100.0);
+    }
+    fclose(fp);
+    return fname;
+}
+//-----------------------------------------------------------------------------
+// Benchmarks
+//-----------------------------------------------------------------------------
+static void bench_lookup() {
+    for (size_t n : {12, 1024}) {
+        std::shared_ptr<SpeedTraction> sptr = make_traction(n);
+        std::vector<double> xs(1024);
+        std::mt19937 rnd(1);
+        std::uniform_real_distribution<double> u(0, 100);
+        for (auto& x : xs) x = u(rnd);
+        bench("Lookup::midval", n, [&](size_t i) { return sptr->midval(xs[i & 1023]); });
+    }
+}
+
+static void bench_motor() {
+    Motor motor;
+    motor.init(300000);
+    bench("Motor::tract", 1, [&](size_t i) { return motor.tract((double)(i % 120)); });
+}
+
+static void bench_train() {
+    std::shared_ptr<RailLine> line = make_line(64, 1);
+    std::shared_ptr<Train> train = make_train(line);
+    bench("Train::df", 1, [&](size_t i) {
+        return train->df((i % 25) + 0.5, (i & 1) ? 0.5 : 0.0, 0.0, false);
+    });
+    bench("Train::step", 1, [&](size_t i) {
+        double v = (i % 25) + 0.5, x = 100.0, a;
+        TrainBench::step(*train, 0.5, 0.0, &v, &x, &a);
+        return v + x;
+    });
+    for (size_t n : {64, 65536}) {
+        std::shared_ptr<RailLine> l = make_line(n, 2);
+        std::shared_ptr<Train> t = make_train(l);
+        double total = l->length();
+        bench("Train::get_min_speed", n, [&](size_t i) {
+            double x = total * ((i * 7919) % 1000) / 1000.0;
+            return TrainBench::min_speed(*t, x - t->length, x);
+        });
+    }
+    // update: the train is restored to the middle of a segment when it leaves the segment
+    {
+        std::shared_ptr<Train> t = make_train(make_line(64, 3));
+        for (int i = 0; i < 600; i++) t->main_run();
+        TrainBench::State s = TrainBench::save(*t);
+        bench("Train::update", 64, [&](size_t) {
+            int r = TrainBench::update(*t);
+            if (r != RunCode::InSegment) TrainBench::restore(*t, s);
+            return t->get_speed();
+        });
+    }
+    // main_run: whole runs of the line
+    {
+        std::shared_ptr<Train> t = make_train(make_line(64, 4));
+        bench("Train::main_run", 64, [&](size_t) {
+            int r = t->main_run();
+            if (r == RunCode::EndOfLine || r == RunCode::LessPower) t->prepare_run();
+            return t->get_speed();
+        });
+    }
+}
+
+static void bench_setsegspeed() {
+    for (size_t n : {64, 65536}) {
+        std::shared_ptr<RailLine> line = make_line(n, 5);
+        std::vector<double> max_speed;
+        bench("setsegspeed", n, [&](size_t) {
+            setsegspeed(line->segs, 1.0, 200.0, 1.0, max_speed);
+            return max_speed[0];
+        });
+    }
+}
+
+static void bench_loadsegdata() {
+    for (size_t n : {64, 65536}) {
+        std::string fname = "microbench_line.tmp";
+        write_line_file(make_line(n, 6), fname);
+        bench("loadsegdata", n, [&](size_t) {
+            std::vector<Segment> segs;
+            return (double)loadsegdata(fname.c_str(), segs);
+        });
+        remove(fname.c_str());
+    }
+}
+
+static void bench_svg() {
+    std::shared_ptr<RailLine> line = make_line(64, 7);
+    for (size_t n : {10000, 200000}) {
+        std::string fname = write_result_file(n);
+        bench("SVGConvert::load", n, [&](size_t) {
+            SVGConvert svgc;
+            return svgc.load(fname.c_str()) ? 1.0 : 0.0;
+        });
+        SVGConvert proto;
+        proto.read_rail(line);
+        proto.load(fname.c_str());
+        FILE* fp = tmpfile();
+        bench("SVGConvert::svg_print", n, [&](size_t) {
+            SVGConvert svgc = proto;
+            rewind(fp);
+            svgc.svg_print(fp);
+            return (double)ftell(fp);
+        });
+        fclose(fp);
+        remove(fname.c_str());
+    }
+}
+//-----------------------------------------------------------------------------
+// Save the results as JSON
+//-----------------------------------------------------------------------------
+static void print_json(FILE* fp) {
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"dt\": %g,\n  \"results\": [\n", GITVERSION, Train::default_dt);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(fp, "    {\"name\": \"%s\", \"size\": %zu, \"iterations\": %zu, \"ns_per_op\": %.2f}%s\n",
+            r.name.c_str(), r.size, r.iterations, r.ns_per_op, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 2) min_time = atof(argv[2]);
+    bench_lookup();
+    bench_motor();
+    bench_train();
+    bench_setsegspeed();
+    bench_loadsegdata();
+    bench_svg();
+    if (argc > 1) {
+        FILE* fp = fopen(argv[1], "wt");
+        if (fp == NULL) {
+            fprintf(stderr, "Cannot create file %s\n", argv[1]);
+            return 1;
+        }
+        print_json(fp);
+        fclose(fp);
+    } else print_json(stdout);
+    return 0;
+}
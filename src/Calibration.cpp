@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include "Calibration.h"
+#include "Sweep.h"
+////////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+//-----------------------------------------------------------------------------
+// The time of a log is counted from the first moving point after a stop,
+// as the departure itself falls between two points of the log
+//-----------------------------------------------------------------------------
+bool MeasuredTrace::read(const char* name) {
+    fname = name;
+    points.clear();
+    ref.clear();
+    std::ifstream fi(name);
+    if (!fi) {
+        fprintf(stderr, "Cannot read file %s\n", name);
+        return false;
+    }
+    std::string str;
+    while (std::getline(fi, str)) {
+        if (str.empty() || str[0] == '#') continue;
+        std::replace(str.begin(), str.end(), ',', ' ');
+        MeasuredPoint p;
+        if (sscanf(str.c_str(), "%lf %lf %lf", &p.time, &p.distance, &p.speed) != 3) {
+            if (points.empty()) continue;   // header
+            fprintf(stderr, "Invalid line of %s: %s\n", name, str.c_str());
+            return false;
+        }
+        if (!points.empty() && p.time < points.back().time) {
+            fprintf(stderr, "Time goes back in %s: %s\n", name, str.c_str());
+            return false;
+        }
+        points.push_back(p);
+    }
+    if (points.size() < 2) {
+        fprintf(stderr, "Too few points in %s\n", name);
+        return false;
+    }
+    size_t r = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (i > 0 && points[i - 1].speed <= TRACE_STOP_SPEED && points[i].speed > TRACE_STOP_SPEED) r = i;
+        ref.push_back(r);
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+Calibration::Calibration() {
+    train_id = 0;
+    sigma_time = 1.0;
+    sigma_speed = 1.0;
+    max_iter = 20;
+    step = 0.05;
+    tol = 1e-4;
+    dt = 0;
+}
+
+bool Calibration::read_json(const json& jdata) {
+    keys.clear();
+    traces.clear();
+    try {
+        if (jdata.contains("train")) train_id = jdata.at("train");
+        keys = jdata.at("keys").get<std::vector<std::string>>();
+        for (const auto& key : keys) {
+            double x;
+            if (!valid_param_key(key) || !TrainBase().get_value(key, &x)) {
+                fprintf(stderr, "Unknown key of calibration: %s\n", key.c_str());
+                return false;
+            }
+        }
+        for (const auto& fname : jdata.at("traces").get<std::vector<std::string>>()) {
+            MeasuredTrace trace;
+            if (!trace.read(fname.c_str())) return false;
+            traces.push_back(std::move(trace));
+        }
+        if (jdata.contains("sigma")) {
+            const json& js = jdata.at("sigma");
+            if (js.contains("time")) sigma_time = js.at("time");
+            if (js.contains("speed")) sigma_speed = js.at("speed");
+        }
+        if (jdata.contains("iterations")) max_iter = jdata.at("iterations");
+        if (jdata.contains("step")) step = jdata.at("step");
+        if (jdata.contains("tol")) tol = jdata.at("tol");
+        if (jdata.contains("dt")) dt = jdata.at("dt");
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in calibration: %s\n", e.what());
+        return false;
+    }
+    if (keys.empty() || traces.empty() || sigma_time <= 0 || sigma_speed <= 0 || step <= 0 || dt < 0) {
+        fprintf(stderr, "Invalid calibration\n");
+        return false;
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+// The time of a moving point is counted from the reference point of the trace
+// in the log and in the run (the first time at its distance), so the
+// stopping times of the log and of the line do not matter.
+//-----------------------------------------------------------------------------
+bool Calibration::residuals(const Trajectory& traj, std::vector<double>* r, std::vector<TraceResidual>* rows) const {
+    r->clear();
+    if (rows) rows->clear();
+    for (size_t k = 0; k < traces.size(); k++) {
+        const MeasuredTrace& trace = traces[k];
+        size_t last_ref = trace.points.size();
+        TrajPoint p0;
+        for (size_t i = 0; i < trace.points.size(); i++) {
+            const MeasuredPoint& q = trace.points[i];
+            const MeasuredPoint& q0 = trace.points[trace.ref[i]];
+            TrajPoint p;
+            if (!traj.at_distance(q.distance, &p)) return false;
+            if (trace.ref[i] != last_ref) {
+                last_ref = trace.ref[i];
+                if (!traj.at_distance(q0.distance, &p0)) return false;
+            }
+            TraceResidual row;
+            row.trace = k;
+            row.time = q.time;
+            row.distance = q.distance;
+            row.speed = q.speed;
+            row.sim_speed = p.speed * 3.6;
+            row.d_speed = row.sim_speed - q.speed;
+            row.d_time = 0;
+            r->push_back(row.d_speed / sigma_speed);
+            if (q.speed > TRACE_STOP_SPEED) {
+                row.d_time = (p.time - p0.time) - (q.time - q0.time);
+                r->push_back(row.d_time / sigma_time);
+            }
+            if (rows) rows->push_back(row);
+        }
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+void trace_rms(const std::vector<TraceResidual>& rows, double* time, double* speed) {
+    double t2 = 0, v2 = 0;
+    size_t nt = 0;
+    for (const auto& row : rows) {
+        v2 += row.d_speed * row.d_speed;
+        if (row.speed > TRACE_STOP_SPEED) {
+            t2 += row.d_time * row.d_time;
+            nt++;
+        }
+    }
+    *time = (nt > 0) ? std::sqrt(t2 / nt) : 0.0;
+    *speed = rows.empty() ? 0.0 : std::sqrt(v2 / rows.size());
+}
+//-----------------------------------------------------------------------------
+// Partial pivoting
+//-----------------------------------------------------------------------------
+bool solve_linear(std::vector<double> a, std::vector<double> b, size_t n, std::vector<double>* x) {
+    for (size_t c = 0; c < n; c++) {
+        size_t piv = c;
+        for (size_t i = c + 1; i < n; i++) {
+            if (std::fabs(a[i * n + c]) > std::fabs(a[piv * n + c])) piv = i;
+        }
+        if (a[piv * n + c] == 0) return false;
+        if (piv != c) {
+            for (size_t j = 0; j < n; j++) std::swap(a[c * n + j], a[piv * n + j]);
+            std::swap(b[c], b[piv]);
+        }
+        for (size_t i = c + 1; i < n; i++) {
+            double f = a[i * n + c] / a[c * n + c];
+            for (size_t j = c; j < n; j++) a[i * n + j] -= f * a[c * n + j];
+            b[i] -= f * b[c];
+        }
+    }
+    x->assign(n, 0.0);
+    for (size_t i = n; i-- > 0; ) {
+        double s = b[i];
+        for (size_t j = i + 1; j < n; j++) s -= a[i * n + j] * (*x)[j];
+        (*x)[i] = s / a[i * n + i];
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+void print_calibration(FILE* fp, const CalibStat& stat) {
+    fprintf(fp, "key\tinitial\tfitted\tstd_error\n");
+    for (size_t i = 0; i < stat.keys.size(); i++) {
+        fprintf(fp, "%s\t%g\t%g\t%g\n", stat.keys[i].c_str(), stat.initial[i], stat.fitted[i], stat.std_err[i]);
+    }
+    fprintf(fp, "\ntrace\ttime\tdistance\tspeed\tsim_speed\td_time\td_speed\n");
+    for (const auto& row : stat.rows) {
+        fprintf(fp, "%zu\t%.3f\t%.2f\t%.2f\t%.2f\t%.3f\t%.3f\n", row.trace, row.time, row.distance, row.speed,
+            row.sim_speed, row.d_time, row.d_speed);
+    }
+}
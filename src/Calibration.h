@@ -0,0 +1,90 @@
+/**
+ * Calibration of a train against measured runs (--calibrate), declared by
+ * the "calibration" object of the parameter file.
+ * A trace is a log of time (s), distance (m) and speed (km/h) of a run on
+ * the line of the train. The keys of the train (res0, start_resist,
+ * tractionfactor, ...) are fitted by Levenberg-Marquardt to the speed at the
+ * distances of the traces and to the time from the last departure.
+ */
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "Simulate.h"
+////////////////////////////////////////////////////////////////////////////////
+constexpr double TRACE_STOP_SPEED = 0.5;    // km/h: stopped at or below this speed
+//-----------------------------------------------------------------------------
+// Measured run: "time distance speed" in each line (spaces, tabs or commas;
+// a header and lines of '#' are skipped)
+//-----------------------------------------------------------------------------
+struct MeasuredPoint {
+    double time;        // s
+    double distance;    // m (on the line)
+    double speed;       // km/h
+};
+
+class MeasuredTrace {
+public:
+    std::string fname;
+    std::vector<MeasuredPoint> points;
+    std::vector<size_t> ref;    // the first moving point after the last stop (or the first point)
+public:
+    // Return false if the file cannot be read or has less than 2 points
+    bool read(const char* fname);
+};
+// Residual of a point at the fitted values
+struct TraceResidual {
+    size_t trace;       // index of the trace
+    double time, distance, speed;   // measured (s, m, km/h)
+    double sim_speed;   // km/h
+    double d_time;      // time from the departure: simulation - measured (s), 0 if stopped
+    double d_speed;     // km/h
+};
+
+class Calibration {
+public:
+    int train_id;                   // train to fit (0: the first train)
+    std::vector<std::string> keys;  // keys of the train (Sweep.h)
+    std::vector<MeasuredTrace> traces;
+    double sigma_time;              // s: scale of the time residuals
+    double sigma_speed;             // km/h: scale of the speed residuals
+    int max_iter;                   // iterations of Levenberg-Marquardt
+    double step;                    // relative step of the Jacobian
+    double dt;                      // s: step of the runs (0: dt of the train)
+    double tol;                     // stop if the cost decreases less than this ratio
+public:
+    Calibration();
+    // "train", "keys", "traces": [file names], "sigma": {"time", "speed"},
+    // "iterations", "step", "tol", "dt". Return false if a key or a trace is invalid.
+    bool read_json(const nlohmann::json& jdata);
+    // Scaled residuals of the traces against a run (kept points).
+    // [Return] false if a point of a trace is out of the run
+    bool residuals(const Trajectory& traj, std::vector<double>* r, std::vector<TraceResidual>* rows) const;
+};
+// Result of a calibration
+struct CalibStat {
+    int train_id;
+    int code;           // 0: success, -2: no line, -3: low power, -5: traces out of the run
+    std::vector<std::string> keys;
+    std::vector<double> initial, fitted;
+    std::vector<double> std_err;    // standard errors of the fitted values (0: not estimated)
+    int iterations;
+    size_t n_runs;                  // simulations
+    double cost0, cost;             // sum of the squares of the scaled residuals
+    double rms_time0, rms_speed0;   // s, km/h at the initial values
+    double rms_time, rms_speed;     // s, km/h at the fitted values
+    std::vector<TraceResidual> rows;
+    CalibStat(): train_id(0), code(0), iterations(0), n_runs(0), cost0(0), cost(0),
+        rms_time0(0), rms_speed0(0), rms_time(0), rms_speed(0) {};
+};
+// RMS of the time (moving points) and the speed of the rows
+void trace_rms(const std::vector<TraceResidual>& rows, double* time, double* speed);
+// Solve a x = b (n x n, row major) by Gaussian elimination. Return false if singular.
+bool solve_linear(std::vector<double> a, std::vector<double> b, size_t n, std::vector<double>* x);
+// Table of the fitted values and the table of the residuals
+void print_calibration(FILE* fp, const CalibStat& stat);
+
+#endif
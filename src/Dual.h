@@ -0,0 +1,117 @@
+/**
+ * Dual numbers for forward-mode automatic differentiation.
+ * A Dual<N> is a value and its derivatives by N parameters. The kernels of
+ * the train (df, step, get_regist, get_force) are templates on the scalar
+ * type, so a run with Dual numbers gives the derivatives of the run in one
+ * pass. Comparisons use the value only (the branches of the real run).
+ */
+#ifndef DUAL_H
+#define DUAL_H
+////////////////////////////////////////////////////////////////////////////////
+#include <cmath>
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+template <int N> class Dual {
+public:
+    double v;       // value
+    double d[N];    // derivative by each parameter
+public:
+    Dual(double x = 0.0) : v(x) { std::fill(d, d + N, 0.0); };
+    // The parameter i (derivative 1 by itself)
+    static Dual var(double x, int i) {
+        Dual r(x);
+        r.d[i] = 1.0;
+        return r;
+    };
+    Dual& operator+=(const Dual& b) {
+        v += b.v;
+        for (int i = 0; i < N; i++) d[i] += b.d[i];
+        return *this;
+    };
+    Dual& operator-=(const Dual& b) {
+        v -= b.v;
+        for (int i = 0; i < N; i++) d[i] -= b.d[i];
+        return *this;
+    };
+    Dual& operator*=(double k) {
+        v *= k;
+        for (int i = 0; i < N; i++) d[i] *= k;
+        return *this;
+    };
+};
+//-----------------------------------------------------------------------------
+// Arithmetic
+//-----------------------------------------------------------------------------
+template <int N> Dual<N> operator-(const Dual<N>& a) {
+    Dual<N> r(-a.v);
+    for (int i = 0; i < N; i++) r.d[i] = -a.d[i];
+    return r;
+}
+template <int N> Dual<N> operator+(const Dual<N>& a, const Dual<N>& b) { Dual<N> r(a); return r += b; }
+template <int N> Dual<N> operator-(const Dual<N>& a, const Dual<N>& b) { Dual<N> r(a); return r -= b; }
+template <int N> Dual<N> operator+(const Dual<N>& a, double b) { Dual<N> r(a); r.v += b; return r; }
+template <int N> Dual<N> operator+(double a, const Dual<N>& b) { Dual<N> r(b); r.v += a; return r; }
+template <int N> Dual<N> operator-(const Dual<N>& a, double b) { Dual<N> r(a); r.v -= b; return r; }
+template <int N> Dual<N> operator-(double a, const Dual<N>& b) { Dual<N> r(-b); r.v += a; return r; }
+template <int N> Dual<N> operator*(const Dual<N>& a, double b) { Dual<N> r(a); return r *= b; }
+template <int N> Dual<N> operator*(double a, const Dual<N>& b) { Dual<N> r(b); return r *= a; }
+template <int N> Dual<N> operator/(const Dual<N>& a, double b) { Dual<N> r(a); return r *= (1.0 / b); }
+
+template <int N> Dual<N> operator*(const Dual<N>& a, const Dual<N>& b) {
+    Dual<N> r(a.v * b.v);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] * b.v + a.v * b.d[i];
+    return r;
+}
+template <int N> Dual<N> operator/(const Dual<N>& a, const Dual<N>& b) {
+    Dual<N> r(a.v / b.v);
+    for (int i = 0; i < N; i++) r.d[i] = (a.d[i] - r.v * b.d[i]) / b.v;
+    return r;
+}
+template <int N> Dual<N> operator/(double a, const Dual<N>& b) { return Dual<N>(a) / b; }
+//-----------------------------------------------------------------------------
+// Comparisons (value only)
+//-----------------------------------------------------------------------------
+template <int N> bool operator<(const Dual<N>& a, const Dual<N>& b) { return a.v < b.v; }
+template <int N> bool operator>(const Dual<N>& a, const Dual<N>& b) { return a.v > b.v; }
+template <int N> bool operator<=(const Dual<N>& a, const Dual<N>& b) { return a.v <= b.v; }
+template <int N> bool operator>=(const Dual<N>& a, const Dual<N>& b) { return a.v >= b.v; }
+template <int N> bool operator<(const Dual<N>& a, double b) { return a.v < b; }
+template <int N> bool operator>(const Dual<N>& a, double b) { return a.v > b; }
+template <int N> bool operator<=(const Dual<N>& a, double b) { return a.v <= b; }
+template <int N> bool operator>=(const Dual<N>& a, double b) { return a.v >= b; }
+//-----------------------------------------------------------------------------
+// Functions
+//-----------------------------------------------------------------------------
+template <int N> Dual<N> sqrt(const Dual<N>& a) {
+    Dual<N> r(std::sqrt(a.v));
+    double k = (r.v > 0) ? 0.5 / r.v : 0.0;
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] * k;
+    return r;
+}
+template <int N> Dual<N> pow(const Dual<N>& a, double p) {
+    Dual<N> r(std::pow(a.v, p));
+    double k = (p == 0) ? 0.0 : p * std::pow(a.v, p - 1);
+    for (int i = 0; i < N; i++) r.d[i] = a.d[i] * k;
+    return r;
+}
+//-----------------------------------------------------------------------------
+// Value of a double or a Dual
+//-----------------------------------------------------------------------------
+inline double value_of(double x) { return x; }
+template <int N> double value_of(const Dual<N>& x) { return x.v; }
+//-----------------------------------------------------------------------------
+// f(x) for a function of double (e.g. a lookup table). The derivative of a
+// Dual is the central difference of f at the value (forward at x < h, as
+// speeds are not negative).
+//-----------------------------------------------------------------------------
+template <class F> double lift(F f, double x) { return f(x); }
+template <int N, class F> Dual<N> lift(F f, const Dual<N>& x) {
+    double h = 1e-4 * std::max(1.0, std::fabs(x.v));
+    double y = f(x.v);
+    double slope = (x.v < h) ? (f(x.v + h) - y) / h : (f(x.v + h) - f(x.v - h)) / (2 * h);
+    Dual<N> r(y);
+    for (int i = 0; i < N; i++) r.d[i] = x.d[i] * slope;
+    return r;
+}
+
+#endif
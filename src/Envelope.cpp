@@ -0,0 +1,227 @@
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include "Envelope.h"
+#include "train.h"
+////////////////////////////////////////////////////////////////////////////////
+//-----------------------------------------------------------------------------
+// Calculate the envelope of a line
+//-----------------------------------------------------------------------------
+SpeedEnvelope::SpeedEnvelope(const RailLine& line, double dec, double train_length, double margin) {
+    setsegspeed(line.segs, dec, train_length, margin, max_speed);
+}
+//-----------------------------------------------------------------------------
+// Braking curve
+//-----------------------------------------------------------------------------
+BrakingCurve::BrakingCurve() {
+    cell = 1.0;
+    dec = 1.0;
+}
+//-----------------------------------------------------------------------------
+// Make the braking curve of a train
+// [Input]
+//    line, env    the line and its envelope
+//    dec          deceleration (m/s^2)
+//    train_length length of the train (m)
+//    top_speed    maximum speed of the train (km/h)
+//-----------------------------------------------------------------------------
+BrakingCurve::BrakingCurve(const RailLine& line, const SpeedEnvelope& env, double dec,
+                           double train_length, double top_speed) {
+    this->dec = dec;
+    cell = 1.0;
+    const SegmentList& segs = line.segs;
+    if (segs.empty()) return;
+    // targets (position, speed)
+    std::vector<std::pair<double, double>> targets;
+    for (size_t i = 0; i < segs.size(); i++) {
+        if (i > 0) {
+            double v = std::min(env.max_speed[i], top_speed) / 3.6;
+            targets.emplace_back(segs[i].distance, (v > 0) ? v : 0.0);
+        }
+        if (segs[i].type == SegmentType::Station) {
+            targets.emplace_back(segs[i].distance + segs[i].length / 2 + train_length / 2, 0.0);
+        }
+    }
+    const Segment& last = segs.back();
+    targets.emplace_back(last.distance + last.length, 0.0);
+    std::stable_sort(targets.begin(), targets.end(),
+        [](const std::pair<double, double>& a, const std::pair<double, double>& b) {
+            return a.first < b.first;
+        });
+    // the most restrictive target among the targets ahead
+    size_t n = targets.size();
+    end.resize(n);
+    level.resize(n);
+    tx.resize(n);
+    tv.resize(n);
+    size_t best = n - 1;
+    double best_level = HUGE_VAL;
+    for (size_t i = n; i-- > 0; ) {
+        double c = targets[i].second * targets[i].second + 2 * dec * targets[i].first;
+        if (c < best_level) {
+            best_level = c;
+            best = i;
+        }
+        end[i] = targets[i].first;
+        level[i] = best_level;
+        tx[i] = targets[best].first;
+        tv[i] = targets[best].second;
+    }
+    // grid to find a piece by the position (about four cells per piece)
+    double total = end.back();
+    if (total > 0) cell = std::max(1.0, total / (4.0 * n));
+    size_t ncell = (size_t)(total / cell) + 1;
+    grid.resize(ncell);
+    size_t k = 0;
+    for (size_t j = 0; j < ncell; j++) {
+        double x = j * cell;
+        while (k < n && x >= end[k]) k++;
+        grid[j] = k;
+    }
+}
+//-----------------------------------------------------------------------------
+// Index of the piece including x (size() if x is beyond the last target)
+//-----------------------------------------------------------------------------
+size_t BrakingCurve::piece(double x) const {
+    if (grid.empty()) return end.size();
+    size_t i = 0;
+    if (x > 0) {
+        size_t j = (size_t)(x / cell);
+        if (j >= grid.size()) j = grid.size() - 1;
+        i = grid[j];
+    }
+    while (i < end.size() && x >= end[i]) i++;
+    return i;
+}
+
+double BrakingCurve::get_level(double x) const {
+    size_t i = piece(x);
+    return (i < end.size()) ? level[i] : HUGE_VAL;
+}
+
+bool BrakingCurve::target(double x, double* xt, double* vt) const {
+    size_t i = piece(x);
+    if (i >= end.size()) return false;
+    *xt = tx[i];
+    *vt = tv[i];
+    return true;
+}
+
+double BrakingCurve::speed(double x) const {
+    double lv = get_level(x);
+    if (lv == HUGE_VAL) return HUGE_VAL;
+    double v2 = lv - 2 * dec * x;
+    return (v2 > 0) ? std::sqrt(v2) : 0.0;
+}
+//-----------------------------------------------------------------------------
+// Hash of the key
+//-----------------------------------------------------------------------------
+size_t EnvelopeKeyHash::operator()(const EnvelopeKey& k) const {
+    std::hash<double> hd;
+    size_t h = std::hash<unsigned long>()(k.line_serial);
+    h ^= std::hash<int>()(k.kind) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hd(k.dec) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hd(k.length) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hd(k.margin) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    h ^= hd(k.top_speed) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+}
+//-----------------------------------------------------------------------------
+// Constructor: n is the maximum number of envelopes
+//-----------------------------------------------------------------------------
+EnvelopeCache::EnvelopeCache(size_t n) {
+    capacity = (n > 0) ? n : 1;
+    n_hit = n_miss = 0;
+}
+//-----------------------------------------------------------------------------
+// Find the entry of the key and mark it as the most recently used
+//-----------------------------------------------------------------------------
+bool EnvelopeCache::find(const EnvelopeKey& key, Entry& entry) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto found = index.find(key);
+    if (found == index.end()) {
+        n_miss++;
+        return false;
+    }
+    items.splice(items.begin(), items, found->second);
+    n_hit++;
+    entry = found->second->second;
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Insert the entry. If another thread has inserted the same key while this
+// thread was calculating, the first one is kept and returned.
+//-----------------------------------------------------------------------------
+EnvelopeCache::Entry EnvelopeCache::insert(const EnvelopeKey& key, const Entry& entry) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto found = index.find(key);
+    if (found != index.end()) return found->second->second;
+    items.emplace_front(key, entry);
+    index[key] = items.begin();
+    evict();
+    return entry;
+}
+//-----------------------------------------------------------------------------
+// Return the envelope of the key. Calculate it if it is not in the cache.
+// The envelope is calculated outside the lock.
+//-----------------------------------------------------------------------------
+std::shared_ptr<const SpeedEnvelope> EnvelopeCache::get(const RailLine& line,
+        double dec, double train_length, double margin) {
+    EnvelopeKey key = {EnvelopeKey::Envelope, line.getSerial(), dec, train_length, margin, 0.0};
+    Entry entry;
+    if (find(key, entry)) return entry.env;
+    entry.env = std::make_shared<const SpeedEnvelope>(line, dec, train_length, margin);
+    return insert(key, entry).env;
+}
+//-----------------------------------------------------------------------------
+// Return the braking curve of the key. The envelope is also taken from the cache.
+//-----------------------------------------------------------------------------
+std::shared_ptr<const BrakingCurve> EnvelopeCache::get_curve(const RailLine& line,
+        double dec, double train_length, double margin, double top_speed) {
+    EnvelopeKey key = {EnvelopeKey::Curve, line.getSerial(), dec, train_length, margin, top_speed};
+    Entry entry;
+    if (find(key, entry)) return entry.curve;
+    entry.env = get(line, dec, train_length, margin);
+    entry.curve = std::make_shared<const BrakingCurve>(line, *entry.env, dec, train_length, top_speed);
+    return insert(key, entry).curve;
+}
+//-----------------------------------------------------------------------------
+// Change the maximum number of envelopes
+//-----------------------------------------------------------------------------
+void EnvelopeCache::set_capacity(size_t n) {
+    std::lock_guard<std::mutex> lock(mtx);
+    capacity = (n > 0) ? n : 1;
+    evict();
+}
+//-----------------------------------------------------------------------------
+// Remove all envelopes. Trains keep their envelopes until the next prepare_run.
+//-----------------------------------------------------------------------------
+void EnvelopeCache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    items.clear();
+    index.clear();
+}
+
+size_t EnvelopeCache::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return items.size();
+}
+
+size_t EnvelopeCache::hits() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return n_hit;
+}
+
+size_t EnvelopeCache::misses() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return n_miss;
+}
+//-----------------------------------------------------------------------------
+// Remove the least recently used envelopes (called in the lock)
+//-----------------------------------------------------------------------------
+void EnvelopeCache::evict() {
+    while (items.size() > capacity) {
+        index.erase(items.back().first);
+        items.pop_back();
+    }
+}
@@ -0,0 +1,111 @@
+/**
+ * SpeedEnvelope keeps the maximum speed of each segment of a line
+ * considering breaking (the result of setsegspeed).
+ * BrakingCurve is the continuous braking curve of a train derived from the
+ * envelope and the station stopping points.
+ * EnvelopeCache shares the envelopes and curves among runs and threads.
+ * The key is (line, deceleration, train length, margin) and old envelopes
+ * are evicted by LRU.
+ */
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "RailLine.h"
+////////////////////////////////////////////////////////////////////////////////
+class SpeedEnvelope {
+public:
+    std::vector<double> max_speed;  // maximum speed of each segment (km/h)
+public:
+    SpeedEnvelope() {};
+    SpeedEnvelope(const RailLine& line, double dec, double train_length, double margin);
+};
+//-----------------------------------------------------------------------------
+// Braking curve: the maximum speed v(x) from which the train can still obey
+// every speed limit and stop ahead of x with the deceleration dec.
+// Each target (position xt, speed vt) gives a parabola
+//     v^2 = vt^2 + 2 dec (xt - x)
+// All parabolas are parallel in v^2, so the most restrictive one between two
+// targets is the one with the minimum level c = vt^2 + 2 dec xt among the
+// targets ahead. The braking check is one comparison v^2 + 2 dec x > c.
+// Targets: the entrance of each segment (envelope speed) and the stopping
+// point of each station and of the end of the line.
+//-----------------------------------------------------------------------------
+class BrakingCurve {
+    std::vector<double> end;    // end position of each piece (m)
+    std::vector<double> level;  // c of the governing target (m^2/s^2)
+    std::vector<double> tx;     // position of the governing target (m)
+    std::vector<double> tv;     // speed of the governing target (m/s)
+    std::vector<size_t> grid;   // the first piece of each cell
+    double cell;                // width of a cell of the grid (m)
+public:
+    double dec;
+public:
+    BrakingCurve();
+    BrakingCurve(const RailLine& line, const SpeedEnvelope& env, double dec,
+                 double train_length, double top_speed);
+    size_t piece(double x) const;
+    // level of the braking curve at x (HUGE_VAL if there is no target ahead)
+    double get_level(double x) const;
+    // v (m/s) at x (m) is over the curve whose level is lv
+    bool exceeds(double lv, double x, double v) const { return v * v + 2 * dec * x > lv; };
+    // governing target at x. Return false if there is no target ahead.
+    bool target(double x, double* xt, double* vt) const;
+    double speed(double x) const;   // v(x) in m/s
+    size_t size() const { return end.size(); };
+};
+//-----------------------------------------------------------------------------
+// Key of the envelope cache
+//-----------------------------------------------------------------------------
+struct EnvelopeKey {
+    enum Kind { Envelope, Curve };
+    Kind kind;                   // SpeedEnvelope or BrakingCurve
+    unsigned long line_serial;   // RailLine::getSerial()
+    double dec;
+    double length;
+    double margin;
+    double top_speed;            // max speed of the train for curves, 0 for envelopes
+    bool operator==(const EnvelopeKey& k) const {
+        return kind == k.kind && line_serial == k.line_serial && dec == k.dec && length == k.length
+            && margin == k.margin && top_speed == k.top_speed;
+    }
+};
+struct EnvelopeKeyHash {
+    size_t operator()(const EnvelopeKey& k) const;
+};
+//-----------------------------------------------------------------------------
+// LRU cache of SpeedEnvelope
+//-----------------------------------------------------------------------------
+class EnvelopeCache {
+    struct Entry {
+        std::shared_ptr<const SpeedEnvelope> env;
+        std::shared_ptr<const BrakingCurve> curve;
+    };
+    using Item = std::pair<EnvelopeKey, Entry>;
+    size_t capacity;
+    std::list<Item> items;   // the front is the most recently used
+    std::unordered_map<EnvelopeKey, std::list<Item>::iterator, EnvelopeKeyHash> index;
+    std::mutex mtx;
+    size_t n_hit;
+    size_t n_miss;
+public:
+    EnvelopeCache(size_t n = 64);
+    std::shared_ptr<const SpeedEnvelope> get(const RailLine& line, double dec, double train_length, double margin);
+    std::shared_ptr<const BrakingCurve> get_curve(const RailLine& line, double dec, double train_length,
+                                                  double margin, double top_speed);
+    void set_capacity(size_t n);
+    void clear();
+    size_t size();
+    size_t hits();
+    size_t misses();
+private:
+    bool find(const EnvelopeKey& key, Entry& entry);
+    Entry insert(const EnvelopeKey& key, const Entry& entry);
+    void evict();
+};
+
+#endif
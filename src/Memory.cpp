@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <sstream>
+#include "Memory.h"
+////////////////////////////////////////////////////////////////////////////////
+namespace memory {
+
+const char* pool_name[nPool] = {"line", "trajectory", "svg", "json"};
+
+static std::atomic<int64_t> used[nPool];
+static std::atomic<int64_t> peaks[nPool];
+static int64_t budgets[nPool];
+//-----------------------------------------------------------------------------
+void add(Pool p, int64_t bytes) {
+    int64_t now = used[p].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t pk = peaks[p].load(std::memory_order_relaxed);
+    while (now > pk && !peaks[p].compare_exchange_weak(pk, now, std::memory_order_relaxed)) {}
+}
+
+int64_t current(Pool p) {
+    return used[p].load(std::memory_order_relaxed);
+}
+
+int64_t peak(Pool p) {
+    return peaks[p].load(std::memory_order_relaxed);
+}
+
+void reset_peaks() {
+    for (int i = 0; i < nPool; i++) peaks[i].store(used[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void set_budget(Pool p, int64_t bytes) {
+    budgets[p] = (bytes > 0) ? bytes : 0;
+}
+
+int64_t budget(Pool p) {
+    return budgets[p];
+}
+
+bool over_budget(Pool p, int64_t bytes) {
+    return budgets[p] > 0 && current(p) + bytes > budgets[p];
+}
+//-----------------------------------------------------------------------------
+// name=size[K|M|G],...
+//-----------------------------------------------------------------------------
+bool parse_budgets(const char* str) {
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t pos = item.find('=');
+        if (pos == std::string::npos) return false;
+        std::string name = item.substr(0, pos);
+        char* end;
+        double x = strtod(item.c_str() + pos + 1, &end);
+        if (end == item.c_str() + pos + 1 || x < 0) return false;
+        if (*end == 'K' || *end == 'k') x *= 1024, end++;
+        else if (*end == 'M' || *end == 'm') x *= 1024 * 1024, end++;
+        else if (*end == 'G' || *end == 'g') x *= 1024.0 * 1024 * 1024, end++;
+        if (*end != '\0') return false;
+        int p = 0;
+        while (p < nPool && name != pool_name[p]) p++;
+        if (p == nPool) return false;
+        set_budget((Pool)p, (int64_t)x);
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+void print_json(FILE* fp, const char* indent) {
+    fprintf(fp, "{");
+    for (int i = 0; i < nPool; i++) {
+        fprintf(fp, "%s\n%s  \"%s\": {\"peak\": %lld, \"final\": %lld, \"budget\": %lld}", (i > 0) ? "," : "",
+            indent, pool_name[i], (long long)peak((Pool)i), (long long)current((Pool)i), (long long)budgets[i]);
+    }
+    fprintf(fp, "\n%s}", indent);
+}
+
+}
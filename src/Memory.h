@@ -0,0 +1,61 @@
+/**
+ * Memory accounting of the large buffers by subsystem.
+ * The owners of the buffers keep a Charge whose size is updated when the
+ * buffer grows, so the current and peak usage of each pool are known for
+ * all runs living at the same time.
+ * A budget of a pool (0: none) is checked by the owners; SVGConvert::load
+ * streams the rows or decimates the points instead of growing over it.
+ */
+#ifndef MEMORY_H
+#define MEMORY_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+namespace memory {
+
+enum Pool { Line, Trajectory, SVG, JSON, nPool };
+extern const char* pool_name[nPool];
+
+// Add bytes (negative to release) to the pool
+void add(Pool p, int64_t bytes);
+int64_t current(Pool p);
+int64_t peak(Pool p);
+// Start the peaks again from the current usage (e.g. for each point of a benchmark)
+void reset_peaks();
+// Budget of a pool in bytes (0: no budget)
+void set_budget(Pool p, int64_t bytes);
+int64_t budget(Pool p);
+// true if the pool is over the budget after adding bytes
+bool over_budget(Pool p, int64_t bytes);
+// "svg=64M,trajectory=256M" (suffix K, M, G). Returns false if invalid.
+bool parse_budgets(const char* str);
+// "memory" object of the metrics
+void print_json(FILE* fp, const char* indent);
+
+// Bytes charged to a pool by an owner
+class Charge {
+    Pool pool;
+    int64_t bytes;
+public:
+    explicit Charge(Pool p) : pool(p), bytes(0) {}
+    Charge(const Charge& c) : pool(c.pool), bytes(0) { set(c.bytes); }
+    Charge& operator=(const Charge& c) {
+        if (this != &c) {
+            set(0);
+            pool = c.pool;
+            set(c.bytes);
+        }
+        return *this;
+    }
+    ~Charge() { set(0); }
+    void set(int64_t n) {
+        if (n != bytes) add(pool, n - bytes);
+        bytes = n;
+    }
+    int64_t get() const { return bytes; }
+};
+
+}
+
+#endif
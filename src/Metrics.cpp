@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "Metrics.h"
+#include "Memory.h"
+#ifndef GITVERSION
+	#define GITVERSION "a"
+#endif
+////////////////////////////////////////////////////////////////////////////////
+namespace metrics {
+
+const char* phase_name[nPhase] = {"none", "params", "line", "prepare_run", "loop", "output", "svg"};
+const char* counter_name[nCounter] = {"ticks", "df", "segment_advances", "get_min_speed"};
+const char* status_name[nStatus] = {"Traction", "Coasting", "Breaking", "Stop", "Constant"};
+
+// The blocks live until the end of the program, so worker threads may exit
+// before the blocks are merged.
+static std::mutex blocks_mutex;
+static std::vector<std::unique_ptr<Block>> blocks;
+static thread_local Block* tl_block = nullptr;
+static bool perf_requested = false;
+
+Block::Block() {
+    for (auto& x : phase_ns) x = 0;
+    for (auto& x : counter) x = 0;
+    for (auto& x : transition) x = 0;
+    for (auto& p : perf_count) for (auto& x : p) x = 0;
+    for (auto& x : perf_last) x = 0;
+    sim_time = 0;
+    perf_tried = false;
+    current = None;
+    since = std::chrono::steady_clock::now();
+}
+//-----------------------------------------------------------------------------
+Block& local() {
+    if (tl_block == nullptr) {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        blocks.emplace_back(new Block());
+        tl_block = blocks.back().get();
+    }
+    return *tl_block;
+}
+//-----------------------------------------------------------------------------
+// The counts since the last sample are added to the running phase
+//-----------------------------------------------------------------------------
+static void perf_sample(Block& b) {
+    uint64_t v[perf::nEvent];
+    if (!b.perf_tried) {
+        b.perf_tried = true;
+        std::shared_ptr<perf::Counters> pc = std::make_shared<perf::Counters>();
+        if (pc->open() && pc->read(b.perf_last)) b.perf = pc;
+        return;
+    }
+    if (!b.perf || !b.perf->read(v)) return;
+    for (int i = 0; i < perf::nEvent; i++) {
+        b.perf_count[b.current][i] += v[i] - b.perf_last[i];
+        b.perf_last[i] = v[i];
+    }
+}
+//-----------------------------------------------------------------------------
+// The time until now is added to the running phase
+//-----------------------------------------------------------------------------
+Phase enter(Phase p) {
+    Block& b = local();
+    if (perf_requested) perf_sample(b);
+    auto now = std::chrono::steady_clock::now();
+    b.phase_ns[b.current] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - b.since).count();
+    b.since = now;
+    Phase prev = b.current;
+    b.current = p;
+    return prev;
+}
+//-----------------------------------------------------------------------------
+Block total() {
+    Block sum;
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    for (const auto& b : blocks) {
+        for (int i = 0; i < nPhase; i++) sum.phase_ns[i] += b->phase_ns[i];
+        for (int i = 0; i < nCounter; i++) sum.counter[i] += b->counter[i];
+        for (int i = 0; i < nStatus; i++) sum.transition[i] += b->transition[i];
+        for (int i = 0; i < nPhase; i++) {
+            for (int j = 0; j < perf::nEvent; j++) sum.perf_count[i][j] += b->perf_count[i][j];
+        }
+        sum.sim_time += b->sim_time;
+        if (b->perf) sum.perf = b->perf;
+    }
+    return sum;
+}
+//-----------------------------------------------------------------------------
+void reset() {
+    std::lock_guard<std::mutex> lock(blocks_mutex);
+    for (auto& b : blocks) {
+        Phase p = b->current;
+        std::shared_ptr<perf::Counters> pc = b->perf;
+        bool tried = b->perf_tried;
+        uint64_t last[perf::nEvent];
+        for (int i = 0; i < perf::nEvent; i++) last[i] = b->perf_last[i];
+        *b = Block();
+        b->current = p;
+        b->perf = pc;
+        b->perf_tried = tried;
+        for (int i = 0; i < perf::nEvent; i++) b->perf_last[i] = last[i];
+    }
+}
+//-----------------------------------------------------------------------------
+bool enabled() {
+#ifdef RUNRAIL_METRICS
+    return true;
+#else
+    return false;
+#endif
+}
+//-----------------------------------------------------------------------------
+void set_perf(bool on) {
+    perf_requested = on;
+}
+//-----------------------------------------------------------------------------
+// Counts of each phase and per simulated second
+//-----------------------------------------------------------------------------
+static void print_perf(FILE* fp, const Block& sum) {
+    fprintf(fp, "  \"perf\": {\n    \"available\": %s", sum.perf ? "true" : "false");
+    if (!sum.perf) {
+        std::string reason = !perf_requested ? "not requested (--perf)" :
+            !enabled() ? "metrics are not compiled in" : perf::reason();
+        fprintf(fp, ",\n    \"reason\": \"%s\"\n  },\n", reason.c_str());
+        return;
+    }
+    fprintf(fp, ",\n    \"events\": [");
+    for (int j = 0; j < perf::nEvent; j++) {
+        if (sum.perf->has((perf::Event)j)) fprintf(fp, "%s\"%s\"", (j > 0) ? ", " : "", perf::event_name[j]);
+    }
+    fprintf(fp, "],\n    \"phases\": {");
+    for (int i = Params; i < nPhase; i++) {
+        fprintf(fp, "%s\n      \"%s\": {", (i > Params) ? "," : "", phase_name[i]);
+        for (int j = 0; j < perf::nEvent; j++) {
+            fprintf(fp, "%s\"%s\": %llu", (j > 0) ? ", " : "", perf::event_name[j],
+                (unsigned long long)sum.perf_count[i][j]);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n    },\n    \"per_sim_second\": {");
+    for (int i = Params; i < nPhase; i++) {
+        fprintf(fp, "%s\n      \"%s\": {", (i > Params) ? "," : "", phase_name[i]);
+        for (int j = 0; j < perf::nEvent; j++) {
+            double x = (sum.sim_time > 0) ? sum.perf_count[i][j] / sum.sim_time : 0.0;
+            fprintf(fp, "%s\"%s\": %.1f", (j > 0) ? ", " : "", perf::event_name[j], x);
+        }
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n    }\n  },\n");
+}
+//-----------------------------------------------------------------------------
+// Phase times are the sum of all threads (s)
+//-----------------------------------------------------------------------------
+bool save(const char* fname) {
+    FILE* fp = fopen(fname, "wt");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot create file %s\n", fname);
+        return false;
+    }
+    Block sum = total();
+    size_t n_threads;
+    {
+        std::lock_guard<std::mutex> lock(blocks_mutex);
+        n_threads = blocks.size();
+    }
+    fprintf(fp, "{\n  \"version\": \"%s\",\n  \"enabled\": %s,\n  \"threads\": %zu,\n",
+        GITVERSION, enabled() ? "true" : "false", n_threads);
+    fprintf(fp, "  \"sim_time\": %.3f,\n", sum.sim_time);
+    print_perf(fp, sum);
+    fprintf(fp, "  \"phases\": {");
+    for (int i = Params; i < nPhase; i++) {
+        fprintf(fp, "%s\n    \"%s\": %.6f", (i > Params) ? "," : "", phase_name[i], sum.phase_ns[i] * 1e-9);
+    }
+    fprintf(fp, "\n  },\n  \"counters\": {");
+    for (int i = 0; i < nCounter; i++) {
+        fprintf(fp, "%s\n    \"%s\": %lld", (i > 0) ? "," : "", counter_name[i], (long long)sum.counter[i]);
+    }
+    fprintf(fp, "\n  },\n  \"transitions\": {");
+    for (int i = 0; i < nStatus; i++) {
+        fprintf(fp, "%s\n    \"%s\": %lld", (i > 0) ? "," : "", status_name[i], (long long)sum.transition[i]);
+    }
+    fprintf(fp, "\n  },\n  \"memory\": ");
+    memory::print_json(fp, "  ");
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    return true;
+}
+
+}
@@ -0,0 +1,90 @@
+/**
+ * Phase timers and hot-path counters (--metrics).
+ * The macros are empty unless RUNRAIL_METRICS is defined (make METRICS=1),
+ * so the normal build does not pay for them.
+ * Each thread has its own block of counters. The blocks are merged when the
+ * metrics are saved.
+ * Phase times are exclusive: a nested phase (e.g. the line file read in the
+ * params) is not included in the outer phase.
+ * With set_perf(true), the hardware counters of each thread (Perf.h) are read
+ * at every change of phase and added to the phase.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include "Perf.h"
+////////////////////////////////////////////////////////////////////////////////
+namespace metrics {
+
+enum Phase { None, Params, Line, Prepare, Loop, Output, SVG, nPhase };
+enum Counter { Ticks, DfEvals, SegAdvances, MinSpeedCalls, nCounter };
+const int nStatus = 5;  // number of TrainStatus
+
+extern const char* phase_name[nPhase];
+extern const char* counter_name[nCounter];
+extern const char* status_name[nStatus];
+
+struct Block {
+    int64_t phase_ns[nPhase];
+    int64_t counter[nCounter];
+    int64_t transition[nStatus];    // number of changes into each status
+    double sim_time;                // simulated time (s)
+    Phase current;                  // running phase
+    std::chrono::steady_clock::time_point since;
+    uint64_t perf_count[nPhase][perf::nEvent];
+    uint64_t perf_last[perf::nEvent];
+    std::shared_ptr<perf::Counters> perf;   // counters of the thread
+    bool perf_tried;                        // perf is opened (or failed)
+    Block();
+};
+// Block of this thread
+Block& local();
+// Switch the running phase of this thread. Returns the previous phase.
+Phase enter(Phase p);
+// Sum of the blocks of all threads
+Block total();
+// Clear all blocks
+void reset();
+// Save as JSON. Returns false if the file cannot be created.
+bool save(const char* fname);
+// true if compiled with RUNRAIL_METRICS
+bool enabled();
+// Read the hardware counters at changes of phase. Call before the runs.
+void set_perf(bool on);
+
+// Scoped phase
+class PhaseTimer {
+    Phase prev;
+public:
+    explicit PhaseTimer(Phase p) { prev = enter(p); }
+    ~PhaseTimer() { enter(prev); }
+};
+// Counts a change of status between construction and destruction
+template<class S> class StatusGuard {
+    const S& ref;
+    S first;
+public:
+    explicit StatusGuard(const S& s) : ref(s), first(s) {}
+    ~StatusGuard() { if (ref != first) local().transition[(int)ref]++; }
+};
+
+}
+
+#ifdef RUNRAIL_METRICS
+#define METRIC_CAT2(a, b) a##b
+#define METRIC_CAT(a, b) METRIC_CAT2(a, b)
+#define METRIC_PHASE(p) metrics::PhaseTimer METRIC_CAT(metric_phase_, __LINE__)(metrics::p)
+#define METRIC_INC(c) (metrics::local().counter[metrics::c]++)
+#define METRIC_STATUS(s) metrics::StatusGuard<decltype(s)> METRIC_CAT(metric_status_, __LINE__)(s)
+#define METRIC_SIM_TIME(t) (metrics::local().sim_time += (t))
+#else
+#define METRIC_PHASE(p)
+#define METRIC_INC(c)
+#define METRIC_STATUS(s)
+#define METRIC_SIM_TIME(t)
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <algorithm>
+#include <sstream>
+#include "common.h"
+#include "MonteCarlo.h"
+#include "Sweep.h"
+////////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+////////////////////////////////////////////////////////////////////////////////
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+//-----------------------------------------------------------------------------
+// The streams start at well separated states
+//-----------------------------------------------------------------------------
+Rng::Rng(uint64_t seed, uint64_t stream) {
+    state = mix64(seed + mix64(stream + 0x9e3779b97f4a7c15ULL));
+}
+
+uint64_t Rng::next() {
+    state += 0x9e3779b97f4a7c15ULL;
+    return mix64(state);
+}
+
+double Rng::uniform() {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+// Box-Muller (the second value is not kept)
+double Rng::normal() {
+    double u1 = 1.0 - uniform();
+    double u2 = uniform();
+    return std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * M_PI * u2);
+}
+//-----------------------------------------------------------------------------
+// Distribution
+//-----------------------------------------------------------------------------
+Distribution::Distribution() {
+    type = Fixed;
+    a = b = c = 0;
+    lo = -HUGE_VAL;
+    hi = HUGE_VAL;
+}
+
+bool Distribution::read_json(const json& jdata) {
+    if (jdata.is_number()) {
+        type = Fixed;
+        a = jdata;
+        return true;
+    }
+    std::string name = jdata.at("dist");
+    if (name == "fixed") {
+        type = Fixed;
+        a = jdata.at("value");
+    }
+    else if (name == "uniform") {
+        type = Uniform;
+        a = jdata.at("min");
+        b = jdata.at("max");
+        if (b < a) return false;
+    }
+    else if (name == "normal" || name == "lognormal") {
+        double mean = jdata.at("mean");
+        double sd = jdata.at("sd");
+        if (sd < 0) return false;
+        if (jdata.contains("min")) lo = jdata.at("min");
+        if (jdata.contains("max")) hi = jdata.at("max");
+        if (hi < lo) return false;
+        if (name == "normal") {
+            type = Normal;
+            a = mean;
+            b = sd;
+        } else {
+            // mean and sd of the value -> mu and sigma of the log
+            if (mean <= 0) return false;
+            type = LogNormal;
+            double s2 = std::log(1 + (sd * sd) / (mean * mean));
+            a = std::log(mean) - s2 / 2;
+            b = std::sqrt(s2);
+        }
+    }
+    else if (name == "triangular") {
+        type = Triangular;
+        a = jdata.at("min");
+        c = jdata.at("mode");
+        b = jdata.at("max");
+        if (c < a || b < c || b <= a) return false;
+    }
+    else return false;
+    return true;
+}
+
+double Distribution::sample(Rng& rng) const {
+    double x = a;
+    switch (type) {
+        case Fixed:
+            return a;
+        case Uniform:
+            return a + (b - a) * rng.uniform();
+        case Normal:
+            x = a + b * rng.normal();
+            break;
+        case LogNormal:
+            x = std::exp(a + b * rng.normal());
+            break;
+        case Triangular: {
+            double u = rng.uniform();
+            double f = (c - a) / (b - a);
+            if (u < f) return a + std::sqrt(u * (b - a) * (c - a));
+            return b - std::sqrt((1 - u) * (b - a) * (b - c));
+        }
+    }
+    return std::min(hi, std::max(lo, x));
+}
+//-----------------------------------------------------------------------------
+// MonteCarlo
+//-----------------------------------------------------------------------------
+MonteCarlo::MonteCarlo() {
+    samples = 0;
+    seed = 1;
+    quantiles = {0.05, 0.5, 0.95};
+    has_dwell = false;
+}
+
+bool MonteCarlo::read_json(const json& jdata) {
+    keys.clear();
+    dists.clear();
+    train_ids.clear();
+    has_dwell = false;
+    try {
+        samples = jdata.at("samples");
+        if (jdata.contains("seed")) seed = jdata.at("seed");
+        if (jdata.contains("trains")) train_ids = jdata.at("trains").get<std::vector<int>>();
+        if (jdata.contains("quantiles")) {
+            quantiles = jdata.at("quantiles").get<std::vector<double>>();
+            for (double q : quantiles) {
+                if (q < 0 || q > 1) {
+                    fprintf(stderr, "Invalid quantile of montecarlo: %g\n", q);
+                    return false;
+                }
+            }
+        }
+        const json& jp = jdata.at("params");
+        for (auto it = jp.begin(); it != jp.end(); ++it) {
+            Distribution dist;
+            if (!dist.read_json(it.value())) {
+                fprintf(stderr, "Invalid distribution of montecarlo: %s\n", it.key().c_str());
+                return false;
+            }
+            if (it.key() == "dwell") {
+                has_dwell = true;
+                dwell = dist;
+            }
+            else if (it.key() != "dt" && valid_param_key(it.key())) {
+                keys.push_back(it.key());
+                dists.push_back(dist);
+            }
+            else {
+                fprintf(stderr, "Unknown key of montecarlo: %s\n", it.key().c_str());
+                return false;
+            }
+        }
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in montecarlo: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool MonteCarlo::has_train(int id) const {
+    return train_ids.empty() || std::find(train_ids.begin(), train_ids.end(), id) != train_ids.end();
+}
+//-----------------------------------------------------------------------------
+// The train must have the line (a dwell time for each station segment)
+//-----------------------------------------------------------------------------
+void MonteCarlo::apply(Train& train, size_t sample) const {
+    Rng rng(seed, ((uint64_t)(uint32_t)train.id << 40) ^ sample);
+    std::vector<double> values(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) values[i] = dists[i].sample(rng);
+    if (!keys.empty()) apply_params(train, keys, values);
+    train.dwell_times.clear();
+    if (has_dwell && train.get_line()) {
+        for (const auto& seg : train.get_line()->segs) {
+            if (seg.type == SegmentType::Station) train.dwell_times.push_back(std::max(0.0, dwell.sample(rng)));
+        }
+    }
+}
+//-----------------------------------------------------------------------------
+void MonteCarloStat::merge(const MonteCarloStat& s) {
+    if (s.code != 0) code = s.code;
+    n_fail += s.n_fail;
+    run_time.merge(s.run_time);
+    energy.merge(s.energy);
+    if (arrivals.size() < s.arrivals.size()) arrivals.resize(s.arrivals.size());
+    for (size_t k = 0; k < s.arrivals.size(); k++) arrivals[k].merge(s.arrivals[k]);
+}
+//-----------------------------------------------------------------------------
+// A finished block is flushed, so it is merged as it is read from a sketch
+//-----------------------------------------------------------------------------
+void MonteCarloStat::flush() {
+    run_time.flush();
+    energy.flush();
+    for (auto& d : arrivals) d.flush();
+}
+//-----------------------------------------------------------------------------
+// The trains are in the order of their first blocks
+//-----------------------------------------------------------------------------
+void merge_montecarlo_blocks(const std::vector<MonteCarloStat>& blocks, std::vector<MonteCarloStat>* stats) {
+    std::vector<const MonteCarloStat*> order;
+    for (const auto& b : blocks) order.push_back(&b);
+    std::sort(order.begin(), order.end(), [](const MonteCarloStat* a, const MonteCarloStat* b) { return a->block < b->block; });
+    stats->clear();
+    for (const MonteCarloStat* b : order) {
+        size_t j = 0;
+        while (j < stats->size() && (*stats)[j].train_id != b->train_id) j++;
+        if (j == stats->size()) {
+            stats->push_back(MonteCarloStat());
+            stats->back().train_id = b->train_id;
+        }
+        (*stats)[j].merge(*b);
+    }
+}
+//-----------------------------------------------------------------------------
+// The trains without the line are not printed
+//-----------------------------------------------------------------------------
+void print_montecarlo(FILE* fp, std::vector<MonteCarloStat>& stats, const std::vector<double>& quantiles) {
+    fprintf(fp, "train\titem\tn\tmean\tmin");
+    for (double q : quantiles) fprintf(fp, "\tq%g", q);
+    fprintf(fp, "\tmax\n");
+    auto print_row = [&](int id, const std::string& item, TDigest& d) {
+        fprintf(fp, "%d\t%s\t%.0f\t%.3f\t%.3f", id, item.c_str(), d.count(), d.mean(), d.min());
+        for (double q : quantiles) fprintf(fp, "\t%.3f", d.quantile(q));
+        fprintf(fp, "\t%.3f\n", d.max());
+    };
+    for (auto& s : stats) {
+        if (s.code != 0) continue;
+        print_row(s.train_id, "run_time", s.run_time);
+        print_row(s.train_id, "energy", s.energy);
+        for (size_t j = 0; j < s.arrivals.size(); j++) {
+            print_row(s.train_id, "arrival" + std::to_string(j + 1), s.arrivals[j]);
+        }
+    }
+}
+//-----------------------------------------------------------------------------
+// quantiles q...
+// block k train code n_fail n_arrivals
+// run_time digest / energy digest / arrival digest (n_arrivals lines)
+//-----------------------------------------------------------------------------
+void save_montecarlo_sketch(FILE* fp, std::vector<MonteCarloStat>& blocks, const std::vector<double>& quantiles) {
+    fprintf(fp, "quantiles");
+    for (double q : quantiles) fprintf(fp, " %.17g", q);
+    fprintf(fp, "\n");
+    for (auto& s : blocks) {
+        fprintf(fp, "block %zu %d %d %zu %zu\n", s.block, s.train_id, s.code, s.n_fail, s.arrivals.size());
+        fprintf(fp, "run_time ");
+        s.run_time.write(fp);
+        fprintf(fp, "\nenergy ");
+        s.energy.write(fp);
+        fprintf(fp, "\n");
+        for (auto& d : s.arrivals) {
+            fprintf(fp, "arrival ");
+            d.write(fp);
+            fprintf(fp, "\n");
+        }
+    }
+}
+
+bool read_montecarlo_sketch(std::istream& in, std::vector<MonteCarloStat>* blocks, std::vector<double>* quantiles) {
+    std::string line, tag;
+    if (!std::getline(in, line)) return false;
+    std::istringstream qs(line);
+    if (!(qs >> tag) || tag != "quantiles") return false;
+    quantiles->clear();
+    double q;
+    while (qs >> q) quantiles->push_back(q);
+    blocks->clear();
+    while (in >> tag) {
+        MonteCarloStat s;
+        size_t n;
+        if (tag != "block" || !(in >> s.block >> s.train_id >> s.code >> s.n_fail >> n)) return false;
+        if (!(in >> tag) || tag != "run_time" || !s.run_time.read(in)) return false;
+        if (!(in >> tag) || tag != "energy" || !s.energy.read(in)) return false;
+        s.arrivals.resize(n);
+        for (auto& d : s.arrivals) {
+            if (!(in >> tag) || tag != "arrival" || !d.read(in)) return false;
+        }
+        blocks->push_back(std::move(s));
+    }
+    return true;
+}
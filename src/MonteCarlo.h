@@ -0,0 +1,95 @@
+/**
+ * Monte Carlo runs declared by the "montecarlo" object of the parameter file.
+ * The keys of a train (WT, spmargin, ...) and "dwell" (the stopping time of
+ * each stop) are drawn from distributions. Each sample has its own random
+ * stream made from the seed, the train id and the sample index. The samples
+ * of a train run in blocks of MONTECARLO_BLOCK; the run time, the arrival
+ * times and the energy of a block go into its own t-digests (TDigest.h), and
+ * the blocks are merged in their order. A result depends only on the seed
+ * and the block size, not on the threads or the shards.
+ */
+#ifndef MONTECARLO_H
+#define MONTECARLO_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <istream>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "train.h"
+#include "TDigest.h"
+////////////////////////////////////////////////////////////////////////////////
+constexpr size_t MONTECARLO_BLOCK = 32;     // samples of a block
+//-----------------------------------------------------------------------------
+// SplitMix64 (the same numbers on all platforms)
+class Rng {
+    uint64_t state;
+public:
+    Rng(uint64_t seed, uint64_t stream);
+    uint64_t next();
+    double uniform();   // [0, 1)
+    double normal();    // N(0, 1)
+};
+//-----------------------------------------------------------------------------
+// {"dist": "fixed", "value"}, {"dist": "uniform", "min", "max"},
+// {"dist": "normal", "mean", "sd"}, {"dist": "lognormal", "mean", "sd"},
+// {"dist": "triangular", "min", "mode", "max"}
+// normal and lognormal are clipped by "min" and "max" if given.
+//-----------------------------------------------------------------------------
+class Distribution {
+public:
+    enum Type { Fixed, Uniform, Normal, LogNormal, Triangular };
+    Type type;
+    double a, b, c;     // parameters of the type
+    double lo, hi;      // clipping
+public:
+    Distribution();
+    bool read_json(const nlohmann::json& jdata);
+    double sample(Rng& rng) const;
+};
+
+class MonteCarlo {
+public:
+    size_t samples;
+    uint64_t seed;
+    std::vector<int> train_ids;         // trains of the runs (empty: all trains)
+    std::vector<double> quantiles;      // reported quantiles
+    std::vector<std::string> keys;      // keys of the train (Sweep.h)
+    std::vector<Distribution> dists;    // distribution of each key
+    bool has_dwell;
+    Distribution dwell;                 // stopping time (s) of each stop
+public:
+    MonteCarlo();
+    // "samples", "seed", "trains", "quantiles", "params": {"key": distribution, "dwell": distribution}
+    // Return false if a key or a distribution is invalid
+    bool read_json(const nlohmann::json& jdata);
+    bool has_train(int id) const;
+    // Draw the values of a sample for the train of id and set them
+    void apply(Train& train, size_t sample) const;
+};
+// Aggregate of the Monte Carlo runs of a train or of a block of its samples
+struct MonteCarloStat {
+    int train_id;
+    size_t block;                   // block: train index x blocks of a train + block
+    int code;                       // 0: success, -2: no line
+    size_t n_fail;                  // runs failed (no line, train length or low power)
+    TDigest run_time;               // s
+    TDigest energy;                 // kJ
+    std::vector<TDigest> arrivals;  // arrival time at each stop (s)
+    MonteCarloStat(): train_id(0), block(0), code(0), n_fail(0) {};
+    void merge(const MonteCarloStat& s);
+    void flush();
+};
+//-----------------------------------------------------------------------------
+// Table of the count, mean, min, quantiles and max of each item
+//-----------------------------------------------------------------------------
+void print_montecarlo(FILE* fp, std::vector<MonteCarloStat>& stats, const std::vector<double>& quantiles);
+// Merge the blocks in the order of block into the stats of the trains
+void merge_montecarlo_blocks(const std::vector<MonteCarloStat>& blocks, std::vector<MonteCarloStat>* stats);
+// The digests of the blocks (to be merged with the other shards)
+void save_montecarlo_sketch(FILE* fp, std::vector<MonteCarloStat>& blocks, const std::vector<double>& quantiles);
+// Read the sketch saved by save_montecarlo_sketch. Return false if invalid.
+bool read_montecarlo_sketch(std::istream& in, std::vector<MonteCarloStat>* blocks, std::vector<double>* quantiles);
+
+#endif
@@ -0,0 +1,36 @@
+#include <thread>
+#include <atomic>
+#include <vector>
+#include "Parallel.h"
+////////////////////////////////////////////////////////////////////////////////
+int hardware_threads() {
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n > 0) ? (int)n : 1;
+}
+//-----------------------------------------------------------------------------
+// Workers are not more than the items
+//-----------------------------------------------------------------------------
+int worker_count(int n, size_t n_items) {
+    if (n <= 0) n = hardware_threads();
+    if ((size_t)n > n_items) n = (int)n_items;
+    return (n > 0) ? n : 1;
+}
+//-----------------------------------------------------------------------------
+// The calling thread is the worker 0.
+//-----------------------------------------------------------------------------
+void parallel_for(size_t n, int nthreads, const std::function<void(size_t, int)>& job) {
+    if (n == 0) return;
+    int nw = worker_count(nthreads, n);
+    std::atomic<size_t> next(0);
+    auto work = [&](int worker) {
+        while (true) {
+            size_t i = next.fetch_add(1);
+            if (i >= n) break;
+            job(i, worker);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int w = 1; w < nw; w++) threads.emplace_back(work, w);
+    work(0);
+    for (auto& t : threads) t.join();
+}
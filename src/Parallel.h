@@ -0,0 +1,20 @@
+/**
+ * Simple parallel loop used by the batch, sweep and analysis modes.
+ * Work items are taken in order by the workers, so the result of each item
+ * must not depend on the worker that runs it.
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <functional>
+////////////////////////////////////////////////////////////////////////////////
+// Number of hardware threads (at least 1)
+int hardware_threads();
+// Number of workers for the request n (n <= 0: all hardware threads)
+int worker_count(int n, size_t n_items);
+// Run job(i, worker) for i = 0 .. n-1 on nthreads workers.
+// worker is 0 .. (number of workers - 1).
+void parallel_for(size_t n, int nthreads, const std::function<void(size_t, int)>& job);
+
+#endif
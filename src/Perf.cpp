@@ -0,0 +1,116 @@
+#include <string.h>
+#include <mutex>
+#include "Perf.h"
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+namespace perf {
+
+const char* event_name[nEvent] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+static std::mutex reason_mutex;
+static std::string last_reason;
+
+static void set_reason(const std::string& str) {
+    std::lock_guard<std::mutex> lock(reason_mutex);
+    last_reason = str;
+}
+
+std::string reason() {
+    std::lock_guard<std::mutex> lock(reason_mutex);
+    return last_reason;
+}
+//-----------------------------------------------------------------------------
+Counters::Counters() {
+    for (int i = 0; i < nEvent; i++) {
+        fd[i] = -1;
+        index[i] = -1;
+    }
+    n_open = 0;
+}
+
+Counters::~Counters() {
+    close();
+}
+
+#ifdef __linux__
+static const uint64_t event_config[nEvent] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+};
+//-----------------------------------------------------------------------------
+// One group of the user-space events of this thread
+// The members that cannot be opened are not counted.
+//-----------------------------------------------------------------------------
+bool Counters::open() {
+    close();
+    for (int i = 0; i < nEvent; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = event_config[i];
+        attr.disabled = (i == Cycles) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int group = (i == Cycles) ? -1 : fd[Cycles];
+        fd[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+        if (fd[i] < 0) {
+            if (i == Cycles) {
+                set_reason(std::string("perf_event_open: ") + strerror(errno));
+                return false;
+            }
+            continue;
+        }
+        index[i] = n_open++;
+    }
+    ioctl(fd[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fd[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void Counters::close() {
+    for (int i = nEvent - 1; i >= 0; i--) {
+        if (fd[i] >= 0) ::close(fd[i]);
+        fd[i] = -1;
+        index[i] = -1;
+    }
+    n_open = 0;
+}
+//-----------------------------------------------------------------------------
+// Layout of the group read: nr, time_enabled, time_running, value[nr]
+//-----------------------------------------------------------------------------
+bool Counters::read(uint64_t v[nEvent]) {
+    uint64_t buf[3 + nEvent];
+    if (n_open == 0) return false;
+    ssize_t n = ::read(fd[Cycles], buf, sizeof(buf));
+    if (n < (ssize_t)(3 * sizeof(uint64_t)) || buf[0] != (uint64_t)n_open) return false;
+    double scale = 1.0;
+    if (buf[2] > 0 && buf[2] < buf[1]) scale = (double)buf[1] / buf[2];
+    for (int i = 0; i < nEvent; i++) {
+        v[i] = (index[i] >= 0) ? (uint64_t)(buf[3 + index[i]] * scale) : 0;
+    }
+    return true;
+}
+#else
+bool Counters::open() {
+    set_reason("perf_event_open is only on Linux");
+    return false;
+}
+
+void Counters::close() {
+    n_open = 0;
+}
+
+bool Counters::read(uint64_t v[nEvent]) {
+    return false;
+}
+#endif
+
+}
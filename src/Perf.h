@@ -0,0 +1,40 @@
+/**
+ * Hardware performance counters of the calling thread (perf_event_open).
+ * Only on Linux. If the counters cannot be opened (other platforms, no
+ * permission, containers or virtual machines without a PMU), open() returns
+ * false and reason() tells why; the caller goes on without counters.
+ */
+#ifndef PERF_H
+#define PERF_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+namespace perf {
+
+enum Event { Cycles, Instructions, CacheMisses, BranchMisses, nEvent };
+extern const char* event_name[nEvent];
+
+class Counters {
+    int fd[nEvent];     // fd[Cycles] is the group leader. -1: not counted
+    int index[nEvent];  // position in the group read. -1: not counted
+    int n_open;
+public:
+    Counters();
+    ~Counters();
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+    // Open and start the counters of this thread
+    bool open();
+    void close();
+    bool is_open() const { return n_open > 0; }
+    bool has(Event e) const { return index[e] >= 0; }
+    // Current values (scaled if the counters were multiplexed)
+    bool read(uint64_t v[nEvent]);
+};
+// Reason of the last failure of open()
+std::string reason();
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include "Preview.h"
+#include "common.h"
+////////////////////////////////////////////////////////////////////////////////
+//-----------------------------------------------------------------------------
+// The limit of a segment holds from its start until the tail leaves it
+// (unless head_only), as in get_min_speed. The pieces are cut at the
+// segments, at the ends of the held limits and at the stops. The envelope
+// comes from the cache of the train if it has one.
+//-----------------------------------------------------------------------------
+Preview::Preview(const Train& t) : train(t) {
+    code = 0;
+    std::shared_ptr<RailLine> line = train.get_line();
+    if (!line || line->nSegment() == 0) {
+        code = -2;
+        return;
+    }
+    const SegmentList& segs = line->segs;
+    std::shared_ptr<EnvelopeCache> cache = train.get_envelope_cache();
+    std::shared_ptr<const SpeedEnvelope> env;
+    if (cache) env = cache->get(*line, train.dec, train.length, train.spmargin);
+    else env = std::make_shared<const SpeedEnvelope>(*line, train.dec, train.length, train.spmargin);
+    double x_start = segs[0].length / 2 + train.length / 2;
+    double x_end = line->length();
+    if (x_start > x_end) {
+        code = -1;
+        return;
+    }
+    // stops and dwells
+    stops.push_back(x_start);
+    for (size_t i = 1; i < segs.size(); i++) {
+        if (segs[i].type != SegmentType::Station) continue;
+        double x = segs[i].distance + segs[i].length / 2 + train.length / 2;
+        if (x <= stops.back()) continue;
+        size_t n = stops.size() - 1;
+        if (n < train.dwell_times.size()) dwells.push_back(train.dwell_times[n]);
+        else if (segs[i].tm_stop > 0) dwells.push_back(segs[i].tm_stop);
+        else dwells.push_back(Control::station_time);
+        stops.push_back(x);
+    }
+    if (segs.back().type != SegmentType::Station && x_end > stops.back()) {
+        dwells.push_back(0);
+        stops.push_back(x_end);
+    }
+    x_end = stops.back();
+    // cut points
+    std::vector<double> cuts(stops.begin(), stops.end());
+    for (const auto& seg : segs) {
+        cuts.push_back(seg.distance);
+        if (!seg.head_only) cuts.push_back(seg.distance + seg.length + train.length);
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+    size_t head = 0;
+    size_t next_stop = 0;
+    for (size_t k = 0; k + 1 < cuts.size(); k++) {
+        Piece p;
+        p.from = cuts[k];
+        p.to = cuts[k + 1];
+        if (p.to <= x_start || p.from >= x_end) continue;
+        while (head + 1 < segs.size() && segs[head + 1].distance <= p.from) head++;
+        p.limit = train.max_speed;
+        for (size_t i = head + 1; i-- > 0; ) {
+            const Segment& seg = segs[i];
+            double ext = seg.head_only ? 0.0 : train.length;
+            if (seg.distance + seg.length + ext <= p.from) {
+                if (seg.distance + seg.length + train.length <= p.from) break;
+                continue;
+            }
+            p.limit = std::min(p.limit, env->max_speed[i]);
+        }
+        p.limit /= 3.6;
+        if (train.b_avg_resist) line->average_profile(p.from - train.length, p.from, &p.gradient, &p.radius);
+        else {
+            p.gradient = segs[head].gradient;
+            p.radius = segs[head].radius;
+        }
+        while (next_stop < stops.size() && stops[next_stop] <= p.from) {
+            first_piece.push_back(pieces.size());
+            next_stop++;
+        }
+        pieces.push_back(p);
+    }
+    first_piece.push_back(pieces.size());
+}
+//-----------------------------------------------------------------------------
+// Backward: the braking level c (v^2 = c - 2 dec x) at the end of each piece.
+// Forward: the driving of update. The train accelerates by speed bands up
+// to the limit and then coasts (or holds the speed with b_fix_speed) until
+// a higher limit, the re-acceleration speed or the braking parabola. v^2 is
+// linear in x in every phase; a coasting step advances the distance twice
+// in update, so v^2 changes by a (not 2 a) per m while coasting.
+//-----------------------------------------------------------------------------
+double Preview::section_time(size_t j, const DriveSection& drive) const {
+    if (code != 0 || j >= sections()) return HUGE_VAL;
+    const double dec = train.dec;
+    const double band = PREVIEW_BAND / 3.6;
+    size_t k0 = first_piece[j], k1 = first_piece[j + 1];
+    std::vector<double> level(k1 - k0);
+    double c = 2 * dec * stops[j + 1];
+    for (size_t k = k1; k-- > k0; ) {
+        level[k - k0] = c;
+        double lim = pieces[k].limit;
+        if (drive.cruise > 0) lim = std::min(lim, drive.cruise / 3.6);
+        c = std::min(c, lim * lim + 2 * dec * pieces[k].from);
+    }
+    double t = 0, v = 0, lim0 = 0;
+    bool coasting = false;
+    for (size_t k = k0; k < k1; k++) {
+        const Piece& p = pieces[k];
+        double lim = p.limit;
+        if (drive.cruise > 0) lim = std::min(lim, drive.cruise / 3.6);
+        if (lim <= 0) return HUGE_VAL;
+        double lv = level[k - k0];
+        double x = p.from;
+        v = std::min(v, lim);
+        if (coasting && lim > lim0) coasting = false;
+        lim0 = lim;
+        while (x < p.to) {
+            bool coast_only = (x >= drive.coast_at) && (v > 0);
+            if (coast_only) coasting = true;
+            else if (coasting && train.b_reaccel && v <= lim - train.reaccel_speed) coasting = false;
+            double end = (!coast_only && drive.coast_at > x) ? std::min(p.to, drive.coast_at) : p.to;
+            double a = 0, slope = 0, vt = v;    // slope: of v^2 per m
+            if (coasting) {
+                if (!train.b_fix_speed || coast_only) {
+                    double lo = std::max(std::ceil(v / band - 1e-9) - 1, 0.0) * band;
+                    if (train.b_reaccel && !coast_only) lo = std::max(lo, lim - train.reaccel_speed);
+                    a = train.df((v + lo) / 2, p.gradient, p.radius, true);
+                    if (a < 0) {
+                        vt = lo;
+                        slope = a;
+                    } else a = 0;   // held on a slope
+                }
+            } else if (v < lim) {
+                vt = std::min((std::floor(v / band + 1e-9) + 1) * band, lim);
+                a = train.df((v + vt) / 2, p.gradient, p.radius, false);
+                if (a <= 0) return HUGE_VAL;
+                slope = 2 * a;
+            } else if (!train.b_fix_speed) {
+                coasting = true;
+                continue;
+            }
+            // the end of the phase and the point where it meets the braking parabola
+            double x1 = (slope == 0) ? end : std::min(x + (vt * vt - v * v) / slope, end);
+            double xb = (slope + 2 * dec > 0) ? (lv - v * v + slope * x) / (slope + 2 * dec) : HUGE_VAL;
+            bool brake = xb < x1;
+            if (brake) x1 = std::max(xb, x);
+            if (slope == 0) t += (x1 - x) / v;
+            else {
+                double v1 = std::sqrt(std::max(v * v + slope * (x1 - x), 0.0));
+                if (v1 <= 0) return HUGE_VAL;
+                t += (v1 - v) / a;
+                v = (brake || x1 == end) ? v1 : vt;
+            }
+            x = x1;
+            if (brake) {
+                double v1 = std::sqrt(std::max(lv - 2 * dec * p.to, 0.0));
+                t += std::max(v - v1, 0.0) / dec;
+                v = v1;
+                break;
+            }
+        }
+    }
+    return t;
+}
+//-----------------------------------------------------------------------------
+double Preview::run_time() const {
+    if (code != 0 || sections() == 0) return HUGE_VAL;
+    double t = 0;
+    for (size_t j = 0; j < sections(); j++) {
+        double ts = section_time(j);
+        if (ts == HUGE_VAL) return HUGE_VAL;
+        t += ts;
+        if (j + 1 < sections()) t = std::ceil(t) + dwells[j];
+    }
+    return t;
+}
+//-----------------------------------------------------------------------------
+void print_preview(FILE* fp, const std::vector<PreviewStat>& stats) {
+    fprintf(fp, "train\tcode\tstops\tpreview_time\trun_time\terror\tpreview_us\trun_us\n");
+    for (const auto& s : stats) {
+        fprintf(fp, "%d\t%d\t%zu\t", s.train_id, s.code, s.stops);
+        if (s.code != 0 || s.preview_time == HUGE_VAL) {
+            fprintf(fp, "-\t%.3f\t-\t%.1f\t%.1f\n", s.run_time, s.preview_us, s.run_us);
+            continue;
+        }
+        double err = (s.preview_time - s.run_time) / s.run_time;
+        fprintf(fp, "%.3f\t%.3f\t%.4f\t%.1f\t%.1f\n", s.preview_time, s.run_time, err, s.preview_us, s.run_us);
+    }
+}
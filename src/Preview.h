@@ -0,0 +1,65 @@
+/**
+ * Kinematic preview of a run (--preview) for quick feasibility checks.
+ * The line is cut into pieces of the same speed limit (the envelope of the
+ * train, kept until the tail leaves a segment) and the same gradient. In a
+ * piece the train accelerates with a constant acceleration in each speed
+ * band (PREVIEW_BAND): the force less the resistance at the middle of the
+ * band, so fixed_acc acts through the fixed force of the SIMPLE method.
+ * At the limit it coasts (or holds the speed) as in update, and braking is
+ * the parabola of dec to the next lower limit or the stop. Each phase is
+ * solved in closed form, so a line takes microseconds. The time step of the
+ * full model is not modelled; --preview reports the error of full runs.
+ */
+#ifndef PREVIEW_H
+#define PREVIEW_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <vector>
+#include "train.h"
+////////////////////////////////////////////////////////////////////////////////
+constexpr double PREVIEW_BAND = 10.0;       // km/h: speed band of a constant acceleration
+constexpr double PREVIEW_MARGIN = 0.05;     // default margin of the pre-filters (ratio)
+//-----------------------------------------------------------------------------
+class Preview {
+    struct Piece {
+        double from, to;        // m: head of the train
+        double limit;           // m/s
+        double gradient, radius;
+    };
+    const Train& train;
+    std::vector<Piece> pieces;
+    std::vector<double> stops;          // m: stopping points from the start of the run
+    std::vector<size_t> first_piece;    // the first piece of each section (and the end)
+    std::vector<double> dwells;         // s: stopping time at each stop after the start
+public:
+    int code;       // 0: success, -1: train length, -2: no line
+public:
+    // The train needs the traction and the line (RunControl::set_train_line)
+    Preview(const Train& train);
+    // Sections between stops
+    size_t sections() const { return stops.empty() ? 0 : stops.size() - 1; };
+    double section_start(size_t j) const { return stops[j]; };
+    double section_end(size_t j) const { return stops[j + 1]; };
+    // Time of the section j (s) from the departure to the arrival with the
+    // driving. [Return] HUGE_VAL if the train stalls (low power or coasting)
+    double section_time(size_t j, const DriveSection& drive = DriveSection()) const;
+    // Run time to the end of the line with the stops (departures rounded up
+    // to a second as in the full model). [Return] HUGE_VAL if it stalls
+    double run_time() const;
+};
+//-----------------------------------------------------------------------------
+// Result of a train in RunControl::preview: the preview against the full run
+struct PreviewStat {
+    int train_id;
+    int code;           // 0: success, -1: train length, -2: no line, -3: low power
+    size_t stops;       // stops after the start
+    double preview_time;    // s (HUGE_VAL: stalls in the preview)
+    double run_time;        // s: full model
+    double preview_us;      // wall time of the preview (microseconds)
+    double run_us;          // wall time of the full run (microseconds)
+    PreviewStat(): train_id(0), code(0), stops(0), preview_time(0), run_time(0), preview_us(0), run_us(0) {};
+};
+// Table of the trains: the preview time against the full run and the error
+void print_preview(FILE* fp, const std::vector<PreviewStat>& stats);
+
+#endif
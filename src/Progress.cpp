@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include "Progress.h"
+////////////////////////////////////////////////////////////////////////////////
+Progress::Progress(int n_workers, uint64_t total_runs, double interval, bool print, const std::string& status_fname)
+    : n_slots(n_workers), slots(new ProgressSlot[n_workers]), total_runs(total_runs),
+      interval(interval), print(print), status_fname(status_fname), stop(false) {
+    if (this->interval <= 0) this->interval = 1.0;
+    t0 = std::chrono::steady_clock::now();
+}
+
+Progress::~Progress() {
+    finish();
+}
+//-----------------------------------------------------------------------------
+void Progress::start() {
+    t0 = std::chrono::steady_clock::now();
+    reporter = std::thread([this]() {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto wait = std::chrono::duration<double>(interval);
+        while (!cv.wait_for(lock, wait, [this]() { return stop; })) {
+            report(false);
+        }
+    });
+}
+
+void Progress::finish() {
+    if (!reporter.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    reporter.join();
+    report(true);
+}
+//-----------------------------------------------------------------------------
+// ETA is estimated from the runs completed
+// The status file is replaced (rename) so that readers see a whole file.
+//-----------------------------------------------------------------------------
+void Progress::report(bool last) {
+    uint64_t runs = 0, ticks = 0, bytes = 0;
+    for (int i = 0; i < n_slots; i++) {
+        runs += slots[i].runs.load(std::memory_order_relaxed);
+        ticks += slots[i].ticks.load(std::memory_order_relaxed);
+        bytes += slots[i].bytes.load(std::memory_order_relaxed);
+    }
+    double el = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    double tick_rate = (el > 0) ? ticks / el : 0;
+    double byte_rate = (el > 0) ? bytes / el : 0;
+    double eta = -1;
+    if (runs >= total_runs) eta = 0;
+    else if (runs > 0) eta = el * (total_runs - runs) / runs;
+    if (print) {
+        fprintf(stderr, "[%s] %.1f s: runs %llu/%llu, %.3g ticks/s, %.2f MB/s",
+            last ? "done" : "progress", el, (unsigned long long)runs, (unsigned long long)total_runs,
+            tick_rate, byte_rate / 1e6);
+        if (eta >= 0) fprintf(stderr, ", ETA %.0f s\n", eta);
+        else fprintf(stderr, ", ETA -\n");
+    }
+    if (!status_fname.empty()) {
+        std::string tmp = status_fname + ".tmp";
+        FILE* fp = fopen(tmp.c_str(), "wt");
+        if (fp == NULL) return;
+        fprintf(fp, "{\"done\": %s, \"elapsed\": %.3f, \"runs\": %llu, \"total_runs\": %llu, "
+            "\"ticks\": %llu, \"bytes\": %llu, \"ticks_per_s\": %.1f, \"bytes_per_s\": %.1f, \"eta\": %.1f}\n",
+            last ? "true" : "false", el, (unsigned long long)runs, (unsigned long long)total_runs,
+            (unsigned long long)ticks, (unsigned long long)bytes, tick_rate, byte_rate, eta);
+        fclose(fp);
+#ifdef _WIN32
+        remove(status_fname.c_str());
+#endif
+        rename(tmp.c_str(), status_fname.c_str());
+    }
+}
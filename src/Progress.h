@@ -0,0 +1,56 @@
+/**
+ * Progress of long batch runs (--progress, --status-file).
+ * Each worker has its own slot of counters on its own cache line. Only the
+ * worker writes its slot (relaxed atomic stores, no lock), and the reporter
+ * thread reads all slots at every interval.
+ */
+#ifndef PROGRESS_H
+#define PROGRESS_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+////////////////////////////////////////////////////////////////////////////////
+struct alignas(64) ProgressSlot {
+    std::atomic<uint64_t> runs;     // runs completed
+    std::atomic<uint64_t> ticks;    // main_run calls
+    std::atomic<uint64_t> bytes;    // bytes written
+    ProgressSlot() : runs(0), ticks(0), bytes(0) {}
+    // Only the owner of the slot may call these
+    void add_run() { runs.store(runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+    void add(uint64_t n_ticks, uint64_t n_bytes) {
+        ticks.store(ticks.load(std::memory_order_relaxed) + n_ticks, std::memory_order_relaxed);
+        bytes.store(bytes.load(std::memory_order_relaxed) + n_bytes, std::memory_order_relaxed);
+    }
+};
+
+class Progress {
+    int n_slots;
+    std::unique_ptr<ProgressSlot[]> slots;
+    uint64_t total_runs;
+    double interval;            // seconds
+    bool print;                 // print to stderr
+    std::string status_fname;   // status file (empty: none)
+    std::thread reporter;
+    std::mutex mtx;             // only for the reporter to sleep
+    std::condition_variable cv;
+    bool stop;
+    std::chrono::steady_clock::time_point t0;
+public:
+    // Ticks and bytes are published every publish_ticks ticks
+    static const uint64_t publish_ticks = 1024;
+    Progress(int n_workers, uint64_t total_runs, double interval, bool print, const std::string& status_fname);
+    ~Progress();
+    ProgressSlot& slot(int worker) { return slots[worker]; }
+    void start();
+    // Stop the reporter and report the last state
+    void finish();
+    void report(bool last);
+};
+
+#endif
@@ -4,17 +4,25 @@
 #include <string.h>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include <cmath>
+#include <algorithm>
 ////////////////////////////////////////////////////////////////////////////////
 #include "RailLine.h"
+#include "Metrics.h"
+#include "Trace.h"
 ////////////////////////////////////////////////////////////////////////////////
 const int SegmentType::Normal  = 0;
 const int SegmentType::Station = 1;
 const int SegmentType::Point   = 2;
+// Source of RailLine::serial. Caches of line data use it as a key.
+static std::atomic<unsigned long> serial_counter(0);
 //-----------------------------------------------------------------------------
 // initialize the Segment class in constructor
 //-----------------------------------------------------------------------------
 Segment::Segment() {
 	id = 0;
+	last_id = 0;
     type = 0;
     distance = 0.0;
     length = 0.0;
@@ -63,6 +71,7 @@ int loadsegdata(const char* fname, std::vector<Segment>& segs) {
 		}
 		Segment seg;
         seg.id = id;
+        seg.last_id = id;
         seg.type = type;
         seg.distance = distance;
 		seg.length = length;
@@ -100,18 +109,105 @@ int loadsegdata(const char* fname, std::vector<Segment>& segs) {
 ///  RailLine: Read line data file
 //------------------------------------------------------------------------------
 int RailLine::read(const char* fname) {
+	METRIC_PHASE(Line);
+	TRACE_SPAN("RailLine::read", "load");
 	segs.clear();
-	return loadsegdata(fname, segs);
+	int ret = loadsegdata(fname, segs);
+	touch();
+	return ret;
 }
 //------------------------------------------------------------------------------
 ///  RailLine: Constructor
 //------------------------------------------------------------------------------
-RailLine::RailLine() {
+RailLine::RailLine() : mem(memory::Line) {
 	id = 0;
 	FnSegment = 0;
 	FnStation = 0;
+	touch();
 };
 //------------------------------------------------------------------------------
+///  RailLine: Give a new serial number after changing segments
+//------------------------------------------------------------------------------
+void RailLine::touch() {
+	serial = ++serial_counter;
+	make_prefix_sums();
+	mem.set((int64_t)(segs.capacity() * sizeof(Segment)
+		+ (grade_sum.capacity() + curve_sum.capacity()) * sizeof(double)));
+}
+//------------------------------------------------------------------------------
+///  RailLine: Make the prefix sums of the gradient and the curvature
+///  grade_sum[i] = integral of sin(gradient) from the start to segs[i].distance
+///  curve_sum[i] = integral of 1/radius from the start to segs[i].distance
+//------------------------------------------------------------------------------
+void RailLine::make_prefix_sums() {
+	grade_sum.resize(segs.size());
+	curve_sum.resize(segs.size());
+	double g = 0.0;
+	double c = 0.0;
+	for (size_t i = 0; i < segs.size(); i++) {
+		grade_sum[i] = g;
+		curve_sum[i] = c;
+		double gr0 = segs[i].gradient / 100;
+		g += gr0 / std::sqrt(1 + gr0 * gr0) * segs[i].length;
+		if (segs[i].radius > 0) c += segs[i].length / segs[i].radius;
+	}
+}
+//------------------------------------------------------------------------------
+///  RailLine: Index of the segment including x (0 if x is before the start)
+//------------------------------------------------------------------------------
+size_t RailLine::find_segment(double x) const {
+	auto it = std::upper_bound(segs.begin(), segs.end(), x,
+		[](double d, const Segment& s) { return d < s.distance; });
+	if (it == segs.begin()) return 0;
+	return (size_t)(it - segs.begin()) - 1;
+}
+//------------------------------------------------------------------------------
+///  RailLine: Integral of sin(gradient) from the start to x (m)
+///  x is limited to the range of the line
+//------------------------------------------------------------------------------
+double RailLine::grade_integral(double x) const {
+	if (segs.empty()) return 0.0;
+	size_t i = find_segment(x);
+	const Segment& s = segs[i];
+	double dx = std::min(std::max(x - s.distance, 0.0), s.length);
+	double gr0 = s.gradient / 100;
+	return grade_sum[i] + gr0 / std::sqrt(1 + gr0 * gr0) * dx;
+}
+//------------------------------------------------------------------------------
+///  RailLine: Integral of 1/radius from the start to x
+//------------------------------------------------------------------------------
+double RailLine::curve_integral(double x) const {
+	if (segs.empty()) return 0.0;
+	size_t i = find_segment(x);
+	const Segment& s = segs[i];
+	if (s.radius <= 0) return curve_sum[i];
+	double dx = std::min(std::max(x - s.distance, 0.0), s.length);
+	return curve_sum[i] + dx / s.radius;
+}
+//------------------------------------------------------------------------------
+///  RailLine: Gradient (%) and radius (m) equivalent to the average between
+///  x1 (tail) and x2 (head). The part out of the line is ignored.
+//------------------------------------------------------------------------------
+void RailLine::average_profile(double x1, double x2, double* gradient, double* radius) const {
+	*gradient = 0.0;
+	*radius = 0.0;
+	if (segs.empty()) return;
+	double start = segs.front().distance;
+	double end = segs.back().distance + segs.back().length;
+	x1 = std::max(x1, start);
+	x2 = std::min(x2, end);
+	if (x2 - x1 <= 0) {
+		const Segment& s = segs[find_segment(x2)];
+		*gradient = s.gradient;
+		*radius = s.radius;
+		return;
+	}
+	double sn = (grade_integral(x2) - grade_integral(x1)) / (x2 - x1);
+	double inv = (curve_integral(x2) - curve_integral(x1)) / (x2 - x1);
+	*gradient = 100 * sn / std::sqrt(1 - sn * sn);
+	if (inv > 0) *radius = 1 / inv;
+}
+//------------------------------------------------------------------------------
 ///  RailLine: get the pointer of Segment i
 //------------------------------------------------------------------------------
 Segment* RailLine::getSegment(int i) {
@@ -127,6 +223,7 @@ void RailLine::init(int n) {
 	if( n <= 0 ) return;
 	segs.resize(n);
 	FnSegment = n;
+	touch();
 }
 //------------------------------------------------------------------------------
 ///  Clear
@@ -136,6 +233,7 @@ void RailLine::clear() {
 	FnSegment = 0;
 	FnStation = 0;
 	name.clear();
+	touch();
 }
 //------------------------------------------------------------------------------
 ///  set a Segment
@@ -143,6 +241,7 @@ void RailLine::clear() {
 void RailLine::setSegment(int i, const Segment& s) {
 	if(i< 0 || i >= FnSegment) return;
 	segs[i] = s;
+	touch();
 }
 //------------------------------------------------------------------------------
 ///  test print
@@ -184,6 +283,7 @@ void RailLine::make_reverse(const RailLine& r)
 	}
 	// The number of stations must be the same
 	FnStation = r.nStation();
+	touch();
 }
 
 
@@ -194,6 +294,36 @@ void RailLine::reset()
 	}
 }
 //------------------------------------------------------------------------------
+//  Merge the runs of adjacent normal segments whose speed, gradient, radius
+//  and type are the same. The merged segment keeps the id of the first one
+//  and last_id of the last one for reporting.
+//  Stations and switches are not merged.
+//  [Return] the number of removed segments
+//------------------------------------------------------------------------------
+int RailLine::coalesce()
+{
+	if( segs.size() < 2 ) return 0;
+	size_t n = 0;
+	for(size_t i = 1; i < segs.size(); i++) {
+		Segment& pre = segs[n];
+		const Segment& cur = segs[i];
+		if( pre.type == SegmentType::Normal && cur.type == SegmentType::Normal &&
+			pre.speed == cur.speed && pre.gradient == cur.gradient &&
+			pre.radius == cur.radius && pre.head_only == cur.head_only ) {
+			pre.length += cur.length;
+			pre.last_id = cur.last_id;
+		} else {
+			n++;
+			if( n != i ) segs[n] = cur;
+		}
+	}
+	int removed = (int)(segs.size() - (n + 1));
+	segs.resize(n + 1);
+	if( FnSegment > 0 ) FnSegment = (int)segs.size();
+	if( removed > 0 ) touch();
+	return removed;
+}
+//------------------------------------------------------------------------------
 //  Return total length
 //------------------------------------------------------------------------------
 double RailLine::length() const
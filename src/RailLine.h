@@ -9,6 +9,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include <vector>
 #include <string>
+#include "Memory.h"
 ////////////////////////////////////////////////////////////////////////////////
 struct SegmentType {
 	static const int Normal;
@@ -22,6 +23,7 @@ struct SegmentType {
 class Segment {
 public:
     int id;
+    int last_id;        // id of the last original segment merged into this one
     int type;           // 0:normal 1:station 2: switch
     double distance;    // begining point of this segment (m)
     double length;      // should be the same as next->distance - this->distance
@@ -48,6 +50,11 @@ private:
 	int id;
 	int FnSegment;
 	int FnStation;
+	unsigned long serial;   // changed whenever segs are changed
+	// Prefix sums at the beginning of each segment (updated by touch)
+	std::vector<double> grade_sum;  // integral of sin(gradient) (m)
+	std::vector<double> curve_sum;  // integral of 1/radius (-)
+	memory::Charge mem;             // segs and prefix sums (updated by touch)
 public:
 	std::vector<Segment> segs;
 	std::string name;
@@ -64,7 +71,17 @@ public:
 	void make_reverse(const RailLine& r);
 	int getID() const { return id;};
 	void setID(int n) {id = n;};
+	unsigned long getSerial() const { return serial; };
+	void touch();   // call after changing segs directly
+	double grade_integral(double x) const;
+	double curve_integral(double x) const;
+	void average_profile(double x1, double x2, double* gradient, double* radius) const;
 	void reset();   // speed = max_speed
+	int coalesce(); // merge adjacent segments having the same attributes
+private:
+	void make_prefix_sums();
+	size_t find_segment(double x) const;
+public:
 	void test_print();
 	int read(const char* fname);
 };
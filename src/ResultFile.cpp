@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+#include "ResultFile.h"
+#include "Parallel.h"
+#include "Memory.h"
+////////////////////////////////////////////////////////////////////////////////
+void ResultColumns::resize(size_t n) {
+    status.resize(n);
+    time.resize(n);
+    distance.resize(n);
+    speed.resize(n);
+    accel.resize(n);
+    force.resize(n);
+    power.resize(n);
+}
+
+int64_t ResultColumns::bytes() const {
+    return (int64_t)(status.capacity() * sizeof(int) + (time.capacity() + distance.capacity()
+        + speed.capacity() + accel.capacity() + force.capacity() + power.capacity()) * sizeof(double));
+}
+//-----------------------------------------------------------------------------
+// Numbers: from_chars if the library has the floating point version
+//-----------------------------------------------------------------------------
+static inline const char* skip_blank(const char* p, const char* e) {
+    while (p < e && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static inline bool parse_number(const char*& p, const char* e, double& v) {
+    p = skip_blank(p, e);
+#if defined(__cpp_lib_to_chars)
+    if (p < e && *p == '+') p++;
+    auto r = std::from_chars(p, e, v);
+    if (r.ec != std::errc()) return false;
+    p = r.ptr;
+#else
+    // strtod needs a terminator: the line always ends with '\n' or e
+    char buf[64];
+    size_t n = 0;
+    while (p + n < e && n < sizeof(buf) - 1 && p[n] != '\t' && p[n] != ' ' && p[n] != '\n' && p[n] != '\r') n++;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    char* end;
+    v = strtod(buf, &end);
+    if (end == buf) return false;
+    p += end - buf;
+#endif
+    return true;
+}
+
+static inline bool parse_number(const char*& p, const char* e, int& v) {
+    p = skip_blank(p, e);
+#if __cplusplus >= 201703L
+    if (p < e && *p == '+') p++;
+    auto r = std::from_chars(p, e, v);
+    if (r.ec != std::errc()) return false;
+    p = r.ptr;
+#else
+    double x;
+    if (!parse_number(p, e, x)) return false;
+    v = (int)x;
+#endif
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Number of lines in [p, e). A last line without '\n' is counted.
+//-----------------------------------------------------------------------------
+static size_t count_lines(const char* p, const char* e) {
+    size_t n = 0;
+    const char* q = p;
+    while (q < e) {
+        const char* nl = (const char*)memchr(q, '\n', e - q);
+        if (nl == NULL) {
+            n++;
+            break;
+        }
+        n++;
+        q = nl + 1;
+    }
+    return n;
+}
+//-----------------------------------------------------------------------------
+// Parse the lines in [p, e) into the rows from k
+//-----------------------------------------------------------------------------
+static bool parse_lines(const char* p, const char* e, ResultColumns* c, size_t k) {
+    while (p < e) {
+        const char* nl = (const char*)memchr(p, '\n', e - p);
+        const char* le = nl ? nl : e;
+        if (skip_blank(p, le) == le) return false;   // empty line
+        const char* q = p;
+        if (!parse_number(q, le, c->status[k]) || !parse_number(q, le, c->time[k])
+            || !parse_number(q, le, c->distance[k]) || !parse_number(q, le, c->speed[k])
+            || !parse_number(q, le, c->accel[k]) || !parse_number(q, le, c->force[k])
+            || !parse_number(q, le, c->power[k])) return false;
+        k++;
+        p = nl ? nl + 1 : e;
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Ranges: at least 256 KB each, 4 per worker
+//-----------------------------------------------------------------------------
+bool parse_result_rows(const char* begin, const char* end, ResultColumns* cols, int nthreads) {
+    const size_t min_chunk = 256 * 1024;
+    size_t len = end - begin;
+    int nw = worker_count(nthreads, 1 + len / min_chunk);
+    size_t n_chunk = std::max<size_t>(1, std::min<size_t>((size_t)nw * 4, 1 + len / min_chunk));
+    std::vector<const char*> bound(n_chunk + 1);
+    bound[0] = begin;
+    bound[n_chunk] = end;
+    for (size_t i = 1; i < n_chunk; i++) {
+        const char* p = std::max(begin + len * i / n_chunk, bound[i - 1]);
+        const char* nl = (p < end) ? (const char*)memchr(p, '\n', end - p) : NULL;
+        bound[i] = nl ? nl + 1 : end;
+    }
+    std::vector<size_t> start(n_chunk + 1, 0);
+    parallel_for(n_chunk, nw, [&](size_t i, int) {
+        start[i + 1] = count_lines(bound[i], bound[i + 1]);
+    });
+    for (size_t i = 0; i < n_chunk; i++) start[i + 1] += start[i];
+    cols->resize(start[n_chunk]);
+    std::atomic<bool> ok(true);
+    parallel_for(n_chunk, nw, [&](size_t i, int) {
+        if (!parse_lines(bound[i], bound[i + 1], cols, start[i])) ok = false;
+    });
+    if (!ok) cols->clear();
+    return ok;
+}
+//-----------------------------------------------------------------------------
+// The file image is charged to the trajectory pool while it is parsed
+//-----------------------------------------------------------------------------
+bool read_result_file(const char* fname, ResultColumns* cols, int nthreads) {
+    FILE* fp = fopen(fname, "rb");
+    if (fp == NULL) return false;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(fp);
+        return false;
+    }
+    std::vector<char> buf(size);
+    memory::Charge mem(memory::Trajectory);
+    mem.set(size);
+    size_t n = fread(buf.data(), 1, size, fp);
+    fclose(fp);
+    if (n != (size_t)size) return false;
+    const char* p = buf.data();
+    const char* e = p + n;
+    // Header
+    const char* nl = (const char*)memchr(p, '\n', e - p);
+    if (nl == NULL) {
+        cols->clear();
+        return true;
+    }
+    return parse_result_rows(nl + 1, e, cols, nthreads);
+}
@@ -0,0 +1,38 @@
+/**
+ * Parallel reader of result files (the output of run_print).
+ * The file is read into memory and split into byte ranges aligned on
+ * newlines. The lines of each range are counted, then the ranges are parsed
+ * on the workers directly into one contiguous columnar buffer.
+ * Rows have 7 numbers separated by tabs or spaces; more columns are ignored.
+ */
+#ifndef RESULTFILE_H
+#define RESULTFILE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+class ResultColumns {
+public:
+    std::vector<int> status;
+    std::vector<double> time;       // s
+    std::vector<double> distance;   // m
+    std::vector<double> speed;      // km/h
+    std::vector<double> accel;      // m/s^2
+    std::vector<double> force;      // N
+    std::vector<double> power;      // kW
+public:
+    size_t size() const { return status.size(); };
+    void resize(size_t n);
+    void clear() { resize(0); };
+    int64_t bytes() const;
+};
+//-----------------------------------------------------------------------------
+// Read a result file (a header line and rows) on nthreads (<= 0: all cores)
+// [Return] false if the file cannot be read or a row is invalid
+//-----------------------------------------------------------------------------
+bool read_result_file(const char* fname, ResultColumns* cols, int nthreads);
+// Parse the rows in [begin, end) after the header. Same as read_result_file.
+bool parse_result_rows(const char* begin, const char* end, ResultColumns* cols, int nthreads);
+
+#endif
@@ -1,8 +1,17 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
 #include "RunControl.h"
 #include "train.h"
+#include "SVGConv.h"
+#include "Parallel.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
 #include "nlohmann/json.hpp"
 ///////////////////////////////////////////////////////////////////////////////
 using namespace nlohmann;
@@ -12,6 +21,14 @@ using namespace nlohmann;
 //-----------------------------------------------------------------------------
 RunControl::RunControl() {
     mSvgMaxpt = 1;
+    mCoalesce = false;
+    mProgressInterval = 0;
+    mShard = 0;
+    mNShard = 1;
+    surface_refined = 0;
+    pattern_uses = 0;
+    shard_items = 0;
+    envelopes = std::make_shared<EnvelopeCache>();
 }
 //-----------------------------------------------------------------------------
 // Get the line pointer of id = line_id
@@ -108,9 +125,27 @@ bool RunControl::read_traction(const char* fname) {
     return ret;
 }
 //-----------------------------------------------------------------------------
+// Approximate size of a json document in memory (bytes)
+//-----------------------------------------------------------------------------
+static size_t json_bytes(const json& j) {
+    size_t n = sizeof(json);
+    if (j.is_string()) n += j.get_ref<const std::string&>().capacity();
+    else if (j.is_object()) {
+        for (auto it = j.begin(); it != j.end(); ++it) {
+            n += it.key().capacity() + 4 * sizeof(void*) + json_bytes(it.value());
+        }
+    }
+    else if (j.is_array()) {
+        for (const auto& x : j) n += json_bytes(x);
+    }
+    return n;
+}
+//-----------------------------------------------------------------------------
 // Read params
 //-----------------------------------------------------------------------------
 bool RunControl::read_params(const char* fname) {
+    METRIC_PHASE(Params);
+    TRACE_SPAN("read_params", "load");
     std::ifstream fs(fname);
 	if (!fs) {
 		fprintf(stderr,"Cannot open file %s\n", fname);
@@ -125,6 +160,8 @@ bool RunControl::read_params(const char* fname) {
         fprintf(stderr,"Format Error in %s (%s)\n", fname, e.what());
 		return false;
 	}
+    memory::Charge json_mem(memory::JSON);
+    json_mem.set((int64_t)json_bytes(jroot));
     bool ret = true;
     try {
         json jdata = jroot["speedtraction"];
@@ -160,8 +197,28 @@ bool RunControl::read_params(const char* fname) {
                 errmsg = "ERROR " + std::to_string(ret) +": Line file (" + line_file_name + ").\n";
                 return false;
             }
+            if (mCoalesce) {
+                size_t n0 = line->nSegment();
+                line->coalesce();
+                printf("Line %d: %zu -> %zu segments\n", id, n0, line->nSegment());
+            }
             lines.push_back(line);
         }
+        if (jroot.contains("sweep") && sweep.read_json(jroot["sweep"]) == false) {
+            throw std::runtime_error("invalid sweep");
+        }
+        if (jroot.contains("montecarlo") && montecarlo.read_json(jroot["montecarlo"]) == false) {
+            throw std::runtime_error("invalid montecarlo");
+        }
+        if (jroot.contains("calibration") && calibration.read_json(jroot["calibration"]) == false) {
+            throw std::runtime_error("invalid calibration");
+        }
+        if (jroot.contains("patterns") && patterns.read_json(jroot["patterns"]) == false) {
+            throw std::runtime_error("invalid patterns");
+        }
+        if (jroot.contains("surface") && surface.read_json(jroot["surface"]) == false) {
+            throw std::runtime_error("invalid surface");
+        }
         if (jdata.find("maxpt") != jdata.end()) {
             mSvgMaxpt = jdata.at("maxpt");
             if (mSvgMaxpt <= 0)  mSvgMaxpt = 0;
@@ -218,6 +275,7 @@ void RunControl::set_train_traction() {
 //-----------------------------------------------------------------------------
 bool RunControl::set_train_line() {
     for(const auto& train: trains) {
+        train->set_envelope_cache(envelopes);
         int tid = train->line_index;
         for(const auto& line: lines) {
             if( tid == line->getID()) {
@@ -229,6 +287,39 @@ bool RunControl::set_train_line() {
     return true;
 }
 //-----------------------------------------------------------------------------
+// Set the traction and the line of the trains for a run of all trains.
+// list (if not null) is all the trains.
+// [Return] false if the lines cannot be set
+//-----------------------------------------------------------------------------
+bool RunControl::prepare_trains(std::vector<std::shared_ptr<Train>>* list) {
+    set_train_traction();
+    if( set_train_line() == false) {
+        fprintf(stderr,"Station length must be longer than the train length\n");
+        return false;
+    }
+    if (list) list->assign(trains.begin(), trains.end());
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Train of the id (0: the first train), nullptr if not found
+//-----------------------------------------------------------------------------
+std::shared_ptr<Train> RunControl::find_train(int train_id) const {
+    for (const auto& train : trains) {
+        if (train_id == 0 || train->id == train_id) return train;
+    }
+    return nullptr;
+}
+//-----------------------------------------------------------------------------
+// Number of the results that failed (code != 0)
+//-----------------------------------------------------------------------------
+template <class Stat> static int count_failed(const std::vector<Stat>& stats) {
+    int n_fail = 0;
+    for (const auto& stat : stats) {
+        if (stat.code != 0) n_fail++;
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
 // Use the first train data and use the line data of line_id
 //-----------------------------------------------------------------------------
 int RunControl::run1(const char* fname) {
@@ -255,36 +346,1227 @@ int RunControl::run1(const char* fname) {
         printf("Train length > line length\n");
         return(-1);
     }
-    int counter = 0;
-    int information = 0;
     printf("[2] Start Calculation.\n");
-    fprintf(fp, "status\ttime\tdistance\tspeed\taccel\tforce\tpower\n");
-    train->run_print(fp);
-    while(true) {
-        int result = train->main_run();
-		if( result == RunCode::LessPower ) {
-            errmsg = "Too low power.";
-            train->run_print(fp);
-            fclose(fp);
-			return (-3);
-		}
-        if ( counter % 16 == 0 ) information = 1;
-        else information = 0;
-
-        if ( information == 1) {
-            train->run_print(fp);
-        }
-        else train->run_print(fp);
-        if ( result == RunCode::EndOfLine ) break;
-        counter++;
+    int result = simulate(*train, fp, nullptr);
+    {
+        TRACE_SPAN_ARG("flush output", "output", train->id);
+        fclose(fp);
+    }
+    if (result == RunCode::LessPower) {
+        errmsg = "Too low power.";
+        return (-3);
     }
-    fclose(fp);
     printf("[3] End Calculation\n");
     present_train = train;
     present_line = train->get_line();
     return (0);
 }
 //-----------------------------------------------------------------------------
+// Run the train after prepare_run until the end of the line
+// The result is written to fp (header and every step)
+// The ticks and bytes are added to slot (if not null) on the way.
+// [Return] RunCode::EndOfLine or RunCode::LessPower
+//-----------------------------------------------------------------------------
+int RunControl::simulate(Train& train, FILE* fp, RunStat* stat, ProgressSlot* slot) {
+    int result;
+    uint64_t ticks = 0, bytes = 0;
+    TRACE_SPAN_ARG("main_run loop", "run", train.id);
+    bytes += fprintf(fp, "status\ttime\tdistance\tspeed\taccel\tforce\tpower\n");
+    bytes += train.run_print(fp);
+    while(true) {
+        {
+            METRIC_PHASE(Loop);
+            result = train.main_run();
+        }
+        {
+            METRIC_PHASE(Output);
+            bytes += train.run_print(fp);
+        }
+        if (slot && ++ticks == Progress::publish_ticks) {
+            slot->add(ticks, bytes);
+            ticks = bytes = 0;
+        }
+        if ( result == RunCode::LessPower || result == RunCode::EndOfLine ) break;
+    }
+    if (slot) slot->add(ticks, bytes);
+    METRIC_SIM_TIME(train.get_time());
+    if (stat) {
+        stat->sim_time = train.get_time();
+        stat->bytes = ftell(fp);
+    }
+    return result;
+}
+//-----------------------------------------------------------------------------
+// Size of a file (bytes)
+//-----------------------------------------------------------------------------
+static long file_size(const char* fname) {
+    FILE* fp;
+    if (fopen_s(&fp, fname, "rb") != 0) return 0;
+    fseek(fp, 0, SEEK_END);
+    long n = ftell(fp);
+    fclose(fp);
+    return n;
+}
+//-----------------------------------------------------------------------------
+// Start the progress report of n_runs runs on the workers of n_tasks tasks
+// [Return] null without --progress and --status-file
+//-----------------------------------------------------------------------------
+std::unique_ptr<Progress> RunControl::start_progress(int nthreads, size_t n_tasks, size_t n_runs) {
+    std::unique_ptr<Progress> progress;
+    if (mProgressInterval > 0 || !mStatusFile.empty()) {
+        progress.reset(new Progress(worker_count(nthreads, n_tasks), n_runs,
+            mProgressInterval, mProgressInterval > 0, mStatusFile));
+        progress->start();
+    }
+    return progress;
+}
+//-----------------------------------------------------------------------------
+// Run all trains on nthreads workers (nthreads <= 0: all hardware threads)
+// The result of a train (id) is saved as prefix-id.tsv and the diagram as
+// svg_prefix-id.svg if svg_prefix is not NULL.
+// batch_stats keeps the result of each train in the order of trains.
+// [Return] the number of failed trains, -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::run_batch(const char* prefix, const char* svg_prefix, int nthreads) {
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(nullptr)) return (-1);
+    size_t k = 0;
+    for (const auto& train : trains) {
+        if (in_shard(k++)) list.push_back(train);
+    }
+    batch_stats.assign(list.size(), RunStat());
+    std::string base = prefix;
+    std::unique_ptr<Progress> progress = start_progress(nthreads, list.size(), list.size());
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        Train& train = *list[i];
+        RunStat& stat = batch_stats[i];
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("train", "batch", train.id);
+        ProgressSlot* slot = progress ? &progress->slot(worker) : nullptr;
+        struct RunDone {
+            ProgressSlot* slot;
+            ~RunDone() { if (slot) slot->add_run(); }
+        } done = {slot};
+        stat.train_id = train.id;
+        std::shared_ptr<RailLine> line = train.get_line();
+        if (line == nullptr) {
+            stat.code = -2;
+            return;
+        }
+        std::string fname = base + "-" + std::to_string(train.id) + ".tsv";
+        FILE* fp;
+        if (fopen_s(&fp, fname.c_str(), "wt") != 0) {
+            stat.code = -1;
+            return;
+        }
+        if (train.prepare_run() != 0) {
+            fclose(fp);
+            stat.code = -1;
+            return;
+        }
+        int result = simulate(train, fp, &stat, slot);
+        {
+            TRACE_SPAN_ARG("flush output", "output", train.id);
+            fclose(fp);
+        }
+        if (result == RunCode::LessPower) {
+            stat.code = -3;
+            return;
+        }
+        if (svg_prefix) {
+            std::string svg_fname = std::string(svg_prefix) + "-" + std::to_string(train.id) + ".svg";
+            SVGConvert svgc;
+            svgc.set_simplify(mSvgMaxpt);
+            svgc.set_threads(1);   // the runs are already parallel
+            svgc.read_rail(line);
+            if (svgc.load(fname.c_str()) && svgc.svg_save(svg_fname.c_str())) {
+                long n = file_size(svg_fname.c_str());
+                stat.bytes += n;
+                if (slot) slot->add(0, n);
+            } else stat.code = -4;
+        }
+    });
+    if (progress) progress->finish();
+    return count_failed(batch_stats);
+}
+//-----------------------------------------------------------------------------
+// Run each train with the reference kernel and with the kernel and compare
+// the runs by distance. verify_stats keeps the result of each train.
+// [Return] the number of trains out of the tolerances (or failed), -1 if the
+// kernel is unknown or the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::verify(const char* kernel, const VerifyTolerance& tol, int nthreads) {
+    {
+        Train test;
+        if (set_kernel(test, kernel) == false) {
+            fprintf(stderr, "Unknown kernel: %s (", kernel);
+            for (int i = 0; kernel_names[i]; i++) fprintf(stderr, "%s%s", (i > 0) ? ", " : "", kernel_names[i]);
+            fprintf(stderr, ")\n");
+            return (-1);
+        }
+    }
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    verify_stats.assign(list.size(), VerifyStat());
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        VerifyStat& stat = verify_stats[i];
+        stat.train_id = list[i]->id;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("verify", "batch", stat.train_id);
+        if (list[i]->get_line() == nullptr) {
+            stat.code = -2;
+            return;
+        }
+        Train ref(*list[i]);
+        Train fast(*list[i]);
+        set_reference_kernel(ref);
+        set_reference_kernel(fast);
+        set_kernel(fast, kernel);
+        Trajectory a, b;
+        int ra = run_trajectory(ref, &a);
+        int rb = run_trajectory(fast, &b);
+        stat.code = (ra != 0) ? ra : rb;
+        if (stat.code != 0) return;
+        stat.ref_time = a.run_time();
+        stat.ref_energy = a.energy();
+        stat.dev = compare_by_distance(a, b, tol.step);
+        stat.ok = tol.check(stat.dev, stat.ref_energy);
+    });
+    int n_fail = 0;
+    for (const auto& stat : verify_stats) {
+        if (stat.code != 0 || !stat.ok) n_fail++;
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Run each train with dt = dt_max, dt_max/2, ... (levels runs, at most
+// DT_STUDY_MAX_LEVELS) in parallel and estimate the errors of the run time,
+// the arrival times and the energy by Richardson extrapolation. The time tolerance is applied to the run time
+// and the arrival times, the energy tolerance is the ratio to the energy.
+// dt_stats keeps the result of each train.
+// [Return] the largest dt within the tolerances for all trains (0: none),
+//          -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+double RunControl::dt_study(double dt_max, int levels, const VerifyTolerance& tol, int nthreads) {
+    if (levels < 2 || levels > DT_STUDY_MAX_LEVELS || dt_max <= 0) return 0;
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    std::vector<Trajectory> runs(list.size() * levels);
+    std::vector<int> codes(runs.size(), 0);
+    parallel_for(runs.size(), nthreads, [&](size_t k, int worker) {
+        size_t i = k / levels;
+        int level = (int)(k % levels);
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("dt run", "batch", list[i]->id);
+        if (list[i]->get_line() == nullptr) {
+            codes[k] = -2;
+            return;
+        }
+        Train train(*list[i]);
+        train.set_dt(std::ldexp(dt_max, -level));
+        codes[k] = run_trajectory(train, &runs[k], false);
+    });
+    dt_stats.assign(list.size(), DtStudy());
+    double result = dt_max;
+    for (size_t i = 0; i < list.size(); i++) {
+        DtStudy& st = dt_stats[i];
+        st.train_id = list[i]->id;
+        for (int l = 0; l < levels; l++) {
+            const Trajectory& r = runs[i * levels + l];
+            if (codes[i * levels + l] != 0) st.code = codes[i * levels + l];
+            st.dts.push_back(std::ldexp(dt_max, -l));
+            st.run_time.push_back(r.run_time());
+            st.energy.push_back(r.energy());
+        }
+        if (st.code != 0) {
+            result = 0;
+            continue;
+        }
+        st.best_time = richardson(st.run_time, &st.err_time, &st.order_time);
+        st.best_energy = richardson(st.energy, &st.err_energy, &st.order_energy);
+        // stations reached in all runs
+        size_t n_st = runs[i * levels].arrivals.size();
+        for (int l = 1; l < levels; l++) n_st = std::min(n_st, runs[i * levels + l].arrivals.size());
+        st.err_arrival.assign(levels, 0.0);
+        for (size_t j = 0; j < n_st; j++) {
+            std::vector<double> q, err;
+            for (int l = 0; l < levels; l++) q.push_back(runs[i * levels + l].arrivals[j]);
+            richardson(q, &err, nullptr);
+            for (int l = 0; l < levels; l++) st.err_arrival[l] = std::max(st.err_arrival[l], err[l]);
+        }
+        for (int l = 0; l < levels; l++) {
+            if (st.err_time[l] <= tol.time && st.err_arrival[l] <= tol.time
+                && st.err_energy[l] <= tol.energy * std::fabs(st.best_energy)) {
+                st.recommended = st.dts[l];
+                break;
+            }
+        }
+        result = std::min(result, st.recommended);
+    }
+    return result;
+}
+//-----------------------------------------------------------------------------
+// Search the cruise speed and the coasting point of each section (between
+// stops) that minimize the energy with the run time within (1 + slack) x
+// the run time of full traction.
+// The sections start from a stop, so each one is run from a copy of the
+// train at its start. The candidates of all sections run in parallel; a
+// candidate is abandoned when its time exceeds the time of the section
+// with all the slack (it cannot be in a feasible plan), or without a run
+// when the preview (the change from full traction) is over it by more than
+// PREVIEW_MARGIN. The runs are not abandoned by energy; after the runs a
+// candidate not faster than another of its section with no less energy is
+// dropped. The candidates of the sections are combined by minimizing
+// energy + lambda x time with lambda bisected for the time limit. A plan
+// still over the limit returns to full traction section by section.
+// drive_stats keeps each train.
+// [Return] the number of trains failed, -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::optimize_driving(double slack, int nthreads) {
+    const double cruise_step = 5.0;     // km/h
+    const double cruise_min = 0.4;      // ratio to max_speed
+    const double coast_step = 0.05;     // ratio to the section length
+    const double coast_min = 0.3;
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    drive_stats.assign(list.size(), DriveStat());
+    // Full traction: the train at the start of each section
+    std::vector<std::vector<Train>> starts(list.size());
+    // Preview of each train and its sections of full traction (pre-filter)
+    std::vector<std::unique_ptr<Preview>> previews(list.size());
+    std::vector<std::vector<double>> base_preview(list.size());
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        DriveStat& st = drive_stats[i];
+        st.train_id = list[i]->id;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("drive base", "batch", st.train_id);
+        if (list[i]->get_line() == nullptr) {
+            st.code = -2;
+            return;
+        }
+        Train train(*list[i]);
+        if (train.prepare_run() != 0) {
+            st.code = -1;
+            return;
+        }
+        while (true) {
+            double t, e;
+            starts[i].push_back(train);
+            st.from.push_back(train.get_dist());
+            int r = run_section(train, HUGE_VAL, &t, &e);
+            if (r == RunCode::LessPower) {
+                st.code = -3;
+                return;
+            }
+            st.to.push_back(train.get_dist());
+            st.base_time.push_back(t);
+            st.base_energy.push_back(e);
+            if (r == RunCode::EndOfLine) break;
+        }
+        st.base_total_time = train.get_time();
+        st.base_total_energy = train.get_energy();
+        st.time_limit = st.base_total_time * (1 + slack);
+        previews[i].reset(new Preview(*list[i]));
+        if (previews[i]->sections() != starts[i].size()) previews[i].reset();
+        else {
+            for (size_t j = 0; j < starts[i].size(); j++) base_preview[i].push_back(previews[i]->section_time(j));
+        }
+    });
+    // Candidates of each section: (cruise, coasting) x sections x trains
+    struct Candidate {
+        size_t train, section;
+        DriveSection drive;
+        int code;           // run_section (not run if filtered)
+        bool filtered;      // abandoned by the preview
+        double time, energy;
+    };
+    std::vector<Candidate> cands;
+    for (size_t i = 0; i < list.size(); i++) {
+        if (drive_stats[i].code != 0) continue;
+        std::vector<double> cruise = {0.0};
+        for (double v = list[i]->max_speed - cruise_step; v >= list[i]->max_speed * cruise_min; v -= cruise_step) {
+            cruise.push_back(v);
+        }
+        std::vector<double> coast = {HUGE_VAL};
+        for (int k = 1; 1 - coast_step * k >= coast_min - 1e-9; k++) coast.push_back(1 - coast_step * k);
+        for (size_t j = 0; j < starts[i].size(); j++) {
+            const DriveStat& st = drive_stats[i];
+            for (double v : cruise) {
+                for (double c : coast) {
+                    Candidate cd;
+                    cd.train = i;
+                    cd.section = j;
+                    cd.drive.cruise = v;
+                    cd.drive.coast_at = (c == HUGE_VAL) ? HUGE_VAL : st.from[j] + (st.to[j] - st.from[j]) * c;
+                    cd.code = 0;
+                    cd.filtered = false;
+                    cd.time = cd.energy = 0;
+                    cands.push_back(cd);
+                }
+            }
+        }
+    }
+    parallel_for(cands.size(), nthreads, [&](size_t k, int worker) {
+        Candidate& cd = cands[k];
+        const DriveStat& st = drive_stats[cd.train];
+        trace::set_thread_name("worker", worker);
+        Train train(starts[cd.train][cd.section]);
+        train.drive.assign(cd.section + 1, DriveSection());
+        train.drive[cd.section] = cd.drive;
+        double cap = st.base_time[cd.section] + (st.time_limit - st.base_total_time);
+        // over the cap by the preview (the change from full traction)
+        if (previews[cd.train] && base_preview[cd.train][cd.section] != HUGE_VAL) {
+            double t = previews[cd.train]->section_time(cd.section, cd.drive);
+            if (t != HUGE_VAL && st.base_time[cd.section] + t - base_preview[cd.train][cd.section] > cap * (1 + PREVIEW_MARGIN)) {
+                cd.filtered = true;
+                return;
+            }
+        }
+        cd.code = run_section(train, cap, &cd.time, &cd.energy);
+    });
+    // Choice of each train, checked by the whole run with the chosen driving.
+    // The limit is lowered by the excess if the run is over it (the departures
+    // are rounded to the time step, so the sections do not add up exactly).
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        DriveStat& st = drive_stats[i];
+        if (st.code != 0) return;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("drive choice", "batch", st.train_id);
+        size_t n_sec = starts[i].size();
+        // feasible candidates of each section
+        std::vector<std::vector<const Candidate*>> sec(n_sec);
+        for (const auto& cd : cands) {
+            if (cd.train != i) continue;
+            st.n_candidates++;
+            if (cd.filtered) {
+                st.n_abandoned++;
+                st.n_filtered++;
+            }
+            else if (cd.code == RunCode::NextStation || cd.code == RunCode::EndOfLine) sec[cd.section].push_back(&cd);
+            else st.n_abandoned++;
+        }
+        // drop the dominated candidates: not faster than another with no less energy
+        for (auto& cs : sec) {
+            std::stable_sort(cs.begin(), cs.end(), [](const Candidate* a, const Candidate* b) {
+                return (a->time != b->time) ? a->time < b->time : a->energy < b->energy;
+            });
+            std::vector<const Candidate*> front;
+            for (const Candidate* cd : cs) {
+                if (front.empty() || cd->energy < front.back()->energy) front.push_back(cd);
+                else st.n_dominated++;
+            }
+            cs.swap(front);
+        }
+        std::vector<const Candidate*> pick(n_sec);
+        auto choose = [&](double lambda) {
+            double total = 0;
+            for (size_t j = 0; j < n_sec; j++) {
+                pick[j] = nullptr;
+                for (const Candidate* cd : sec[j]) {
+                    if (pick[j] == nullptr || cd->energy + lambda * cd->time < pick[j]->energy + lambda * pick[j]->time) pick[j] = cd;
+                }
+                total += pick[j] ? pick[j]->time : st.base_time[j];
+            }
+            return total;
+        };
+        auto run_plan = [&]() {
+            Train train(*list[i]);
+            train.drive = st.drive;
+            Trajectory traj;
+            st.code = run_trajectory(train, &traj, false);
+            st.total_time = traj.run_time();
+            st.total_energy = traj.energy();
+            return st.code != 0 || st.total_time <= st.time_limit;
+        };
+        double limit = std::accumulate(st.base_time.begin(), st.base_time.end(), 0.0) + st.time_limit - st.base_total_time;
+        bool ok = false;
+        for (int retry = 0; retry < 4 && !ok; retry++) {
+            if (choose(0) > limit) {
+                double lo = 0, hi = 1;
+                while (choose(hi) > limit && hi < 1e12) hi *= 2;
+                for (int it = 0; it < 60; it++) {
+                    double mid = (lo + hi) / 2;
+                    if (choose(mid) > limit) lo = mid;
+                    else hi = mid;
+                }
+                choose(hi);
+            }
+            st.drive.assign(n_sec, DriveSection());
+            st.time = st.base_time;
+            st.energy = st.base_energy;
+            for (size_t j = 0; j < n_sec; j++) {
+                if (pick[j] == nullptr) continue;
+                st.drive[j] = pick[j]->drive;
+                st.time[j] = pick[j]->time;
+                st.energy[j] = pick[j]->energy;
+            }
+            ok = run_plan();
+            if (!ok) limit -= st.total_time - st.time_limit;
+        }
+        // still over the limit: back to full traction, the sections of the
+        // most time over it first, until the run is within the limit (the
+        // run of full traction always is)
+        std::vector<size_t> order(n_sec);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return st.time[a] - st.base_time[a] > st.time[b] - st.base_time[b];
+        });
+        for (size_t j : order) {
+            if (ok) break;
+            if (pick[j] == nullptr) continue;
+            st.drive[j] = DriveSection();
+            st.time[j] = st.base_time[j];
+            st.energy[j] = st.base_energy[j];
+            st.n_fallback++;
+            ok = run_plan();
+        }
+    });
+    return count_failed(drive_stats);
+}
+//-----------------------------------------------------------------------------
+// Table of the sections of optimize_driving (the failed trains are skipped)
+//-----------------------------------------------------------------------------
+void print_drive(FILE* fp, const std::vector<DriveStat>& stats) {
+    fprintf(fp, "train\tsection\tfrom\tto\tcruise\tcoast_at\tbase_time\tbase_energy\ttime\tenergy\n");
+    for (const auto& s : stats) {
+        if (s.code != 0) continue;
+        for (size_t j = 0; j < s.drive.size(); j++) {
+            const DriveSection& d = s.drive[j];
+            fprintf(fp, "%d\t%zu\t%.1f\t%.1f\t%g\t", s.train_id, j + 1, s.from[j], s.to[j], d.cruise);
+            if (d.coast_at == HUGE_VAL) fprintf(fp, "-");
+            else fprintf(fp, "%.1f", d.coast_at);
+            fprintf(fp, "\t%.3f\t%.1f\t%.3f\t%.1f\n", s.base_time[j], s.base_energy[j], s.time[j], s.energy[j]);
+        }
+    }
+}
+//-----------------------------------------------------------------------------
+// Run each train once with the derivatives of the running time and the
+// energy by the keys (the default keys of the train if empty).
+// sens_stats keeps each train.
+// [Return] the number of trains failed, -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::sensitivity(const std::vector<std::string>& keys, int nthreads) {
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    sens_stats.assign(list.size(), SensStat());
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        SensStat& st = sens_stats[i];
+        st.train_id = list[i]->id;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("sensitivity", "batch", st.train_id);
+        if (list[i]->get_line() == nullptr) {
+            st.code = -2;
+            return;
+        }
+        Train train(*list[i]);
+        TrainSens sens;
+        if (!sens.init(train, keys.empty() ? default_sens_keys(train) : keys)) {
+            st.code = -4;
+            return;
+        }
+        train.sens = &sens;
+        Trajectory traj;
+        st.code = run_trajectory(train, &traj, false);
+        if (st.code != 0) return;
+        st.keys = sens.keys;
+        st.run_time = traj.run_time();
+        st.running_time = sens.run_time.v;
+        st.energy = traj.energy();
+        for (size_t k = 0; k < st.keys.size(); k++) {
+            double x = 0;
+            train.get_value(st.keys[k], &x);
+            st.values.push_back(x);
+            st.d_time.push_back(sens.run_time.d[k]);
+            st.d_energy.push_back(sens.energy.d[k]);
+        }
+    });
+    return count_failed(sens_stats);
+}
+//-----------------------------------------------------------------------------
+// Fit the keys of the calibration train to the traces by Levenberg-Marquardt.
+// The columns of the Jacobian (forward differences) and the trial steps of
+// several dampings are runs of copies of the train in parallel; the copies
+// share the line, the traction table and the braking envelope. The values
+// are kept non-negative.
+// [Return] the code of calib_stat
+//-----------------------------------------------------------------------------
+int RunControl::calibrate(int nthreads) {
+    CalibStat& st = calib_stat;
+    st = CalibStat();
+    if (!prepare_trains(nullptr)) return (-1);
+    std::shared_ptr<Train> base = find_train(calibration.train_id);
+    if (!base) {
+        fprintf(stderr, "Train %d of calibration is not found\n", calibration.train_id);
+        return (-1);
+    }
+    st.train_id = base->id;
+    if (base->get_line() == nullptr) return (st.code = -2);
+    const std::vector<std::string>& keys = calibration.keys;
+    size_t n = keys.size();
+    st.keys = keys;
+    st.initial.assign(n, 0.0);
+    for (size_t j = 0; j < n; j++) base->get_value(keys[j], &st.initial[j]);
+    // Runs of the values in parallel. ok[i] is false if the run fails.
+    std::vector<std::vector<double>> res;
+    std::vector<char> ok;
+    auto run_all = [&](const std::vector<std::vector<double>>& ps) {
+        res.assign(ps.size(), std::vector<double>());
+        ok.assign(ps.size(), 0);
+        parallel_for(ps.size(), nthreads, [&](size_t i, int worker) {
+            trace::set_thread_name("worker", worker);
+            TRACE_SPAN_ARG("calibrate", "batch", st.train_id);
+            Train train(*base);
+            apply_params(train, keys, ps[i]);
+            if (calibration.dt > 0) train.set_dt(calibration.dt);
+            Trajectory traj;
+            if (run_trajectory(train, &traj) != 0) return;
+            ok[i] = calibration.residuals(traj, &res[i], nullptr);
+        });
+        st.n_runs += ps.size();
+    };
+    auto cost_of = [](const std::vector<double>& r) {
+        double c = 0;
+        for (double x : r) c += x * x;
+        return c;
+    };
+    // Jacobian (m x n, row major) at p with the residuals r
+    std::vector<double> jac;
+    auto jacobian = [&](const std::vector<double>& p, const std::vector<double>& r) {
+        std::vector<std::vector<double>> ps(n, p);
+        std::vector<double> h(n);
+        for (size_t j = 0; j < n; j++) {
+            h[j] = calibration.step * ((p[j] != 0) ? std::fabs(p[j]) : 1.0);
+            ps[j][j] += h[j];
+        }
+        run_all(ps);
+        size_t m = r.size();
+        jac.assign(m * n, 0.0);
+        for (size_t j = 0; j < n; j++) {
+            if (!ok[j]) continue;   // the column is 0 (the key is not moved)
+            for (size_t i = 0; i < m; i++) jac[i * n + j] = (res[j][i] - r[i]) / h[j];
+        }
+    };
+    std::vector<double> p = st.initial;
+    run_all({p});
+    if (!ok[0]) {
+        fprintf(stderr, "The traces are out of the run of train %d (or low power)\n", st.train_id);
+        return (st.code = -5);
+    }
+    std::vector<double> r = res[0];
+    size_t m = r.size();
+    st.cost0 = st.cost = cost_of(r);
+    double lambda = 1e-2;
+    const double factors[] = {0.1, 1.0, 10.0, 100.0};
+    for (st.iterations = 0; st.iterations < calibration.max_iter; ) {
+        jacobian(p, r);
+        // normal equations A d = -g
+        std::vector<double> a(n * n, 0.0), g(n, 0.0);
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < n; j++) {
+                g[j] += jac[i * n + j] * r[i];
+                for (size_t k = 0; k < n; k++) a[j * n + k] += jac[i * n + j] * jac[i * n + k];
+            }
+        }
+        bool moved = false, converged = false;
+        while (!moved && lambda < 1e10) {
+            std::vector<std::vector<double>> ps;
+            std::vector<double> lambdas;
+            for (double f : factors) {
+                std::vector<double> ad = a, d;
+                for (size_t j = 0; j < n; j++) {
+                    if (a[j * n + j] == 0) ad[j * n + j] = 1.0;     // not moved by the key
+                    else ad[j * n + j] += lambda * f * a[j * n + j];
+                }
+                if (!solve_linear(ad, g, n, &d)) continue;
+                std::vector<double> q = p;
+                for (size_t j = 0; j < n; j++) q[j] = std::max(0.0, p[j] - d[j]);
+                ps.push_back(q);
+                lambdas.push_back(lambda * f);
+            }
+            run_all(ps);
+            size_t best = ps.size();
+            double best_cost = st.cost;
+            for (size_t i = 0; i < ps.size(); i++) {
+                if (!ok[i]) continue;
+                double c = cost_of(res[i]);
+                if (c < best_cost) {
+                    best = i;
+                    best_cost = c;
+                }
+            }
+            if (best == ps.size()) {
+                lambda *= 1000;
+                continue;
+            }
+            moved = true;
+            double decrease = st.cost - best_cost;
+            p = ps[best];
+            r = res[best];
+            st.cost = best_cost;
+            lambda = lambdas[best];
+            st.iterations++;
+            converged = decrease < calibration.tol * (st.cost + decrease);
+        }
+        if (!moved || converged) break;
+    }
+    st.fitted = p;
+    // standard errors: s^2 (J^T J)^-1 with s^2 = cost / (m - n)
+    st.std_err.assign(n, 0.0);
+    jacobian(p, r);
+    if (m > n) {
+        std::vector<double> a(n * n, 0.0);
+        for (size_t i = 0; i < m; i++) {
+            for (size_t j = 0; j < n; j++) {
+                for (size_t k = 0; k < n; k++) a[j * n + k] += jac[i * n + j] * jac[i * n + k];
+            }
+        }
+        double s2 = st.cost / (m - n);
+        std::vector<char> moves(n);
+        for (size_t j = 0; j < n; j++) {
+            moves[j] = (a[j * n + j] != 0);
+            if (!moves[j]) a[j * n + j] = 1.0;     // not moved by the key (error 0)
+        }
+        for (size_t j = 0; j < n; j++) {
+            std::vector<double> e(n, 0.0), x;
+            e[j] = 1.0;
+            if (moves[j] && solve_linear(a, e, n, &x) && x[j] > 0) st.std_err[j] = std::sqrt(s2 * x[j]);
+        }
+    }
+    // residuals at the initial and the fitted values
+    for (int k = 0; k < 2; k++) {
+        Train train(*base);
+        apply_params(train, keys, (k == 0) ? st.initial : st.fitted);
+        if (calibration.dt > 0) train.set_dt(calibration.dt);
+        Trajectory traj;
+        run_trajectory(train, &traj);
+        std::vector<double> rr;
+        calibration.residuals(traj, &rr, &st.rows);
+        if (k == 0) trace_rms(st.rows, &st.rms_time0, &st.rms_speed0);
+        else trace_rms(st.rows, &st.rms_time, &st.rms_speed);
+    }
+    return st.code;
+}
+//-----------------------------------------------------------------------------
+// Preview of each train and its full run in parallel for the error.
+// [Return] the number of failed trains, -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::preview(int nthreads) {
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    preview_stats.assign(list.size(), PreviewStat());
+    parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+        PreviewStat& st = preview_stats[i];
+        st.train_id = list[i]->id;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("preview", "batch", st.train_id);
+        auto t0 = std::chrono::steady_clock::now();
+        Preview pv(*list[i]);
+        st.preview_time = pv.run_time();
+        auto t1 = std::chrono::steady_clock::now();
+        st.preview_us = std::chrono::duration<double, std::micro>(t1 - t0).count();
+        if (pv.code != 0) {
+            st.code = pv.code;
+            return;
+        }
+        st.stops = pv.sections();
+        Train train(*list[i]);
+        Trajectory traj;
+        st.code = run_trajectory(train, &traj, false);
+        st.run_time = traj.run_time();
+        st.run_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t1).count();
+    });
+    return count_failed(preview_stats);
+}
+//-----------------------------------------------------------------------------
+// Run the stopping patterns of the train. The sections of all the patterns
+// are collected first and each distinct section is run once (in parallel);
+// a pattern adds its sections and the stops, whose departures are rounded
+// up to a second and counted by dt as in main_run. The fastest pattern of each number of
+// stops is marked.
+// [Return] the number of failed patterns, -1 if the train is not ready
+//-----------------------------------------------------------------------------
+int RunControl::run_patterns(int nthreads) {
+    pattern_sections.clear();
+    pattern_stats.clear();
+    pattern_uses = 0;
+    if (!prepare_trains(nullptr)) return (-1);
+    std::shared_ptr<Train> base = find_train(patterns.train_id);
+    if (!base || base->get_line() == nullptr) {
+        fprintf(stderr, "Train %d of patterns or its line is not found\n", patterns.train_id);
+        return (-1);
+    }
+    std::shared_ptr<RailLine> line = base->get_line();
+    if (!patterns.set_line(*line)) return (-1);
+    // distinct sections: index of (from, to) in pattern_sections
+    size_t n_stop = patterns.stops.size();
+    std::vector<int> memo(n_stop * n_stop, -1);
+    std::vector<size_t> list;
+    for (size_t k = 0; k < patterns.size(); k++) {
+        patterns.stops_of(patterns.mask(k), &list);
+        for (size_t i = 0; i + 1 < list.size(); i++) {
+            int& m = memo[list[i] * n_stop + list[i + 1]];
+            if (m < 0) {
+                m = (int)pattern_sections.size();
+                PatternSection sec;
+                sec.from = list[i];
+                sec.to = list[i + 1];
+                pattern_sections.push_back(sec);
+            }
+        }
+        pattern_uses += list.size() - 1;
+    }
+    parallel_for(pattern_sections.size(), nthreads, [&](size_t i, int worker) {
+        PatternSection& sec = pattern_sections[i];
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("pattern section", "batch", (int)i);
+        Train train(*base);
+        train.set_line(patterns.section_line(*line, sec.from, sec.to));
+        Trajectory traj;
+        sec.code = run_trajectory(train, &traj, false);
+        sec.time = traj.run_time();
+        sec.energy = traj.energy();
+    });
+    pattern_stats.assign(patterns.size(), PatternStat());
+    parallel_for(patterns.size(), nthreads, [&](size_t k, int) {
+        PatternStat& st = pattern_stats[k];
+        std::vector<size_t> stops;
+        st.mask = patterns.mask(k);
+        patterns.stops_of(st.mask, &stops);
+        st.stops = stops.size() - 2;
+        for (size_t i = 0; i + 1 < stops.size(); i++) {
+            const PatternSection& sec = pattern_sections[memo[stops[i] * n_stop + stops[i + 1]]];
+            if (sec.code != 0) {
+                st.code = sec.code;
+                return;
+            }
+            if (i > 0) {
+                // the timer of main_run: the dwell and the rest of the second, counted by dt
+                double timer = patterns.dwells[stops[i]] + std::ceil(st.run_time) - st.run_time;
+                st.run_time += (std::ceil(timer / base->dt - 1e-9) - 1) * base->dt;
+            }
+            st.run_time += sec.time;
+            st.energy += sec.energy;
+        }
+    });
+    std::vector<int> best(n_stop, -1);
+    int n_fail = 0;
+    for (size_t k = 0; k < pattern_stats.size(); k++) {
+        const PatternStat& st = pattern_stats[k];
+        if (st.code != 0) {
+            n_fail++;
+            continue;
+        }
+        int& b = best[st.stops];
+        if (b < 0 || st.run_time < pattern_stats[b].run_time) b = (int)k;
+    }
+    for (int b : best) {
+        if (b >= 0) pattern_stats[b].best = true;
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Matrix of the run times between the stations of each train. A task is a
+// train and a station from which it runs (in parallel). The run to the last
+// station keeps the train at the entrance of each segment; a run to a nearer
+// station is the same until a step looks at the first segment where its
+// envelope differs (or its station), so it continues from the last state
+// before that on its own line. With the braking curve the whole curve may
+// differ, so the runs start over. The sub-lines of a row are used only by
+// the row, so their envelopes are kept in a small cache of the row instead
+// of the cache shared by the trains.
+// [Return] the number of failed pairs, -1 if the trains are not ready
+//-----------------------------------------------------------------------------
+int RunControl::run_matrix(int nthreads) {
+    matrices.clear();
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(&list)) return (-1);
+    matrices.assign(list.size(), StationMatrix());
+    std::vector<std::pair<size_t, size_t>> tasks;   // (train, station from)
+    for (size_t i = 0; i < list.size(); i++) {
+        StationMatrix& m = matrices[i];
+        m.train_id = list[i]->id;
+        std::shared_ptr<RailLine> line = list[i]->get_line();
+        if (line == nullptr) {
+            m.code = -2;
+            continue;
+        }
+        for (size_t s = 0; s < line->nSegment(); s++) {
+            if (line->segs[s].type != SegmentType::Station) continue;
+            m.segs.push_back(s);
+            m.ids.push_back(line->segs[s].id);
+        }
+        size_t n = m.size();
+        m.codes.assign(n * n, 0);
+        m.times.assign(n * n, 0.0);
+        m.energies.assign(n * n, 0.0);
+        for (size_t a = 0; a + 1 < n; a++) tasks.push_back(std::make_pair(i, a));
+    }
+    std::vector<size_t> ticks(tasks.size(), 0), pair_ticks(tasks.size(), 0);
+    parallel_for(tasks.size(), nthreads, [&](size_t t, int worker) {
+        StationMatrix& m = matrices[tasks[t].first];
+        const Train& base = *list[tasks[t].first];
+        size_t a = tasks[t].second;
+        size_t n = m.size();
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("matrix row", "batch", m.train_id);
+        std::shared_ptr<RailLine> line = base.get_line();
+        std::shared_ptr<RailLine> full = sub_line(*line, m.segs[a], m.segs[n - 1]);
+        std::shared_ptr<EnvelopeCache> cache = std::make_shared<EnvelopeCache>(4);
+        Train train(base);
+        train.drive.clear();
+        train.set_envelope_cache(cache);
+        train.set_line(full);
+        if (train.prepare_run() != 0) {
+            for (size_t b = a + 1; b < n; b++) m.codes[m.at(a, b)] = -1;
+            return;
+        }
+        // the train at the start and at the entrance of each segment
+        std::vector<Train> states;
+        std::vector<size_t> state_seg, state_tick;
+        states.push_back(train);
+        state_seg.push_back(train.get_segment());
+        state_tick.push_back(0);
+        int result;
+        size_t tick = 0;
+        while (true) {
+            result = train.main_run();
+            tick++;
+            if (result == RunCode::NextSegment) {
+                states.push_back(train);
+                state_seg.push_back(train.get_segment());
+                state_tick.push_back(tick);
+            }
+            if (result == RunCode::LessPower || result == RunCode::EndOfLine) break;
+        }
+        ticks[t] = tick;
+        pair_ticks[t] = tick;
+        m.codes[m.at(a, n - 1)] = (result == RunCode::LessPower) ? -3 : 0;
+        m.times[m.at(a, n - 1)] = train.get_time();
+        m.energies[m.at(a, n - 1)] = train.get_energy();
+        // the farthest segment looked at before the entrance of each segment:
+        // the next segment and the first one not head_only (get_min_speed)
+        size_t ns = full->nSegment();
+        std::vector<size_t> reach(ns, 0);
+        for (size_t k = 0, far = 0; k < ns; k++) {
+            reach[k] = far;
+            size_t j = k;
+            while (j < ns && full->segs[j].head_only) j++;
+            far = std::max(far, std::max(k + 1, j));
+        }
+        std::shared_ptr<const SpeedEnvelope> env = cache->get(*full, train.dec, train.length, train.spmargin);
+        for (size_t b = a + 1; b + 1 < n; b++) {
+            std::shared_ptr<RailLine> sub = sub_line(*line, m.segs[a], m.segs[b]);
+            size_t d = 0;   // the first segment of another envelope or type (the station b)
+            if (!train.b_brake_curve) {
+                // continue_on takes the same envelope from the cache
+                std::shared_ptr<const SpeedEnvelope> eb = cache->get(*sub, train.dec, train.length, train.spmargin);
+                size_t last = sub->nSegment() - 1;
+                while (d < last && eb->max_speed[d] == env->max_speed[d]) d++;
+            }
+            size_t k = states.size() - 1;
+            while (k > 0 && reach[state_seg[k]] >= d) k--;
+            Train tb(states[k]);
+            tb.continue_on(sub);
+            size_t n_tick = 0;
+            while (true) {
+                result = tb.main_run();
+                n_tick++;
+                if (result == RunCode::LessPower || result == RunCode::EndOfLine) break;
+            }
+            ticks[t] += n_tick;
+            pair_ticks[t] += state_tick[k] + n_tick;
+            m.codes[m.at(a, b)] = (result == RunCode::LessPower) ? -3 : 0;
+            m.times[m.at(a, b)] = tb.get_time();
+            m.energies[m.at(a, b)] = tb.get_energy();
+        }
+    });
+    int n_fail = 0;
+    for (size_t t = 0; t < tasks.size(); t++) {
+        StationMatrix& m = matrices[tasks[t].first];
+        m.ticks += ticks[t];
+        m.pair_ticks += pair_ticks[t];
+        size_t a = tasks[t].second;
+        for (size_t b = a + 1; b < m.size(); b++) {
+            if (m.codes[m.at(a, b)] != 0) n_fail++;
+        }
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Train of the surface with the traction and the line set (nullptr if not found)
+//-----------------------------------------------------------------------------
+std::shared_ptr<Train> RunControl::surface_train() {
+    if (!prepare_trains(nullptr)) return nullptr;
+    std::shared_ptr<Train> train = find_train(surface.train_id);
+    if (!train) {
+        fprintf(stderr, "Train %d of surface is not found\n", surface.train_id);
+        return nullptr;
+    }
+    if (train->get_line() == nullptr) {
+        fprintf(stderr, "No line of train %d\n", train->id);
+        return nullptr;
+    }
+    return train;
+}
+//-----------------------------------------------------------------------------
+// Run the nodes not run yet in parallel. [Return] the number of failed nodes
+//-----------------------------------------------------------------------------
+int RunControl::run_surface_nodes(const Train& base, int nthreads) {
+    std::vector<size_t> items;
+    for (size_t k = 0; k < surface.size(); k++) {
+        if (surface.nodes[k].state == 0) items.push_back(k);
+    }
+    parallel_for(items.size(), nthreads, [&](size_t i, int worker) {
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("surface", "batch", (int)items[i]);
+        Train train(base);
+        std::vector<double> values;
+        surface.point(items[i], &values);
+        apply_params(train, surface.keys, values);
+        run_stops(train, &surface.nodes[items[i]]);
+    });
+    int n_fail = 0;
+    for (const auto& node : surface.nodes) {
+        if (node.state != 1) n_fail++;
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Load a surface file. Its nodes are kept only if its fingerprint is of the
+// train and the line of the parameter file now; otherwise the surface of the
+// parameter file is built again.
+// [Return] false if the file is invalid or there is no surface to build
+//-----------------------------------------------------------------------------
+bool RunControl::load_surface(const char* fname) {
+    Surface def = surface;
+    if (!surface.load(fname)) return false;
+    if (!prepare_trains(nullptr)) return false;
+    std::shared_ptr<Train> train = find_train(surface.train_id);
+    if (train && surface.fingerprint == surface_fingerprint(*train, surface.keys)) return true;
+    if (def.keys.empty()) {
+        fprintf(stderr, "Surface file %s is of another train or line, and no surface in the parameter file\n", fname);
+        return false;
+    }
+    printf("Surface file %s is of another train or line: built again\n", fname);
+    surface = def;
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Run the nodes of the surface (those of a loaded file are kept).
+// [Return] the number of failed nodes, -1 if the train is not ready
+//-----------------------------------------------------------------------------
+int RunControl::build_surface(int nthreads) {
+    std::shared_ptr<Train> base = surface_train();
+    if (!base) return (-1);
+    surface.fingerprint = surface_fingerprint(*base, surface.keys);
+    return run_surface_nodes(*base, nthreads);
+}
+//-----------------------------------------------------------------------------
+// Answer the queries in order from the surface if the estimated errors are
+// within the tolerances, otherwise by a run of the train. The grid is then
+// refined: a value out of the grid is added to its key, and a query inside
+// the grid splits its cell at the middle along the key of the largest
+// error; the new nodes run in parallel and serve the next queries.
+// [Return] the number of failed queries, -1 if the train is not ready
+//-----------------------------------------------------------------------------
+int RunControl::query_surface(const std::vector<SurfaceQuery>& queries, int nthreads) {
+    surface_answers.assign(queries.size(), SurfaceAnswer());
+    surface_refined = 0;
+    std::shared_ptr<Train> base = surface_train();
+    if (!base) return (-1);
+    int n_fail = 0;
+    for (size_t i = 0; i < queries.size(); i++) {
+        const SurfaceQuery& q = queries[i];
+        SurfaceAnswer& ans = surface_answers[i];
+        if (q.values.size() != surface.keys.size()) {
+            n_fail++;
+            continue;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        bool inside = surface.interpolate(q.values, q.from, q.to, &ans.value);
+        if (inside && surface.trusted(ans.value)) {
+            ans.source = 0;
+            ans.usec = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+            continue;
+        }
+        int axis = inside ? ans.value.axis : -1;
+        Train train(*base);
+        apply_params(train, surface.keys, q.values);
+        SurfaceNode node;
+        ans.value = SurfaceValue();
+        if (q.from < q.to && run_stops(train, &node) == 0 && q.to < node.arrival.size()) {
+            ans.value.time = node.arrival[q.to] - node.departure[q.from];
+            ans.value.energy = node.energy[q.to] - node.energy[q.from];
+            ans.source = 1;
+        } else n_fail++;
+        ans.usec = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        // refinement
+        bool refined = false;
+        for (size_t d = 0; d < surface.keys.size(); d++) {
+            const std::vector<double>& ax = surface.axes[d];
+            if (q.values[d] < ax.front() || q.values[d] > ax.back()) refined |= surface.insert(d, q.values[d]);
+        }
+        if (!refined && axis >= 0) {
+            const std::vector<double>& ax = surface.axes[axis];
+            size_t j = std::upper_bound(ax.begin(), ax.end(), q.values[axis]) - ax.begin();
+            j = std::min(std::max(j, (size_t)1), ax.size() - 1);
+            refined = surface.insert(axis, 0.5 * (ax[j - 1] + ax[j]));
+        }
+        if (refined) {
+            run_surface_nodes(*base, nthreads);
+            surface_refined++;
+        }
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Run every point of the sweep for each train of the sweep in parallel.
+// The lines, traction tables and envelopes are shared by the points; a
+// failed point (e.g. low power) is recorded and the others go on.
+// sweep_stats keeps the points of each train in order (only the items of
+// the shard, k = train index * points + point).
+// [Return] the number of failed runs
+//-----------------------------------------------------------------------------
+int RunControl::run_sweep(int nthreads) {
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(nullptr)) return (-1);
+    for (const auto& train : trains) {
+        if (sweep.has_train(train->id)) list.push_back(train);
+    }
+    size_t n_point = sweep.size();
+    shard_items = list.size() * n_point;
+    std::vector<size_t> items;
+    for (size_t k = 0; k < shard_items; k++) {
+        if (in_shard(k)) items.push_back(k);
+    }
+    sweep_stats.assign(items.size(), SweepStat());
+    // Pre-filter: the run time of a point is the full run of the train plus
+    // the change of the preview from the train to the point
+    std::vector<double> base_time(list.size(), 0.0), base_preview(list.size(), HUGE_VAL);
+    if (sweep.max_time > 0) {
+        parallel_for(list.size(), nthreads, [&](size_t i, int worker) {
+            if (list[i]->get_line() == nullptr) return;
+            trace::set_thread_name("worker", worker);
+            TRACE_SPAN_ARG("sweep base", "batch", list[i]->id);
+            Train train(*list[i]);
+            Trajectory traj;
+            if (run_trajectory(train, &traj, false) != 0) return;
+            base_time[i] = traj.run_time();
+            base_preview[i] = Preview(*list[i]).run_time();
+        });
+    }
+    std::unique_ptr<Progress> progress = start_progress(nthreads, items.size(), items.size());
+    parallel_for(items.size(), nthreads, [&](size_t j, int worker) {
+        size_t k = items[j];
+        SweepStat& stat = sweep_stats[j];
+        const Train& base = *list[k / n_point];
+        stat.point = k % n_point;
+        stat.train_id = base.id;
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("sweep", "batch", stat.train_id);
+        ProgressSlot* slot = progress ? &progress->slot(worker) : nullptr;
+        struct RunDone {
+            ProgressSlot* slot;
+            ~RunDone() { if (slot) slot->add_run(); }
+        } done = {slot};
+        if (list[k / n_point]->get_line() == nullptr) {
+            stat.code = -2;
+            return;
+        }
+        std::vector<double> values;
+        sweep.point(stat.point, &values);
+        Train train(base);
+        sweep.apply(train, values);
+        if (base_preview[k / n_point] != HUGE_VAL) {
+            double t = Preview(train).run_time();
+            if (t != HUGE_VAL) {
+                t += base_time[k / n_point] - base_preview[k / n_point];
+                if (t > sweep.max_time * (1 + sweep.margin)) {
+                    stat.code = -6;
+                    stat.run_time = t;
+                    return;
+                }
+            }
+        }
+        Trajectory traj;
+        stat.code = run_trajectory(train, &traj, false, slot);
+        stat.run_time = traj.run_time();
+        stat.energy = traj.energy();
+        stat.stations = traj.arrivals.size();
+    });
+    if (progress) progress->finish();
+    int n_fail = 0;
+    for (const auto& stat : sweep_stats) {
+        if (stat.code != 0 && stat.code != -6) n_fail++;
+    }
+    return n_fail;
+}
+//-----------------------------------------------------------------------------
+// Run the samples of each train of the Monte Carlo in parallel. Each worker
+// adds the results to its own digests, which are merged at the end, so the
+// memory does not grow with the number of samples. Only the runs of the
+// shard are done (k = train index * samples + sample).
+// [Return] the number of failed runs
+//-----------------------------------------------------------------------------
+int RunControl::run_montecarlo(int nthreads) {
+    std::vector<std::shared_ptr<Train>> list;
+    if (!prepare_trains(nullptr)) return (-1);
+    for (const auto& train : trains) {
+        if (montecarlo.has_train(train->id)) list.push_back(train);
+    }
+    size_t n_sample = montecarlo.samples;
+    size_t n_block = (n_sample + MONTECARLO_BLOCK - 1) / MONTECARLO_BLOCK;
+    // blocks of the shard: k = train index * n_block + block
+    shard_items = list.size() * n_block;
+    std::vector<size_t> items;
+    for (size_t k = 0; k < shard_items; k++) {
+        if (in_shard(k)) items.push_back(k);
+    }
+    mc_blocks.assign(items.size(), MonteCarloStat());
+    size_t n_run = 0;
+    for (size_t k : items) n_run += std::min(MONTECARLO_BLOCK, n_sample - (k % n_block) * MONTECARLO_BLOCK);
+    std::unique_ptr<Progress> progress = start_progress(nthreads, items.size(), n_run);
+    parallel_for(items.size(), nthreads, [&](size_t j, int worker) {
+        size_t k = items[j];
+        size_t i = k / n_block;
+        size_t s0 = (k % n_block) * MONTECARLO_BLOCK;
+        size_t s1 = std::min(s0 + MONTECARLO_BLOCK, n_sample);
+        MonteCarloStat& stat = mc_blocks[j];
+        ProgressSlot* slot = progress ? &progress->slot(worker) : nullptr;
+        stat.train_id = list[i]->id;
+        stat.block = k;
+        if (list[i]->get_line() == nullptr) {
+            stat.code = -2;
+            stat.n_fail = s1 - s0;
+            for (size_t s = s0; slot && s < s1; s++) slot->add_run();
+            return;
+        }
+        trace::set_thread_name("worker", worker);
+        TRACE_SPAN_ARG("montecarlo block", "batch", stat.train_id);
+        for (size_t s = s0; s < s1; s++) {
+            Train train(*list[i]);
+            montecarlo.apply(train, s);
+            Trajectory traj;
+            int code = run_trajectory(train, &traj, false, slot);
+            if (slot) slot->add_run();
+            if (code != 0) {
+                stat.n_fail++;
+                continue;
+            }
+            stat.run_time.add(traj.run_time());
+            stat.energy.add(traj.energy());
+            if (stat.arrivals.size() < traj.arrivals.size()) stat.arrivals.resize(traj.arrivals.size());
+            for (size_t a = 0; a < traj.arrivals.size(); a++) stat.arrivals[a].add(traj.arrivals[a]);
+        }
+        stat.flush();
+    });
+    if (progress) progress->finish();
+    merge_montecarlo_blocks(mc_blocks, &mc_stats);
+    size_t n_fail = 0;
+    for (const auto& st : mc_stats) n_fail += st.n_fail;
+    return (int)n_fail;
+}
+//-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
 void RunControl::traction_test(const char* fname) {
@@ -4,17 +4,91 @@
 #include <string>
 #include <memory>
 #include <list>
+#include <vector>
 #include "RailLine.h"
 #include "train.h"
+#include "Envelope.h"
+#include "Progress.h"
+#include "Simulate.h"
+#include "Sweep.h"
+#include "MonteCarlo.h"
+#include "Sensitivity.h"
+#include "Calibration.h"
+#include "Surface.h"
+#include "Preview.h"
+#include "StopPattern.h"
+#include "StationMatrix.h"
+///////////////////////////////////////////////
+// Result of a run in run_batch
+struct RunStat {
+    int train_id;
+    int code;          // 0: success, -1: file or train length, -2: no line, -3: low power, -4: SVG
+    double sim_time;   // simulated time (s)
+    long bytes;        // bytes written (result and SVG)
+    RunStat(): train_id(0), code(0), sim_time(0), bytes(0) {};
+};
+// Result of a train in optimize_driving (index: section)
+struct DriveStat {
+    int train_id;
+    int code;                           // 0: success, -1: train length, -2: no line, -3: low power
+    std::vector<DriveSection> drive;    // chosen driving of each section
+    std::vector<double> from, to;       // start and end of the section (m)
+    std::vector<double> base_time, base_energy; // full traction (s, kJ)
+    std::vector<double> time, energy;   // chosen driving (s, kJ)
+    double time_limit;                  // limit of the run time (s)
+    double base_total_time, base_total_energy;  // full traction (s, kJ)
+    double total_time, total_energy;    // run with the chosen driving (s, kJ)
+    size_t n_candidates, n_abandoned;   // runs of the sections
+    size_t n_filtered;                  // abandoned by the preview without a run
+    size_t n_dominated;                 // runs dropped before the choice
+    size_t n_fallback;                  // sections back to full traction for the limit
+    DriveStat(): train_id(0), code(0), time_limit(0), base_total_time(0), base_total_energy(0),
+        total_time(0), total_energy(0), n_candidates(0), n_abandoned(0), n_filtered(0),
+        n_dominated(0), n_fallback(0) {};
+};
+// Table of the sections: the chosen driving against full traction
+void print_drive(FILE* fp, const std::vector<DriveStat>& stats);
 ///////////////////////////////////////////////
 class RunControl {
     double mSvgMaxpt;
+    bool mCoalesce;     // merge the same segments after reading lines
+    double mProgressInterval;       // progress report of batch, sweep and montecarlo (s), 0: none
+    std::string mStatusFile;        // status file of batch, sweep and montecarlo
+    int mShard, mNShard;            // the item k of batch, sweep and montecarlo is run if k % mNShard == mShard
+    bool prepare_trains(std::vector<std::shared_ptr<Train>>* list);
+    std::shared_ptr<Train> find_train(int train_id) const;
+    std::unique_ptr<Progress> start_progress(int nthreads, size_t n_tasks, size_t n_runs);
+    std::shared_ptr<Train> surface_train();
+    int run_surface_nodes(const Train& base, int nthreads);
 public:
     std::string errmsg;
     std::list<std::shared_ptr<Train>> trains;
     std::list<std::shared_ptr<RailLine>> lines;
     std::list<std::shared_ptr<SpeedTraction>> sptr_list;
     std::list<std::shared_ptr<Motor>> motors;
+    std::shared_ptr<EnvelopeCache> envelopes;   // braking envelopes shared by trains
+    std::vector<RunStat> batch_stats;           // results of run_batch
+    std::vector<VerifyStat> verify_stats;       // results of verify
+    std::vector<DtStudy> dt_stats;              // results of dt_study
+    Sweep sweep;                                // "sweep" of the parameter file
+    std::vector<SweepStat> sweep_stats;         // results of run_sweep
+    std::vector<DriveStat> drive_stats;         // results of optimize_driving
+    std::vector<SensStat> sens_stats;           // results of sensitivity
+    std::vector<PreviewStat> preview_stats;     // results of preview
+    Calibration calibration;                    // "calibration" of the parameter file
+    CalibStat calib_stat;                       // result of calibrate
+    StopPatterns patterns;                      // "patterns" of the parameter file
+    std::vector<PatternSection> pattern_sections;   // sections run by run_patterns
+    std::vector<PatternStat> pattern_stats;     // results of run_patterns
+    size_t pattern_uses;                        // sections of all the patterns
+    std::vector<StationMatrix> matrices;        // results of run_matrix
+    Surface surface;                            // "surface" of the parameter file or a file
+    std::vector<SurfaceAnswer> surface_answers; // results of query_surface
+    size_t surface_refined;                     // refinements by query_surface
+    MonteCarlo montecarlo;                      // "montecarlo" of the parameter file
+    std::vector<MonteCarloStat> mc_blocks;      // blocks of run_montecarlo (of the shard)
+    std::vector<MonteCarloStat> mc_stats;       // results of run_montecarlo
+    size_t shard_items;                         // items of run_sweep or run_montecarlo in all the shards
 public:
     std::shared_ptr<RailLine> present_line;
     std::shared_ptr<Train> present_train;
@@ -29,9 +103,34 @@ public:
     void set_train_motor();
     bool set_train_line();
     int run1(const char* fname);
+    int run_batch(const char* prefix, const char* svg_prefix, int nthreads);
+    int simulate(Train& train, FILE* fp, RunStat* stat, ProgressSlot* slot = nullptr);
+    int verify(const char* kernel, const VerifyTolerance& tol, int nthreads);
+    double dt_study(double dt_max, int levels, const VerifyTolerance& tol, int nthreads);
+    int run_sweep(int nthreads);
+    int optimize_driving(double slack, int nthreads);
+    int sensitivity(const std::vector<std::string>& keys, int nthreads);
+    int preview(int nthreads);
+    int calibrate(int nthreads);
+    int run_patterns(int nthreads);
+    int run_matrix(int nthreads);
+    bool load_surface(const char* fname);
+    int build_surface(int nthreads);
+    int query_surface(const std::vector<SurfaceQuery>& queries, int nthreads);
+    int run_montecarlo(int nthreads);
     void traction_test(const char* fname);
     void print_data();
     double svg_maxpt() { return mSvgMaxpt; };
+    void set_coalesce(bool b) { mCoalesce = b; };
+    void set_shard(int i, int n) {
+        mShard = i;
+        mNShard = n;
+    };
+    bool in_shard(size_t k) const { return (int)(k % mNShard) == mShard; };
+    void set_progress(double interval, const std::string& status_file) {
+        mProgressInterval = interval;
+        mStatusFile = status_file;
+    };
 };
 
 #endif
@@ -6,8 +6,13 @@
 #include <memory>
 #include <list>
 #include <vector>
+#include <sys/stat.h>
 #include "RailLine.h"
 #include "SVGConv.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "ResultFile.h"
 ///////////////////////////////////////////////////////////////////////////////
 using namespace std;
 //-----------------------------------------------------------------------------
@@ -74,7 +79,7 @@ void SVGText::print_svg(FILE* fp) {
 //---------------------------------------------------------------------------------------
 // SVGConverter: Constructor
 //---------------------------------------------------------------------------------------
-SVGConvert::SVGConvert() {
+SVGConvert::SVGConvert() : mem(memory::SVG) {
     svg_axis_x = 800; svg_axis_y = 500;
     xmargin = 100; ymargin = 100;
     base_axis_x = 0;
@@ -84,6 +89,8 @@ SVGConvert::SVGConvert() {
     xlim_min = ylim_min = 0;
     xlim_max = 0;
     ylim_max = 10;
+    stride = 1;
+    threads = 0;
 }
 //---------------------------------------------------------------------------------------
 // Read rail data
@@ -107,6 +114,7 @@ bool SVGConvert::read_rail(const char* fname) {
         start++;
     }
     track.push_back(bg_point(dist, pre_speed));
+    update_mem();
     return true;
 }
 //---------------------------------------------------------------------------------------
@@ -130,72 +138,156 @@ bool SVGConvert::read_rail(std::shared_ptr<RailLine>& line) {
         start++;
     }
     track.push_back(bg_point(dist, pre_speed));
+    update_mem();
     return true;
 }
 //---------------------------------------------------------------------------------------
 // The maximum numbre of points = 1000
+// The rows are parsed in parallel into columns (ResultFile.h). If the
+// columns may go over the trajectory budget, the rows are streamed into
+// svg_items instead. If svg_items go over the SVG budget, the points are
+// decimated.
 //---------------------------------------------------------------------------------------
 bool SVGConvert::load(const char* fname) {
-    using namespace boost::assign;
-    
+    METRIC_PHASE(SVG);
+    // The file image and about 52 bytes for each row of 20 bytes or more
+    struct stat st;
+    if (stat(fname, &st) != 0) return false;
+    if (memory::over_budget(memory::Trajectory, (int64_t)st.st_size * 4)) return load_stream(fname);
+    ResultColumns cols;
+    memory::Charge traj_mem(memory::Trajectory);
+    trace::Span parse_span("SVGConvert::load parse", "svg");
+    if (!read_result_file(fname, &cols, threads)) return false;
+    traj_mem.set(cols.bytes());
+    size_t n = cols.size();
+    for (size_t i = 0; i < n; i++) {
+        if (cols.distance[i] > base_axis_x) base_axis_x = cols.distance[i];
+        if (cols.speed[i] > base_axis_y) base_axis_y = cols.speed[i];
+    }
+    parse_span.end();
+    TRACE_SPAN("SVGConvert::load items", "svg");
+    /* Calculate xlim_max and xlim_may based on base_axis_x and base_axis_y */
+    set_limit();
+    /* Construct svg_items */
+    ItemBuilder builder;
+    for (size_t i = 0; i < n; i++) {
+        ResultData d = {cols.status[i], cols.time[i], cols.distance[i], cols.speed[i],
+            cols.accel[i], cols.force[i], cols.power[i]};
+        add_row(builder, d, i + 1 == n);
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+// Rows are read one by one and added to svg_items (one row is kept to know
+// the last one)
+//-----------------------------------------------------------------------------
+bool SVGConvert::load_stream(const char* fname) {
     std::string str;
-    std::list<ResultData> results;
-    // Load the data into the memory
+    ItemBuilder builder;
+    bool has_row = false;
+    ResultData prev;
+    TRACE_SPAN("SVGConvert::load stream", "svg");
     std::ifstream fi(fname);
     if (!fi) return false;
     // Header file
-    if (std::getline(fi, str)) {
-        while (std::getline(fi, str)) {
-            if (str.empty()) return false;
-            std::istringstream iss(str);
-            ResultData d;
-            iss >> d;
-            if (!iss) {
-                return false;
-            }
-            if (d.distance > base_axis_x) base_axis_x = d.distance;
-            if (d.speed > base_axis_y) base_axis_y = d.speed;
-            results.push_back(d);
+    if (!std::getline(fi, str)) return false;
+    while (std::getline(fi, str)) {
+        if (str.empty()) return false;
+        std::istringstream iss(str);
+        ResultData d;
+        iss >> d;
+        if (!iss) {
+            return false;
         }
-    }
-    else {
-        return false;
+        if (d.distance > base_axis_x) base_axis_x = d.distance;
+        if (d.speed > base_axis_y) base_axis_y = d.speed;
+        if (has_row) add_row(builder, prev, false);
+        prev = d;
+        has_row = true;
     }
     fi.close();
-    /* Calculate xlim_max and xlim_may based on base_axis_x and base_axis_y */
     set_limit();
-    /* Construct svg_items */
-    int pre_status = -1;
-    double pre_distance = 0;
-    double pre_speed = 0;
-    std::size_t count = 1;
-    boost::geometry::model::linestring<bg_point> data;
-    data += bg_point(0.0, 0.0);
-    for(list<ResultData>::const_iterator it = results.cbegin(); it != results.cend(); ++it) {
-        if( (pre_status != -1 && pre_status != it->status) || count == results.size()) {
-            if( pre_status == 3 ) {
-                // in station, no move
-            } if(data.size() == 2 ) {
-                svg_items += data;
-            } else if (data.size() < 1000) {
-                svg_items += data; 
-            }
-            data.clear();
-            data.push_back(bg_point(pre_distance, pre_speed));
-        }
-        if (data.size() >= 1000) {
-            svg_items += data;
-            data.clear();
+    if (has_row) add_row(builder, prev, true);
+    return true;
+}
+//-----------------------------------------------------------------------------
+// SVGConvert::ItemBuilder: the line starts at the origin
+//-----------------------------------------------------------------------------
+SVGConvert::ItemBuilder::ItemBuilder() {
+    pre_status = -1;
+    pre_distance = 0;
+    pre_speed = 0;
+    row = 0;
+    data.push_back(bg_point(0.0, 0.0));
+}
+//-----------------------------------------------------------------------------
+// Add a row to the builder. A line is cut at each change of status and
+// every 1000 points. last: the row is the last one.
+//-----------------------------------------------------------------------------
+void SVGConvert::add_row(ItemBuilder& b, const ResultData& d, bool last) {
+    bool change = (b.pre_status != -1 && b.pre_status != d.status) || last;
+    b.row++;
+    if (!change && stride > 1 && b.row % stride != 0) {
+        b.pre_distance = d.distance;
+        b.pre_speed = d.speed;
+        b.pre_status = d.status;
+        return;
+    }
+    if (change) {
+        if( b.pre_status == 3 ) {
+            // in station, no move
+        } if(b.data.size() == 2 ) {
+            add_item(b.data);
+        } else if (b.data.size() < 1000) {
+            add_item(b.data);
         }
-        data.push_back(bg_point(it->distance, it->speed));
-        pre_distance = it->distance;
-        pre_speed = it->speed;
-        pre_status = it->status;
-        count++;
+        b.data.clear();
+        b.data.push_back(bg_point(b.pre_distance, b.pre_speed));
+    }
+    if (b.data.size() >= 1000) {
+        add_item(b.data);
+        b.data.clear();
+    }
+    b.data.push_back(bg_point(d.distance, d.speed));
+    b.pre_distance = d.distance;
+    b.pre_speed = d.speed;
+    b.pre_status = d.status;
+}
+//-----------------------------------------------------------------------------
+void SVGConvert::add_item(const bg_linestring& ls) {
+    svg_items.push_back(ls);
+    const bg_linestring& item = svg_items.back();
+    mem.set(mem.get() + (int64_t)(sizeof(bg_linestring) + 2 * sizeof(void*) + item.capacity() * sizeof(bg_point)));
+    while (memory::over_budget(memory::SVG, 0) && decimate()) {}
+}
+//-----------------------------------------------------------------------------
+// Remove every second point of svg_items (the ends are kept) and double
+// the stride. Return false if no point can be removed.
+//-----------------------------------------------------------------------------
+bool SVGConvert::decimate() {
+    bool removed = false;
+    for (auto& ls : svg_items) {
+        if (ls.size() <= 2) continue;
+        bg_linestring out;
+        for (size_t i = 0; i < ls.size(); i += 2) out.push_back(ls[i]);
+        if ((ls.size() & 1) == 0) out.push_back(ls.back());
+        if (out.size() < ls.size()) removed = true;
+        ls.swap(out);
     }
+    if (!removed) return false;
+    stride *= 2;
+    update_mem();
     return true;
 }
 //-----------------------------------------------------------------------------
+void SVGConvert::update_mem() {
+    size_t n = track.capacity() * sizeof(bg_point);
+    for (const auto& ls : svg_items) {
+        n += sizeof(bg_linestring) + 2 * sizeof(void*) + ls.capacity() * sizeof(bg_point);
+    }
+    mem.set((int64_t)n);
+}
+//-----------------------------------------------------------------------------
 // Convert distance(km)-speed(km/h) to screen x-y points
 //-----------------------------------------------------------------------------
 void SVGConvert::convert_func(double x, double y, double& rx, double& ry) {
@@ -361,13 +453,18 @@ void SVGConvert::svg_print(FILE* fp) {
 // Save as a svg file
 //-----------------------------------------------------------------------------
 bool SVGConvert::svg_save(const char* fname) {
+    METRIC_PHASE(SVG);
     FILE* fp;
     errno_t err = fopen_s(&fp, fname, "wt");
     if ( err != 0 ) {
         fprintf(stderr, "Cannot create file %s\n", fname);
         return false;
     }
-    svg_print(fp);
+    {
+        TRACE_SPAN("SVGConvert::svg_print", "svg");
+        svg_print(fp);
+    }
+    TRACE_SPAN("SVGConvert flush", "svg");
     fclose(fp);
     return true;
 }
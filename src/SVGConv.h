@@ -9,6 +9,7 @@
 #include <list>
 #include <vector>
 #include <functional>
+#include "Memory.h"
 ///////////////////////////////////////////////////////////////////////////////
 // For simplify
 #include <boost/geometry.hpp>
@@ -116,6 +117,17 @@ class SVGConvert {
     std::list<SVGLine> ytics;
     std::list<SVGText> ylabels;
     double simple_dist;   // used for the simplify function    
+    size_t stride;        // every stride-th row is used (doubled over the SVG budget)
+    memory::Charge mem;   // svg_items and track
+    int threads;          // threads of reading the result file (0: all cores)
+    // State of making svg_items from the rows
+    struct ItemBuilder {
+        int pre_status;
+        double pre_distance, pre_speed;
+        size_t row;
+        bg_linestring data;
+        ItemBuilder();
+    };
 public:
     SVGConvert();
     bool load(const char* fname);
@@ -124,13 +136,19 @@ public:
     void convert_func(double x, double y, double& rx, double& ry);
     void set_limit();
     void set_simplify(double a);
+    void set_threads(int n) { threads = n; };
     void svg_print(FILE * fp);
     bool svg_save(const char* fname);
 protected:
+    bool load_stream(const char* fname);
     void print_lines(FILE* fp, const bg_linestring& ls);
     void set_xtic_unit();
     void set_xtics();
     void set_ytics();
+    void add_row(ItemBuilder& b, const ResultData& d, bool last);
+    void add_item(const bg_linestring& ls);
+    bool decimate();
+    void update_mem();
 };
 
 #endif
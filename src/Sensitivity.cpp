@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <algorithm>
+#include "Sensitivity.h"
+////////////////////////////////////////////////////////////////////////////////
+static const char* sens_keys[] = {"weight", "acceleration", "deceleration",
+    "res0", "res1", "res2", "res3", "res4", "res5", "start_resist", "curve_resist_A", nullptr};
+
+bool valid_sens_key(const std::string& key) {
+    for (int i = 0; sens_keys[i]; i++) {
+        if (key == sens_keys[i]) return true;
+    }
+    return false;
+}
+
+std::vector<std::string> default_sens_keys(const TrainBase& train) {
+    std::vector<std::string> keys = {"weight", "acceleration", "deceleration"};
+    int n = 0;
+    switch (train.res_type) {
+        case RollingResistance::Quadratic: n = 3; break;
+        case RollingResistance::JNR_EMU: n = 4; break;
+        case RollingResistance::JNR_EMU_MT: n = 6; break;
+        default: break;
+    }
+    for (int i = 0; i < n; i++) keys.push_back("res" + std::to_string(i));
+    return keys;
+}
+//-----------------------------------------------------------------------------
+// The forces of ForceMethod::SIMPLE follow the weight and the acceleration
+// (TrainBase::set_simple_method), WM and WT follow the weight.
+//-----------------------------------------------------------------------------
+bool TrainSens::init(const TrainBase& train, const std::vector<std::string>& param_keys) {
+    if (param_keys.size() > (size_t)SENS_MAX) {
+        fprintf(stderr, "Too many parameters of sensitivities (max %d)\n", SENS_MAX);
+        return false;
+    }
+    keys = param_keys;
+    TrainCoefs<SensDual>& c = coefs;
+    SensDual weight = train.weight;
+    SensDual acc = train.fixed_acc;
+    c.dec = train.dec;
+    c.start_resist = train.start_resist;
+    c.curve_resist_A = train.curve_resist_A;
+    for (int i = 0; i < 6; i++) c.res_coefs[i] = train.res_coefs[i];
+    for (size_t i = 0; i < keys.size(); i++) {
+        const std::string& key = keys[i];
+        int k = (int)i;
+        if (key == "weight") weight = SensDual::var(train.weight, k);
+        else if (key == "acceleration") acc = SensDual::var(train.fixed_acc, k);
+        else if (key == "deceleration") c.dec = SensDual::var(train.dec, k);
+        else if (key == "start_resist") c.start_resist = SensDual::var(train.start_resist, k);
+        else if (key == "curve_resist_A") c.curve_resist_A = SensDual::var(train.curve_resist_A, k);
+        else if (key.size() == 4 && key.compare(0, 3, "res") == 0 && key[3] >= '0' && key[3] <= '5') {
+            int j = key[3] - '0';
+            c.res_coefs[j] = SensDual::var(train.res_coefs[j], k);
+        }
+        else {
+            fprintf(stderr, "Unknown parameter of sensitivities: %s\n", key.c_str());
+            return false;
+        }
+    }
+    c.weight = weight;
+    c.WM = (train.weight > 0) ? weight * (train.WM / train.weight) : SensDual(train.WM);
+    c.WT = (train.weight > 0) ? weight * (train.WT / train.weight) : SensDual(train.WT);
+    c.fixed_force = (weight * 1000) * (1 + train.inertia) * acc;
+    c.fixed_power = c.fixed_force * (train.torque_max_speed / 3.6);
+    c.simple_const = c.fixed_power * (train.power_max_speed / 3.6);
+    reset();
+    return true;
+}
+
+void TrainSens::reset() {
+    x = v = power = energy = arrive = run_time = SensDual();
+    move = 0;
+    rate_x = rate_v = rate_p = 0;
+    seg = 0;
+    limspeed = 0;
+}
+//-----------------------------------------------------------------------------
+void print_sensitivity(FILE* fp, const std::vector<SensStat>& stats) {
+    fprintf(fp, "train\trun_time\trunning_time\tenergy\tkey\tvalue\td_running_time\td_energy\n");
+    for (const auto& s : stats) {
+        if (s.code != 0) continue;
+        for (size_t i = 0; i < s.keys.size(); i++) {
+            fprintf(fp, "%d\t%.3f\t%.3f\t%.1f\t%s\t%g\t%.6g\t%.6g\n", s.train_id, s.run_time, s.running_time,
+                s.energy, s.keys[i].c_str(), s.values[i], s.d_time[i], s.d_energy[i]);
+        }
+    }
+}
@@ -0,0 +1,76 @@
+/**
+ * Sensitivities of the run time and the energy to the parameters of a train
+ * by forward-mode automatic differentiation (Dual.h).
+ * The real run decides the branches; the derivatives of the distance, the
+ * speed and the energy follow it with the same kernels on Dual numbers.
+ * When the driving changes (traction, coasting, constant, braking) or the
+ * segment changes, the time of the change moves with the parameters, which
+ * is added as a jump of the derivatives. The running time of a section is
+ * differentiated through the remaining time of the braking to the stop.
+ */
+#ifndef SENSITIVITY_H
+#define SENSITIVITY_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "Dual.h"
+#include "TrainBase.h"
+////////////////////////////////////////////////////////////////////////////////
+constexpr int SENS_MAX = 12;    // parameters of a run
+using SensDual = Dual<SENS_MAX>;
+//-----------------------------------------------------------------------------
+// Parameters of the kernels that can be differentiated. The names are the
+// members of TrainBase, so the kernels take either a train (double) or
+// TrainCoefs<Dual>.
+//-----------------------------------------------------------------------------
+template <class T> struct TrainCoefs {
+    T weight, WM, WT;           // ton
+    T res_coefs[6];
+    T start_resist;             // N/t
+    T curve_resist_A;           // N/t x m
+    T fixed_force, fixed_power, simple_const;   // ForceMethod::SIMPLE
+    T dec;                      // m/s^2
+};
+// Keys: "weight", "acceleration", "deceleration", "res0" - "res5",
+// "start_resist", "curve_resist_A"
+bool valid_sens_key(const std::string& key);
+// weight, acceleration, deceleration and the coefficients of the resistance model
+std::vector<std::string> default_sens_keys(const TrainBase& train);
+//-----------------------------------------------------------------------------
+// Derivatives of a run (Train::sens)
+//-----------------------------------------------------------------------------
+struct TrainSens {
+    std::vector<std::string> keys;  // parameter of each derivative
+    TrainCoefs<SensDual> coefs;
+    SensDual x, v;          // distance (m) and speed (m/s)
+    SensDual power;         // kW (kept as the power of the train)
+    SensDual energy;        // kJ
+    SensDual arrive;        // remaining time of braking to the stop (s)
+    SensDual run_time;      // running time (s): the time of the steps out of the stops
+    int move;               // driving of the last step (Train::SensMove)
+    double rate_x, rate_v;  // m/s and m/s^2 of the last step
+    double rate_p;          // power of the last step (kW)
+    size_t seg;             // segment of the last step
+    double limspeed;        // speed limit of the last step (m/s)
+    // Set the parameters of the keys. Return false if a key is unknown.
+    bool init(const TrainBase& train, const std::vector<std::string>& keys);
+    // Start of a run
+    void reset();
+};
+// Result of a train in run_sensitivity
+struct SensStat {
+    int train_id;
+    int code;                   // 0: success, -1: train length, -2: no line, -3: low power, -4: keys
+    std::vector<std::string> keys;
+    std::vector<double> values; // value of each key
+    double run_time;            // s (with the stops)
+    double running_time;        // s (sum of the sections)
+    double energy;              // kJ
+    std::vector<double> d_time, d_energy;   // derivatives of running_time and energy by each key
+    SensStat(): train_id(0), code(0), run_time(0), running_time(0), energy(0) {};
+};
+// A row of each key with the KPIs of the train (failed trains are not printed)
+void print_sensitivity(FILE* fp, const std::vector<SensStat>& stats);
+
+#endif
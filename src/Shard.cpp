@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include "Shard.h"
+#include "MonteCarlo.h"
+////////////////////////////////////////////////////////////////////////////////
+bool parse_shard(const char* str, int* index, int* count) {
+    char* end;
+    long i = strtol(str, &end, 10);
+    if (end == str || *end != '/') return false;
+    const char* p = end + 1;
+    long n = strtol(p, &end, 10);
+    if (end == p || *end != '\0' || n < 1 || i < 0 || i >= n) return false;
+    *index = (int)i;
+    *count = (int)n;
+    return true;
+}
+
+void print_shard_header(FILE* fp, int index, int count, const char* kind, size_t items) {
+    fprintf(fp, "# runrail shard %d/%d %s %zu\n", index, count, kind, items);
+}
+//-----------------------------------------------------------------------------
+// The row k of a sweep is the row k / N of the shard k % N
+//-----------------------------------------------------------------------------
+static bool merge_sweep(FILE* fp, std::vector<std::unique_ptr<std::ifstream>>& files, size_t items) {
+    size_t n = files.size();
+    std::string header, str;
+    for (size_t i = 0; i < n; i++) {
+        if (!std::getline(*files[i], str) || (i > 0 && str != header)) {
+            fprintf(stderr, "Columns of the shards do not match\n");
+            return false;
+        }
+        header = str;
+    }
+    fprintf(fp, "%s\n", header.c_str());
+    size_t k = 0;
+    while (std::getline(*files[k % n], str)) {
+        fprintf(fp, "%s\n", str.c_str());
+        k++;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (std::getline(*files[i], str)) {
+            fprintf(stderr, "Rows of the shards do not match\n");
+            return false;
+        }
+    }
+    if (k != items) {
+        fprintf(stderr, "%zu rows of %zu in the shards\n", k, items);
+        return false;
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+// The blocks of all shards are merged in their order as in a single run
+//-----------------------------------------------------------------------------
+static bool merge_montecarlo(FILE* fp, std::vector<std::unique_ptr<std::ifstream>>& files, size_t items) {
+    std::vector<MonteCarloStat> blocks, stats;
+    std::vector<double> quantiles;
+    for (size_t i = 0; i < files.size(); i++) {
+        std::vector<MonteCarloStat> bs;
+        std::vector<double> qs;
+        if (!read_montecarlo_sketch(*files[i], &bs, &qs) || (i > 0 && qs != quantiles)) {
+            fprintf(stderr, "Invalid sketch of shard %zu\n", i);
+            return false;
+        }
+        quantiles = qs;
+        for (auto& b : bs) blocks.push_back(std::move(b));
+    }
+    std::vector<bool> found(items, false);
+    for (const auto& b : blocks) {
+        if (b.block >= items || found[b.block]) {
+            fprintf(stderr, "Block %zu of the shards is invalid\n", b.block);
+            return false;
+        }
+        found[b.block] = true;
+    }
+    if (blocks.size() != items) {
+        fprintf(stderr, "%zu blocks of %zu in the shards\n", blocks.size(), items);
+        return false;
+    }
+    merge_montecarlo_blocks(blocks, &stats);
+    print_montecarlo(fp, stats, quantiles);
+    return true;
+}
+//-----------------------------------------------------------------------------
+bool merge_shards(const char* out_fname, const std::vector<std::string>& fnames) {
+    if (fnames.empty()) return false;
+    std::vector<std::unique_ptr<std::ifstream>> files(fnames.size());
+    std::string kind;
+    int count = 0;
+    size_t items = 0;
+    for (const auto& fname : fnames) {
+        std::unique_ptr<std::ifstream> fi(new std::ifstream(fname));
+        std::string str, mark, name, spec, k;
+        int index, n;
+        size_t m;
+        if (!*fi || !std::getline(*fi, str)) {
+            fprintf(stderr, "Cannot read file %s\n", fname.c_str());
+            return false;
+        }
+        std::istringstream iss(str);
+        if (!(iss >> mark >> name >> str >> spec >> k >> m) || mark != "#" || name != "runrail" || str != "shard"
+            || !parse_shard(spec.c_str(), &index, &n)) {
+            fprintf(stderr, "Not a shard file: %s\n", fname.c_str());
+            return false;
+        }
+        if (count == 0) {
+            count = n;
+            kind = k;
+            items = m;
+            files.resize(n);
+        }
+        if (n != count || k != kind || m != items || files[index]) {
+            fprintf(stderr, "Shard %s of %s does not match\n", spec.c_str(), fname.c_str());
+            return false;
+        }
+        files[index] = std::move(fi);
+    }
+    for (int i = 0; i < count; i++) {
+        if (!files[i]) {
+            fprintf(stderr, "Shard %d/%d is missing\n", i, count);
+            return false;
+        }
+    }
+    if (kind != "sweep" && kind != "montecarlo") {
+        fprintf(stderr, "Shards of %s cannot be merged\n", kind.c_str());
+        return false;
+    }
+    // the output is replaced only by a complete merge
+    std::string tmp_fname = std::string(out_fname) + ".tmp";
+    FILE* fp = fopen(tmp_fname.c_str(), "wt");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot create file %s\n", tmp_fname.c_str());
+        return false;
+    }
+    bool ret;
+    if (kind == "sweep") ret = merge_sweep(fp, files, items);
+    else ret = merge_montecarlo(fp, files, items);
+    if (fclose(fp) != 0) ret = false;
+    if (!ret) {
+        remove(tmp_fname.c_str());
+        return false;
+    }
+    // rename does not replace a file on Windows
+    if (rename(tmp_fname.c_str(), out_fname) != 0 && (remove(out_fname) != 0 || rename(tmp_fname.c_str(), out_fname) != 0)) {
+        fprintf(stderr, "Cannot rename %s to %s\n", tmp_fname.c_str(), out_fname);
+        remove(tmp_fname.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,26 @@
+/**
+ * Sharded runs (--shard i/N) and the merge of the shard files (--merge).
+ * The item k of a batch, a sweep or a Monte Carlo run (a block of samples)
+ * goes to the shard k % N, so the shards can run in separate processes or
+ * machines. A shard file starts with "# runrail shard i/N kind items" (the
+ * items of all the shards); the sweep rows of the shard follow in the order
+ * of k, a Monte Carlo shard has the digests of its blocks.
+ */
+#ifndef SHARD_H
+#define SHARD_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+// "i/N" (0 <= i < N). Return false if invalid.
+bool parse_shard(const char* str, int* index, int* count);
+void print_shard_header(FILE* fp, int index, int count, const char* kind, size_t items);
+//-----------------------------------------------------------------------------
+// Merge the shard files (all shards of a run, in any order) into the file of
+// a single run
+// [Return] false if a shard or an item is missing or the files do not match
+//-----------------------------------------------------------------------------
+bool merge_shards(const char* out_fname, const std::vector<std::string>& fnames);
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+#include "Simulate.h"
+////////////////////////////////////////////////////////////////////////////////
+// Only the kernels that compute the same model. A model option such as
+// "averageresist" changes the run, so it is kept as the train has it.
+const char* kernel_names[] = {"brakecurve", nullptr};
+//-----------------------------------------------------------------------------
+// The first point at or after x is found by a binary search, so the time of
+// a stop is the arrival time.
+//-----------------------------------------------------------------------------
+bool Trajectory::at_distance(double x, TrajPoint* p) const {
+    if (points.empty() || x < points.front().distance || x > points.back().distance) return false;
+    auto it = std::lower_bound(points.begin(), points.end(), x,
+        [](const TrajPoint& q, double d) { return q.distance < d; });
+    if (it == points.begin()) {
+        *p = *it;
+        return true;
+    }
+    const TrajPoint& q1 = *(it - 1);
+    const TrajPoint& q2 = *it;
+    double r = (x - q1.distance) / (q2.distance - q1.distance);
+    p->distance = x;
+    p->time = q1.time + (q2.time - q1.time) * r;
+    p->speed = q1.speed + (q2.speed - q1.speed) * r;
+    p->energy = q1.energy + (q2.energy - q1.energy) * r;
+    return true;
+}
+//-----------------------------------------------------------------------------
+int run_trajectory(Train& train, Trajectory* traj, bool keep_points, ProgressSlot* slot) {
+    traj->points.clear();
+    traj->arrivals.clear();
+    if (train.prepare_run() != 0) return (-1);
+    if (keep_points) traj->points.push_back({train.get_time(), train.get_dist(), train.get_speed(), train.get_energy()});
+    int result;
+    uint64_t ticks = 0;
+    while (true) {
+        result = train.main_run();
+        if (keep_points) traj->points.push_back({train.get_time(), train.get_dist(), train.get_speed(), train.get_energy()});
+        if (result == RunCode::NextStation) traj->arrivals.push_back(train.get_time());
+        if (slot && ++ticks == Progress::publish_ticks) {
+            slot->add(ticks, 0);
+            ticks = 0;
+        }
+        if (result == RunCode::LessPower || result == RunCode::EndOfLine) break;
+    }
+    if (slot) slot->add(ticks, 0);
+    traj->code = result;
+    traj->total_time = train.get_time();
+    traj->total_energy = train.get_energy();
+    return (result == RunCode::LessPower) ? -3 : 0;
+}
+//-----------------------------------------------------------------------------
+int run_section(Train& train, double time_cap, double* time, double* energy) {
+    double t0 = train.get_time();
+    double e0 = train.get_energy();
+    int result;
+    while (true) {
+        result = train.main_run();
+        if (result == RunCode::NextStation || result == RunCode::EndOfLine || result == RunCode::LessPower) break;
+        if (train.get_time() - t0 > time_cap) {
+            result = RunCode::InSegment;
+            break;
+        }
+    }
+    *time = train.get_time() - t0;
+    *energy = train.get_energy() - e0;
+    return result;
+}
+//-----------------------------------------------------------------------------
+// The runs are compared from the larger start to the smaller end
+//-----------------------------------------------------------------------------
+Deviation compare_by_distance(const Trajectory& a, const Trajectory& b, double step) {
+    Deviation dev = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    dev.run_time = b.run_time() - a.run_time();
+    dev.energy = b.energy() - a.energy();
+    if (a.points.empty() || b.points.empty() || step <= 0) return dev;
+    double x0 = std::max(a.points.front().distance, b.points.front().distance);
+    double x1 = std::min(a.points.back().distance, b.points.back().distance);
+    double s2 = 0, t2 = 0, e2 = 0;
+    for (size_t i = 0; ; i++) {
+        double x = x0 + step * i;
+        if (x > x1) break;
+        TrajPoint pa, pb;
+        if (!a.at_distance(x, &pa) || !b.at_distance(x, &pb)) continue;
+        double ds = std::fabs(pb.speed - pa.speed) * 3.6;
+        double dt = std::fabs(pb.time - pa.time);
+        double de = std::fabs(pb.energy - pa.energy);
+        dev.max_speed = std::max(dev.max_speed, ds);
+        dev.max_time = std::max(dev.max_time, dt);
+        dev.max_energy = std::max(dev.max_energy, de);
+        s2 += ds * ds;
+        t2 += dt * dt;
+        e2 += de * de;
+        dev.n++;
+    }
+    if (dev.n > 0) {
+        dev.rms_speed = std::sqrt(s2 / dev.n);
+        dev.rms_time = std::sqrt(t2 / dev.n);
+        dev.rms_energy = std::sqrt(e2 / dev.n);
+    }
+    return dev;
+}
+//-----------------------------------------------------------------------------
+// q* = q[n-1] + (q[n-1] - q[n-2]) / (2^p - 1)
+//-----------------------------------------------------------------------------
+double richardson(const std::vector<double>& q, std::vector<double>* err, double* order) {
+    size_t n = q.size();
+    double p = 1.0;
+    double qx = (n > 0) ? q[n - 1] : 0.0;
+    if (n >= 3) {
+        double d1 = q[n - 3] - q[n - 2];
+        double d2 = q[n - 2] - q[n - 1];
+        if (d2 != 0) {
+            double r = d1 / d2;
+            // 0.5 <= p <= 4
+            if (r >= std::sqrt(2.0) && r <= 16) p = std::log2(r);
+        }
+    }
+    if (n >= 2) qx = q[n - 1] + (q[n - 1] - q[n - 2]) / (std::pow(2.0, p) - 1);
+    if (err) {
+        err->resize(n);
+        for (size_t i = 0; i < n; i++) (*err)[i] = std::fabs(q[i] - qx);
+    }
+    if (order) *order = p;
+    return qx;
+}
+//-----------------------------------------------------------------------------
+// name=value,...
+//-----------------------------------------------------------------------------
+bool VerifyTolerance::parse(const char* str) {
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t pos = item.find('=');
+        if (pos == std::string::npos) return false;
+        std::string name = item.substr(0, pos);
+        char* end;
+        double x = strtod(item.c_str() + pos + 1, &end);
+        if (end == item.c_str() + pos + 1 || *end != '\0' || x < 0) return false;
+        if (name == "speed") speed = x;
+        else if (name == "time") time = x;
+        else if (name == "energy") energy = x;
+        else if (name == "step" && x > 0) step = x;
+        else return false;
+    }
+    return true;
+}
+
+bool VerifyTolerance::check(const Deviation& dev, double ref_energy) const {
+    return dev.max_speed <= speed && dev.max_time <= time
+        && dev.max_energy <= energy * std::fabs(ref_energy);
+}
+//-----------------------------------------------------------------------------
+void print_verify(FILE* fp, const std::vector<VerifyStat>& stats) {
+    fprintf(fp, "train\tcode\tresult\tpoints\tref_time\tref_energy\tmax_speed\trms_speed\tmax_time\trms_time\tmax_energy\trms_energy\td_time\td_energy\n");
+    for (const auto& s : stats) {
+        const Deviation& d = s.dev;
+        fprintf(fp, "%d\t%d\t%s\t%zu\t%.3f\t%.1f\t%.3f\t%.3f\t%.3f\t%.3f\t%.1f\t%.1f\t%.3f\t%.1f\n",
+            s.train_id, s.code, (s.code == 0 && s.ok) ? "ok" : "NG", d.n, s.ref_time, s.ref_energy,
+            d.max_speed, d.rms_speed, d.max_time, d.rms_time, d.max_energy, d.rms_energy, d.run_time, d.energy);
+    }
+}
+//-----------------------------------------------------------------------------
+void print_dt_study(FILE* fp, const std::vector<DtStudy>& stats) {
+    fprintf(fp, "train\tdt\trun_time\tenergy\terr_time\terr_arrival\terr_energy\n");
+    for (const auto& s : stats) {
+        if (s.code != 0) continue;
+        for (size_t l = 0; l < s.dts.size(); l++) {
+            fprintf(fp, "%d\t%g\t%.3f\t%.1f\t%.3f\t%.3f\t%.1f\n", s.train_id, s.dts[l], s.run_time[l],
+                s.energy[l], s.err_time[l], s.err_arrival[l], s.err_energy[l]);
+        }
+    }
+}
+//-----------------------------------------------------------------------------
+void set_reference_kernel(TrainBase& train) {
+    train.b_brake_curve = false;
+}
+
+bool set_kernel(TrainBase& train, const std::string& name) {
+    if (name == "brakecurve") train.b_brake_curve = true;
+    else return false;
+    return true;
+}
@@ -0,0 +1,127 @@
+/**
+ * Runs without the result file and comparison of runs.
+ * A Trajectory keeps the state of every tick, so two runs of the same
+ * train with different kernels can be compared by distance.
+ * Kernels are the optional calculation paths of a train (the keys of the
+ * train in the parameter file). The reference kernel has all of them off.
+ */
+#ifndef SIMULATE_H
+#define SIMULATE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include "train.h"
+#include "Progress.h"
+////////////////////////////////////////////////////////////////////////////////
+struct TrajPoint {
+    double time;      // s
+    double distance;  // m
+    double speed;     // m/s
+    double energy;    // kJ (traction only)
+};
+
+class Trajectory {
+public:
+    int code;                       // RunCode::EndOfLine or RunCode::LessPower
+    std::vector<TrajPoint> points;  // every tick from the start (if kept)
+    std::vector<double> arrivals;   // arrival time at each station (s)
+    double total_time;              // s
+    double total_energy;            // kJ
+public:
+    Trajectory() : code(0), total_time(0), total_energy(0) {};
+    double run_time() const { return total_time; };
+    double energy() const { return total_energy; };
+    // Arrival (the first time) at x: time, speed and energy by linear interpolation.
+    // Return false if x is out of the run.
+    bool at_distance(double x, TrajPoint* p) const;
+};
+//-----------------------------------------------------------------------------
+// Run the train from prepare_run to the end of the line
+// keep_points = false: only the arrivals and the totals are kept
+// The ticks are added to slot (if not null) on the way.
+// [Return] 0, -1 (train length), -3 (low power)
+//-----------------------------------------------------------------------------
+int run_trajectory(Train& train, Trajectory* traj, bool keep_points = true, ProgressSlot* slot = nullptr);
+//-----------------------------------------------------------------------------
+// Run the train from its state (after prepare_run or a stop) to the next stop
+// The run is abandoned when the time of the section exceeds time_cap (s).
+// time, energy: of the section (s, kJ)
+// [Return] RunCode::NextStation, RunCode::EndOfLine, RunCode::LessPower
+//          or RunCode::InSegment (abandoned)
+//-----------------------------------------------------------------------------
+int run_section(Train& train, double time_cap, double* time, double* energy);
+//-----------------------------------------------------------------------------
+// Deviation of b from a at every step (m) of the common distance
+//-----------------------------------------------------------------------------
+struct Deviation {
+    size_t n;           // number of points compared
+    double max_speed, rms_speed;    // km/h
+    double max_time, rms_time;      // s
+    double max_energy, rms_energy;  // kJ
+    double run_time;    // difference of the run time (s)
+    double energy;      // difference of the energy (kJ)
+};
+Deviation compare_by_distance(const Trajectory& a, const Trajectory& b, double step);
+//-----------------------------------------------------------------------------
+// Tolerances of the verification (--verify)
+//-----------------------------------------------------------------------------
+struct VerifyTolerance {
+    double speed;   // max deviation of speed (km/h)
+    double time;    // max deviation of time (s)
+    double energy;  // max deviation of energy (ratio to the reference energy)
+    double step;    // interval of the comparison (m)
+    VerifyTolerance() : speed(1.0), time(2.0), energy(0.01), step(10.0) {};
+    // "speed=1,time=2,energy=0.01,step=10". Return false if invalid.
+    bool parse(const char* str);
+    bool check(const Deviation& dev, double ref_energy) const;
+};
+// Result of a train in verify
+struct VerifyStat {
+    int train_id;
+    int code;           // 0: success, -1: train length, -2: no line, -3: low power
+    bool ok;            // within the tolerances
+    double ref_time;    // run time of the reference (s)
+    double ref_energy;  // energy of the reference (kJ)
+    Deviation dev;      // fast kernel - reference
+    VerifyStat(): train_id(0), code(0), ok(false), ref_time(0), ref_energy(0), dev() {};
+};
+// Table of the deviations of verify
+void print_verify(FILE* fp, const std::vector<VerifyStat>& stats);
+//-----------------------------------------------------------------------------
+// Richardson extrapolation of q[i] calculated with the step dt / 2^i.
+// The order is observed from the last three values (1 if it is not clear,
+// e.g. the values are dominated by the events of the steps).
+// err[i] is the estimated error of q[i]. [Return] the extrapolated value
+//-----------------------------------------------------------------------------
+double richardson(const std::vector<double>& q, std::vector<double>* err, double* order);
+constexpr int DT_STUDY_MAX_LEVELS = 12;     // dt down to dt_max / 2^11
+// Result of a train in dt_study (index: dt_max / 2^i)
+struct DtStudy {
+    int train_id;
+    int code;                       // 0: success, -1: train length, -2: no line, -3: low power
+    std::vector<double> dts;        // s
+    std::vector<double> run_time;   // s
+    std::vector<double> energy;     // kJ
+    std::vector<double> err_time;   // estimated error of the run time (s)
+    std::vector<double> err_arrival;// max estimated error of the arrival times (s)
+    std::vector<double> err_energy; // estimated error of the energy (kJ)
+    double order_time, order_energy;// observed orders
+    double best_time, best_energy;  // extrapolated values
+    double recommended;             // largest dt within the tolerances (0: none)
+    DtStudy(): train_id(0), code(0), order_time(0), order_energy(0),
+        best_time(0), best_energy(0), recommended(0) {};
+};
+// Table of the values and the errors of each dt of dt_study
+void print_dt_study(FILE* fp, const std::vector<DtStudy>& stats);
+//-----------------------------------------------------------------------------
+// Kernels
+//-----------------------------------------------------------------------------
+// Names of the kernels
+extern const char* kernel_names[];
+// Turn off all kernels (reference). The model options of the train are kept.
+void set_reference_kernel(TrainBase& train);
+// Turn on the kernel. Return false if name is unknown.
+bool set_kernel(TrainBase& train, const std::string& name);
+
+#endif
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include "StationMatrix.h"
+////////////////////////////////////////////////////////////////////////////////
+static void print_block(FILE* fp, const StationMatrix& m, const char* name,
+                        const std::vector<double>& values, const char* format) {
+    fprintf(fp, "# train %d %s\nstation", m.train_id, name);
+    for (int id : m.ids) fprintf(fp, "\t%d", id);
+    fprintf(fp, "\n");
+    for (size_t a = 0; a < m.size(); a++) {
+        fprintf(fp, "%d", m.ids[a]);
+        for (size_t b = 0; b < m.size(); b++) {
+            if (b <= a) fprintf(fp, "\t-");
+            else if (m.codes[m.at(a, b)] != 0) fprintf(fp, "\tx");
+            else fprintf(fp, format, values[m.at(a, b)]);
+        }
+        fprintf(fp, "\n");
+    }
+}
+//-----------------------------------------------------------------------------
+void print_matrices(FILE* fp, const std::vector<StationMatrix>& mats) {
+    for (const auto& m : mats) {
+        if (m.code != 0 || m.size() < 2) continue;
+        print_block(fp, m, "time", m.times, "\t%.3f");
+        print_block(fp, m, "energy", m.energies, "\t%.1f");
+    }
+}
@@ -0,0 +1,35 @@
+/**
+ * Matrix of the minimum run times between the stations (--matrix): the
+ * non-stop run with full traction from the stop of each Station segment to
+ * the stop of every later one, for every train on its line. The runs from
+ * the same station are the same until the braking for the nearer stop, so
+ * one run to the last station keeps the state at the entrance of each
+ * segment and the run to each station continues from the last state before
+ * its envelope differs.
+ */
+#ifndef STATIONMATRIX_H
+#define STATIONMATRIX_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+struct StationMatrix {
+    int train_id;
+    int code;                       // 0: success, -2: no line
+    std::vector<size_t> segs;       // segments of the stations on the line
+    std::vector<int> ids;           // segment ids of the stations
+    // n x n (row: from, column: to), the pairs from < to
+    std::vector<int> codes;         // 0: success, -1: train length, -3: low power
+    std::vector<double> times;      // s: from the departure to the arrival
+    std::vector<double> energies;   // kJ
+    size_t ticks;                   // time steps run
+    size_t pair_ticks;              // time steps of the pairs run one by one
+    StationMatrix(): train_id(0), code(0), ticks(0), pair_ticks(0) {};
+    size_t size() const { return ids.size(); };
+    size_t at(size_t from, size_t to) const { return from * ids.size() + to; };
+};
+// Blocks of the times and of the energies of each train: a row per station
+// from which and a column per station to which ("-": none, "x": failed)
+void print_matrices(FILE* fp, const std::vector<StationMatrix>& mats);
+
+#endif
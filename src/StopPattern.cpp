@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <algorithm>
+#include "StopPattern.h"
+#include "common.h"
+////////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+//-----------------------------------------------------------------------------
+StopPatterns::StopPatterns() {
+    train_id = 0;
+    max_time = 0;
+}
+//-----------------------------------------------------------------------------
+// A pattern of the file is the stations of the set that stop
+//-----------------------------------------------------------------------------
+bool StopPatterns::read_json(const json& jdata) {
+    station_ids.clear();
+    masks.clear();
+    try {
+        if (jdata.contains("train")) train_id = jdata.at("train");
+        station_ids = jdata.at("stations").get<std::vector<int>>();
+        if (jdata.contains("max_time")) max_time = jdata.at("max_time");
+        if (station_ids.empty() || station_ids.size() > 64) {
+            fprintf(stderr, "Invalid stations of patterns (1 to 64)\n");
+            return false;
+        }
+        for (size_t i = 1; i < station_ids.size(); i++) {
+            if (std::find(station_ids.begin(), station_ids.begin() + i, station_ids[i]) != station_ids.begin() + i) {
+                fprintf(stderr, "Station %d appears twice in the stations of patterns\n", station_ids[i]);
+                return false;
+            }
+        }
+        if (jdata.contains("patterns")) {
+            for (const auto& jp : jdata.at("patterns")) {
+                uint64_t m = 0;
+                for (int id : jp.get<std::vector<int>>()) {
+                    auto it = std::find(station_ids.begin(), station_ids.end(), id);
+                    if (it == station_ids.end()) {
+                        fprintf(stderr, "Station %d of a pattern is not in the stations\n", id);
+                        return false;
+                    }
+                    m |= (uint64_t)1 << (it - station_ids.begin());
+                }
+                masks.push_back(m);
+            }
+        }
+        else if (station_ids.size() > PATTERN_MAX_ENUM) {
+            fprintf(stderr, "Too many stations for all the patterns (max %zu)\n", PATTERN_MAX_ENUM);
+            return false;
+        }
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in patterns: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+// The start is the first segment and the end is the last segment (the last
+// station or the end of the line), as in Train::prepare_run and main_run
+//-----------------------------------------------------------------------------
+bool StopPatterns::set_line(const RailLine& line) {
+    stops.clear();
+    bits.clear();
+    dwells.clear();
+    size_t n = line.nSegment();
+    if (n < 2) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (i != 0 && i != n - 1 && line.segs[i].type != SegmentType::Station) continue;
+        stops.push_back(i);
+        bits.push_back(-1);
+        dwells.push_back((line.segs[i].tm_stop > 0) ? line.segs[i].tm_stop : Control::station_time);
+    }
+    for (size_t b = 0; b < station_ids.size(); b++) {
+        size_t k = 1;
+        while (k + 1 < stops.size() && line.segs[stops[k]].id != station_ids[b]) k++;
+        if (k + 1 >= stops.size()) {
+            fprintf(stderr, "Segment %d is not a station between the start and the end\n", station_ids[b]);
+            return false;
+        }
+        bits[k] = (int)b;
+    }
+    return true;
+}
+
+size_t StopPatterns::size() const {
+    if (!masks.empty()) return masks.size();
+    return (size_t)1 << station_ids.size();
+}
+
+uint64_t StopPatterns::mask(size_t k) const {
+    return masks.empty() ? (uint64_t)k : masks[k];
+}
+
+void StopPatterns::stops_of(uint64_t m, std::vector<size_t>* list) const {
+    list->clear();
+    for (size_t k = 0; k < stops.size(); k++) {
+        if (bits[k] < 0 || ((m >> bits[k]) & 1)) list->push_back(k);
+    }
+}
+std::shared_ptr<RailLine> StopPatterns::section_line(const RailLine& line, size_t a, size_t b) const {
+    return sub_line(line, stops[a], stops[b]);
+}
+//-----------------------------------------------------------------------------
+// The most stops within max_time, the least time of them
+//-----------------------------------------------------------------------------
+size_t StopPatterns::pick(const std::vector<PatternStat>& stats) const {
+    size_t k = stats.size();
+    if (max_time <= 0) return k;
+    for (size_t i = 0; i < stats.size(); i++) {
+        const PatternStat& s = stats[i];
+        if (s.code != 0 || s.run_time > max_time) continue;
+        if (k == stats.size() || s.stops > stats[k].stops || (s.stops == stats[k].stops && s.run_time < stats[k].run_time)) k = i;
+    }
+    return k;
+}
+//-----------------------------------------------------------------------------
+// The train starts at the middle of the first segment (prepare_run), so the
+// distances begin at the segment s0.
+//-----------------------------------------------------------------------------
+std::shared_ptr<RailLine> sub_line(const RailLine& line, size_t s0, size_t s1) {
+    auto sub = std::make_shared<RailLine>();
+    sub->setID(line.getID());
+    double x0 = line.segs[s0].distance;
+    sub->segs.assign(line.segs.begin() + s0, line.segs.begin() + s1 + 1);
+    for (size_t i = 0; i < sub->segs.size(); i++) {
+        Segment& seg = sub->segs[i];
+        seg.distance -= x0;
+        if (i > 0 && i + 1 < sub->segs.size() && seg.type == SegmentType::Station) seg.type = SegmentType::Normal;
+    }
+    sub->touch();
+    return sub;
+}
+//-----------------------------------------------------------------------------
+void print_patterns(FILE* fp, const StopPatterns& patterns, const std::vector<PatternStat>& stats) {
+    fprintf(fp, "pattern\tcode\tstops\tstations\trun_time\tenergy\tbest\n");
+    for (size_t k = 0; k < stats.size(); k++) {
+        const PatternStat& s = stats[k];
+        fprintf(fp, "%zu\t%d\t%zu\t", k, s.code, s.stops);
+        bool first = true;
+        for (size_t b = 0; b < patterns.station_ids.size(); b++) {
+            if (((s.mask >> b) & 1) == 0) continue;
+            fprintf(fp, first ? "%d" : ",%d", patterns.station_ids[b]);
+            first = false;
+        }
+        if (first) fprintf(fp, "-");
+        if (s.code != 0) fprintf(fp, "\t-\t-\t0\n");
+        else fprintf(fp, "\t%.3f\t%.1f\t%d\n", s.run_time, s.energy, s.best ? 1 : 0);
+    }
+}
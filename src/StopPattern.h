@@ -0,0 +1,76 @@
+/**
+ * Stopping patterns of a train (--patterns), declared by the "patterns"
+ * object of the parameter file. The stations of the set may be passed; the
+ * other stations, the start and the end of the line are always stops. A
+ * pattern is run as sections from a stop to the next stop. Every section
+ * starts from a stop (entry speed 0), so it is keyed by its two stops and
+ * simulated only once for all the patterns on a line of its own: the
+ * segments between the stops with the passed stations as normal segments.
+ */
+#ifndef STOPPATTERN_H
+#define STOPPATTERN_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "RailLine.h"
+////////////////////////////////////////////////////////////////////////////////
+constexpr size_t PATTERN_MAX_ENUM = 20;     // stations of the set for all the patterns
+//-----------------------------------------------------------------------------
+// Run of a section from a stop to the next stop (indices of StopPatterns::stops)
+struct PatternSection {
+    size_t from, to;
+    int code;           // 0: success, -1: train length, -3: low power
+    double time;        // s: from the departure to the arrival
+    double energy;      // kJ
+    PatternSection(): from(0), to(0), code(0), time(0), energy(0) {};
+};
+// Result of a pattern
+struct PatternStat {
+    uint64_t mask;      // bit i: the station i of the set stops
+    int code;           // 0: success, -1: train length, -3: low power
+    size_t stops;       // stops between the start and the end
+    double run_time;    // s (with the stops)
+    double energy;      // kJ
+    bool best;          // the fastest of its number of stops
+    PatternStat(): mask(0), code(0), stops(0), run_time(0), energy(0), best(false) {};
+};
+//-----------------------------------------------------------------------------
+class StopPatterns {
+public:
+    int train_id;                   // 0: the first train
+    std::vector<int> station_ids;   // segment ids of the stations that may be passed
+    std::vector<uint64_t> masks;    // patterns of the file (empty: all the patterns)
+    double max_time;                // s: the pattern of the most stops within this (0: none)
+    // Stops of the line (set_line)
+    std::vector<size_t> stops;      // segments: the start, the stations and the end
+    std::vector<int> bits;          // bit of each stop in a mask (-1: always a stop)
+    std::vector<double> dwells;     // s: stopping time at each stop
+public:
+    StopPatterns();
+    // "train", "stations": [segment ids], "patterns": [[segment ids], ...], "max_time".
+    // Return false if invalid.
+    bool read_json(const nlohmann::json& jdata);
+    // Stops of the line. Return false if a station of the set is not a
+    // station between the start and the end of the line.
+    bool set_line(const RailLine& line);
+    // Number of patterns
+    size_t size() const;
+    uint64_t mask(size_t k) const;
+    // Stops of a pattern (indices of stops)
+    void stops_of(uint64_t mask, std::vector<size_t>* list) const;
+    // Line of the section from the stop a to the stop b
+    std::shared_ptr<RailLine> section_line(const RailLine& line, size_t a, size_t b) const;
+    // Pattern of the most stops within max_time (the results of the
+    // patterns). [Return] stats.size() if none or no max_time
+    size_t pick(const std::vector<PatternStat>& stats) const;
+};
+// Line of the segments s0 to s1 of the line, the stations between them as
+// normal segments (a non-stop run from the stop of s0 to the stop of s1)
+std::shared_ptr<RailLine> sub_line(const RailLine& line, size_t s0, size_t s1);
+// Table of the patterns: the stops and the segment ids of the stations of the set
+void print_patterns(FILE* fp, const StopPatterns& patterns, const std::vector<PatternStat>& stats);
+
+#endif
@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "Surface.h"
+#include "Sweep.h"
+////////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+//-----------------------------------------------------------------------------
+// The departure is the last step at speed 0 before moving
+//-----------------------------------------------------------------------------
+int run_stops(Train& train, SurfaceNode* node) {
+    node->arrival.assign(1, 0.0);
+    node->departure.clear();
+    node->energy.assign(1, 0.0);
+    node->state = -1;
+    if (train.prepare_run() != 0) return (-1);
+    bool stopped = true;
+    double t_dep = train.get_time();
+    while (true) {
+        int result = train.main_run();
+        if (result == RunCode::LessPower) return (-3);
+        if (result == RunCode::NextStation || result == RunCode::EndOfLine) {
+            if (stopped) node->departure.push_back(t_dep);
+            node->arrival.push_back(train.get_time());
+            node->energy.push_back(train.get_energy());
+            if (result == RunCode::EndOfLine) {
+                node->departure.push_back(train.get_time());
+                break;
+            }
+            stopped = true;
+            t_dep = train.get_time();
+        }
+        else if (train.get_speed() <= 0) t_dep = train.get_time();
+        else if (stopped) {
+            node->departure.push_back(t_dep);
+            stopped = false;
+        }
+    }
+    node->state = 1;
+    return 0;
+}
+//-----------------------------------------------------------------------------
+Surface::Surface() {
+    train_id = 0;
+    tol_time = 1.0;
+    tol_energy = 0.01;
+    max_nodes = 100000;
+}
+//-----------------------------------------------------------------------------
+// The ranges are read by Sweep; the values of each key are sorted
+//-----------------------------------------------------------------------------
+bool Surface::read_json(const json& jdata) {
+    keys.clear();
+    axes.clear();
+    nodes.clear();
+    Sweep sweep;
+    try {
+        if (jdata.contains("train")) train_id = jdata.at("train");
+        if (!sweep.read_json(json{{"ranges", jdata.at("ranges")}})) return false;
+        if (jdata.contains("tol")) {
+            const json& jt = jdata.at("tol");
+            if (jt.contains("time")) tol_time = jt.at("time");
+            if (jt.contains("energy")) tol_energy = jt.at("energy");
+        }
+        if (jdata.contains("max_nodes")) max_nodes = jdata.at("max_nodes");
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in surface: %s\n", e.what());
+        return false;
+    }
+    for (const auto& r : sweep.ranges) {
+        std::vector<double> ax = r.values;
+        std::sort(ax.begin(), ax.end());
+        ax.erase(std::unique(ax.begin(), ax.end()), ax.end());
+        keys.push_back(r.key);
+        axes.push_back(ax);
+    }
+    if (keys.empty() || sweep.size() > max_nodes) {
+        fprintf(stderr, "Invalid surface (no key or more than %zu nodes)\n", max_nodes);
+        return false;
+    }
+    size_t n = 1;
+    for (const auto& ax : axes) n *= ax.size();
+    nodes.assign(n, SurfaceNode());
+    return true;
+}
+//-----------------------------------------------------------------------------
+// FNV-1a of the doubles (the traction is sampled every km/h up to the max
+// speed, so it covers the table and the motor)
+//-----------------------------------------------------------------------------
+std::string surface_fingerprint(const Train& train, const std::vector<std::string>& keys) {
+    static const char* train_keys[] = {"maxspeed", "length", "WM", "WT", "weight", "nCars", "acceleration",
+        "deceleration", "coasting", "jerk", "nTractions", "torquemaxspeed", "powermaxspeed", "inertia",
+        "spmargin", "start_resist", "curve_resist_A", "tractionfactor", "res0", "res1", "res2", "res3", "res4",
+        "res5", nullptr};
+    uint64_t h = 14695981039346656037ULL;
+    auto add = [&](double x) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(&x);
+        for (size_t i = 0; i < sizeof(x); i++) h = (h ^ p[i]) * 1099511628211ULL;
+    };
+    std::shared_ptr<RailLine> line = train.get_line();
+    if (line) {
+        for (const auto& s : line->segs) {
+            add(s.id);
+            add(s.type);
+            add(s.distance);
+            add(s.length);
+            add(s.speed);
+            add(s.gradient);
+            add(s.radius);
+            add(s.tm_stop);
+        }
+    }
+    double x;
+    for (int i = 0; train_keys[i]; i++) add(train.get_value(train_keys[i], &x) ? x : 0.0);
+    add(train.get_dt());
+    add(train.b_brake_curve);
+    add(train.b_avg_resist);
+    for (double v = 0; v <= train.max_speed; v += 1) add(train.get_force(v));
+    for (const auto& key : keys) {
+        for (char c : key) add(c);
+        add(0);
+    }
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+    return buf;
+}
+//-----------------------------------------------------------------------------
+bool Surface::load(const char* fname) {
+    std::ifstream fi(fname);
+    if (!fi) return false;
+    try {
+        json j = json::parse(fi);
+        train_id = j.at("train");
+        keys = j.at("keys").get<std::vector<std::string>>();
+        axes = j.at("axes").get<std::vector<std::vector<double>>>();
+        tol_time = j.at("tol").at("time");
+        tol_energy = j.at("tol").at("energy");
+        max_nodes = j.at("max_nodes");
+        fingerprint = j.value("fingerprint", "");
+        nodes.clear();
+        for (const auto& jn : j.at("nodes")) {
+            SurfaceNode node;
+            node.state = jn.at("state");
+            node.arrival = jn.at("arrival").get<std::vector<double>>();
+            node.departure = jn.at("departure").get<std::vector<double>>();
+            node.energy = jn.at("energy").get<std::vector<double>>();
+            nodes.push_back(std::move(node));
+        }
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in surface file %s: %s\n", fname, e.what());
+        return false;
+    }
+    size_t n = 1;
+    for (const auto& ax : axes) n *= ax.size();
+    if (keys.size() != axes.size() || n != nodes.size()) {
+        fprintf(stderr, "Invalid surface file %s\n", fname);
+        return false;
+    }
+    return true;
+}
+
+bool Surface::save(const char* fname) const {
+    json j;
+    j["train"] = train_id;
+    j["keys"] = keys;
+    j["axes"] = axes;
+    j["tol"] = {{"time", tol_time}, {"energy", tol_energy}};
+    j["max_nodes"] = max_nodes;
+    j["fingerprint"] = fingerprint;
+    json jn = json::array();
+    for (const auto& node : nodes) {
+        jn.push_back({{"state", node.state}, {"arrival", node.arrival},
+            {"departure", node.departure}, {"energy", node.energy}});
+    }
+    j["nodes"] = jn;
+    std::ofstream fo(fname);
+    if (!fo) {
+        fprintf(stderr, "Cannot create file %s\n", fname);
+        return false;
+    }
+    fo << j.dump() << "\n";
+    return true;
+}
+//-----------------------------------------------------------------------------
+size_t Surface::index(const std::vector<size_t>& idx) const {
+    size_t k = 0;
+    for (size_t d = 0; d < axes.size(); d++) k = k * axes[d].size() + idx[d];
+    return k;
+}
+
+void Surface::point(size_t k, std::vector<double>* values) const {
+    values->resize(axes.size());
+    for (size_t d = axes.size(); d-- > 0; ) {
+        size_t n = axes[d].size();
+        (*values)[d] = axes[d][k % n];
+        k /= n;
+    }
+}
+
+bool Surface::node_value(size_t k, size_t a, size_t b, double* time, double* energy) const {
+    const SurfaceNode& node = nodes[k];
+    if (node.state != 1 || b >= node.arrival.size()) return false;
+    *time = node.arrival[b] - node.departure[a];
+    *energy = node.energy[b] - node.energy[a];
+    return true;
+}
+//-----------------------------------------------------------------------------
+// The error of the linear interpolation along a key is |f[x0,x1,x2]| (x - xi)
+// (xi+1 - x) with the divided difference of three values around the cell
+// at the nearest corner; a key of two values cannot be estimated.
+//-----------------------------------------------------------------------------
+bool Surface::interpolate(const std::vector<double>& values, size_t a, size_t b, SurfaceValue* r) const {
+    size_t D = axes.size();
+    if (values.size() != D || a >= b) return false;
+    std::vector<size_t> lo(D), idx(D), near(D);
+    std::vector<double> w(D);   // weight of the upper value
+    for (size_t d = 0; d < D; d++) {
+        const std::vector<double>& ax = axes[d];
+        double x = values[d];
+        if (x < ax.front() || x > ax.back()) return false;
+        if (ax.size() == 1) {
+            lo[d] = 0;
+            w[d] = 0;
+        } else {
+            size_t i = std::upper_bound(ax.begin(), ax.end(), x) - ax.begin();
+            i = std::min(std::max(i, (size_t)1), ax.size() - 1);
+            lo[d] = i - 1;
+            w[d] = (x - ax[i - 1]) / (ax[i] - ax[i - 1]);
+        }
+        near[d] = lo[d] + ((w[d] > 0.5) ? 1 : 0);
+    }
+    *r = SurfaceValue();
+    for (size_t c = 0; c < ((size_t)1 << D); c++) {
+        double weight = 1.0;
+        for (size_t d = 0; d < D; d++) {
+            size_t bit = (c >> d) & 1;
+            weight *= bit ? w[d] : 1 - w[d];
+            idx[d] = lo[d] + ((axes[d].size() > 1) ? bit : 0);
+        }
+        if (weight == 0) continue;
+        double t, e;
+        if (!node_value(index(idx), a, b, &t, &e)) return false;
+        r->time += weight * t;
+        r->energy += weight * e;
+    }
+    double worst = 0;
+    for (size_t d = 0; d < D; d++) {
+        const std::vector<double>& ax = axes[d];
+        if (ax.size() == 1) continue;
+        double et = HUGE_VAL, ee = HUGE_VAL;
+        if (ax.size() >= 3) {
+            size_t j0 = (lo[d] >= 1) ? lo[d] - 1 : lo[d];
+            double f[3][2];
+            bool ok = true;
+            idx = near;
+            for (int j = 0; j < 3 && ok; j++) {
+                idx[d] = j0 + j;
+                ok = node_value(index(idx), a, b, &f[j][0], &f[j][1]);
+            }
+            if (ok) {
+                double x0 = ax[j0], x1 = ax[j0 + 1], x2 = ax[j0 + 2];
+                double span = (values[d] - ax[lo[d]]) * (ax[lo[d] + 1] - values[d]);
+                double dt = ((f[2][0] - f[1][0]) / (x2 - x1) - (f[1][0] - f[0][0]) / (x1 - x0)) / (x2 - x0);
+                double de = ((f[2][1] - f[1][1]) / (x2 - x1) - (f[1][1] - f[0][1]) / (x1 - x0)) / (x2 - x0);
+                et = std::fabs(dt) * span;
+                ee = std::fabs(de) * span;
+            }
+        }
+        r->err_time += et;
+        r->err_energy += ee;
+        double score = et / tol_time + ee / (tol_energy * std::max(std::fabs(r->energy), 1.0));
+        if (score > worst) {
+            worst = score;
+            r->axis = (int)d;
+        }
+    }
+    return true;
+}
+
+bool Surface::trusted(const SurfaceValue& r) const {
+    return r.err_time <= tol_time && r.err_energy <= tol_energy * std::max(std::fabs(r.energy), 1.0);
+}
+//-----------------------------------------------------------------------------
+// The nodes of the other values keep their runs
+//-----------------------------------------------------------------------------
+bool Surface::insert(size_t d, double x) {
+    std::vector<double>& ax = axes[d];
+    auto it = std::lower_bound(ax.begin(), ax.end(), x);
+    if (it != ax.end() && *it == x) return false;
+    if (nodes.size() / ax.size() * (ax.size() + 1) > max_nodes) return false;
+    size_t pos = it - ax.begin();
+    std::vector<std::vector<double>> old_axes = axes;
+    ax.insert(it, x);
+    size_t n = nodes.size() / old_axes[d].size() * ax.size();
+    std::vector<SurfaceNode> old_nodes;
+    old_nodes.swap(nodes);
+    nodes.resize(n);
+    std::vector<size_t> idx(axes.size());
+    for (size_t k = 0; k < n; k++) {
+        size_t q = k;
+        for (size_t e = axes.size(); e-- > 0; ) {
+            idx[e] = q % axes[e].size();
+            q /= axes[e].size();
+        }
+        if (idx[d] == pos) continue;
+        if (idx[d] > pos) idx[d]--;
+        size_t old = 0;
+        for (size_t e = 0; e < axes.size(); e++) old = old * old_axes[e].size() + idx[e];
+        nodes[k] = std::move(old_nodes[old]);
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+bool read_surface_queries(const char* fname, const std::vector<std::string>& keys, std::vector<SurfaceQuery>* queries) {
+    queries->clear();
+    std::ifstream fi(fname);
+    std::string str, name;
+    if (!fi || !std::getline(fi, str)) {
+        fprintf(stderr, "Cannot read file %s\n", fname);
+        return false;
+    }
+    // column of each key, from and to
+    std::vector<std::string> header;
+    std::istringstream iss(str);
+    while (iss >> name) header.push_back(name);
+    std::vector<size_t> cols;
+    std::vector<std::string> names = keys;
+    names.push_back("from");
+    names.push_back("to");
+    for (const auto& key : names) {
+        auto it = std::find(header.begin(), header.end(), key);
+        if (it == header.end()) {
+            fprintf(stderr, "No column of %s in %s\n", key.c_str(), fname);
+            return false;
+        }
+        cols.push_back(it - header.begin());
+    }
+    while (std::getline(fi, str)) {
+        if (str.empty() || str[0] == '#') continue;
+        std::istringstream is(str);
+        std::vector<double> row;
+        double x;
+        while (is >> x) row.push_back(x);
+        if (row.size() != header.size()) {
+            fprintf(stderr, "Invalid line of %s: %s\n", fname, str.c_str());
+            return false;
+        }
+        SurfaceQuery q;
+        for (size_t i = 0; i < keys.size(); i++) q.values.push_back(row[cols[i]]);
+        q.from = (size_t)row[cols[keys.size()]];
+        q.to = (size_t)row[cols[keys.size() + 1]];
+        queries->push_back(q);
+    }
+    return true;
+}
+
+void print_surface_answers(FILE* fp, const Surface& surface, const std::vector<SurfaceQuery>& queries,
+                           const std::vector<SurfaceAnswer>& answers) {
+    static const char* sources[] = {"failed", "surface", "sim"};
+    for (const auto& key : surface.keys) fprintf(fp, "%s\t", key.c_str());
+    fprintf(fp, "from\tto\ttime\terr_time\tenergy\terr_energy\tsource\tus\n");
+    for (size_t i = 0; i < queries.size(); i++) {
+        const SurfaceQuery& q = queries[i];
+        const SurfaceAnswer& a = answers[i];
+        for (double x : q.values) fprintf(fp, "%g\t", x);
+        fprintf(fp, "%zu\t%zu\t%.3f\t%.3f\t%.1f\t%.1f\t%s\t%.1f\n", q.from, q.to, a.value.time, a.value.err_time,
+            a.value.energy, a.value.err_energy, sources[a.source + 1], a.usec);
+    }
+}
+
+void print_surface_nodes(FILE* fp, const Surface& surface) {
+    for (const auto& key : surface.keys) fprintf(fp, "%s\t", key.c_str());
+    fprintf(fp, "state\tstops\trun_time\tenergy\n");
+    std::vector<double> values;
+    for (size_t k = 0; k < surface.size(); k++) {
+        const SurfaceNode& node = surface.nodes[k];
+        surface.point(k, &values);
+        for (double x : values) fprintf(fp, "%g\t", x);
+        if (node.state == 1) {
+            fprintf(fp, "%d\t%zu\t%.3f\t%.1f\n", node.state, node.arrival.size(), node.arrival.back(), node.energy.back());
+        } else fprintf(fp, "%d\t0\t-\t-\n", node.state);
+    }
+}
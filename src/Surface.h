@@ -0,0 +1,100 @@
+/**
+ * Response surfaces of the run times and the energy between stops
+ * (--surface), declared by the "surface" object of the parameter file.
+ * The runs of a train are sampled on a grid of keys (the ranges of a
+ * sweep). A node keeps the arrival and departure times and the energy at
+ * every stop, so the time and the energy between any two stops are
+ * interpolated (multilinear) from the nodes of the cell of a query. The
+ * error is estimated from the second differences along each key; a query
+ * out of the grid or over the tolerances is simulated and the grid is
+ * refined there.
+ */
+#ifndef SURFACE_H
+#define SURFACE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "train.h"
+////////////////////////////////////////////////////////////////////////////////
+// Run of a point of the grid
+struct SurfaceNode {
+    int state;                      // 0: not run, 1: run, -1: failed (low power)
+    std::vector<double> arrival;    // s: arrival at each stop (0 for the start)
+    std::vector<double> departure;  // s: departure from each stop (arrival at the end)
+    std::vector<double> energy;     // kJ at the arrival at each stop
+    SurfaceNode(): state(0) {};
+};
+// Time and energy from a stop to another stop
+struct SurfaceValue {
+    double time;        // s: departure from the first stop to the arrival at the second
+    double energy;      // kJ
+    double err_time;    // s: estimated error of the interpolation
+    double err_energy;  // kJ
+    int axis;           // key of the largest error (-1: none)
+    SurfaceValue(): time(0), energy(0), err_time(0), err_energy(0), axis(-1) {};
+};
+// Query of a file: the values of the keys and the stops
+struct SurfaceQuery {
+    std::vector<double> values;
+    size_t from, to;    // stops (0: start of the run)
+};
+struct SurfaceAnswer {
+    SurfaceValue value;
+    int source;         // 0: surface, 1: simulation, -1: failed
+    double usec;        // time of the answer (microseconds)
+    SurfaceAnswer(): source(-1), usec(0) {};
+};
+// Run the train from prepare_run to the end and record the stops.
+// [Return] 0, -1 (train length), -3 (low power)
+int run_stops(Train& train, SurfaceNode* node);
+// Hash (hex) of the segments of the line, the values, dt, options and
+// traction of the train and the keys: the runs of a surface file are
+// reused only with the same fingerprint
+std::string surface_fingerprint(const Train& train, const std::vector<std::string>& keys);
+//-----------------------------------------------------------------------------
+class Surface {
+public:
+    int train_id;                   // 0: the first train
+    std::vector<std::string> keys;  // keys of the train (Sweep.h)
+    std::vector<std::vector<double>> axes;  // sorted values of each key
+    std::vector<SurfaceNode> nodes; // the last key changes fastest
+    double tol_time;                // s: trusted if the estimated error is within this
+    double tol_energy;              // ratio to the energy
+    size_t max_nodes;               // no refinement over this
+    std::string fingerprint;        // surface_fingerprint of the runs (empty: not run)
+public:
+    Surface();
+    // "train", "ranges" (as in sweep), "tol": {"time", "energy"}, "max_nodes".
+    // Return false if a key or a range is invalid.
+    bool read_json(const nlohmann::json& jdata);
+    // A file without a fingerprint loads with an empty one (not reused)
+    bool load(const char* fname);
+    bool save(const char* fname) const;
+    size_t size() const { return nodes.size(); };
+    // Values of the keys of a node
+    void point(size_t k, std::vector<double>* values) const;
+    // Interpolation from the stop a to the stop b (a < b).
+    // [Return] false if out of the grid, a node of the cell has failed or
+    // the stops are not in the runs
+    bool interpolate(const std::vector<double>& values, size_t a, size_t b, SurfaceValue* r) const;
+    bool trusted(const SurfaceValue& r) const;
+    // Add the value x to the key d; the new nodes are not run.
+    // [Return] false if x is already there or the nodes would exceed max_nodes
+    bool insert(size_t d, double x);
+private:
+    size_t index(const std::vector<size_t>& idx) const;
+    // Time and energy from a to b at a node (false if not run)
+    bool node_value(size_t k, size_t a, size_t b, double* time, double* energy) const;
+};
+
+// Queries with a header of the keys, "from" and "to" (spaces or tabs).
+// Return false if a key is missing or a line is invalid.
+bool read_surface_queries(const char* fname, const std::vector<std::string>& keys, std::vector<SurfaceQuery>* queries);
+void print_surface_answers(FILE* fp, const Surface& surface, const std::vector<SurfaceQuery>& queries,
+                           const std::vector<SurfaceAnswer>& answers);
+// Table of the nodes: values, state, run time and energy to the end
+void print_surface_nodes(FILE* fp, const Surface& surface);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include "Sweep.h"
+////////////////////////////////////////////////////////////////////////////////
+using namespace nlohmann;
+////////////////////////////////////////////////////////////////////////////////
+static const size_t max_points = 100000000;
+//-----------------------------------------------------------------------------
+// The key is checked with a default train and motor
+//-----------------------------------------------------------------------------
+bool valid_param_key(const std::string& key) {
+    if (key == "dt") return true;
+    if (key.compare(0, 6, "motor.") == 0) {
+        Motor motor;
+        return motor.set_value(key.substr(6), 1.0);
+    }
+    TrainBase train;
+    return train.set_value(key, 1.0);
+}
+//-----------------------------------------------------------------------------
+// {"from": a, "to": b, "step": s} or {"from": a, "to": b, "n": n}
+//-----------------------------------------------------------------------------
+static bool read_range(const json& j, std::vector<double>& values) {
+    if (j.is_array()) {
+        for (const auto& x : j) values.push_back(x.get<double>());
+        return !values.empty();
+    }
+    if (!j.is_object() || !j.contains("from") || !j.contains("to")) return false;
+    double from = j.at("from");
+    double to = j.at("to");
+    if (j.contains("n")) {
+        int n = j.at("n");
+        if (n < 1) return false;
+        for (int i = 0; i < n; i++) values.push_back((n == 1) ? from : from + (to - from) * i / (n - 1));
+    }
+    else if (j.contains("step")) {
+        double step = j.at("step");
+        if (step <= 0 || to < from || (to - from) / step >= max_points) return false;
+        for (size_t i = 0; from + step * i <= to + step * 1e-9; i++) values.push_back(from + step * i);
+    }
+    else return false;
+    return true;
+}
+//-----------------------------------------------------------------------------
+bool Sweep::read_json(const json& jdata) {
+    ranges.clear();
+    train_ids.clear();
+    try {
+        if (jdata.contains("trains")) train_ids = jdata.at("trains").get<std::vector<int>>();
+        if (jdata.contains("max_time")) max_time = jdata.at("max_time");
+        if (jdata.contains("margin")) margin = jdata.at("margin");
+        const json& jr = jdata.at("ranges");
+        for (auto it = jr.begin(); it != jr.end(); ++it) {
+            SweepRange r;
+            r.key = it.key();
+            if (!valid_param_key(r.key)) {
+                fprintf(stderr, "Unknown key of sweep: %s\n", r.key.c_str());
+                return false;
+            }
+            if (!read_range(it.value(), r.values)
+                || (r.key == "dt" && *std::min_element(r.values.begin(), r.values.end()) <= 0)) {
+                fprintf(stderr, "Invalid range of sweep: %s\n", r.key.c_str());
+                return false;
+            }
+            ranges.push_back(r);
+        }
+    } catch(nlohmann::json::exception& e) {
+        fprintf(stderr, "Error in sweep: %s\n", e.what());
+        return false;
+    }
+    double n = 1;
+    for (const auto& r : ranges) n *= (double)r.values.size();
+    if (n > max_points) {
+        fprintf(stderr, "Too many points of sweep (%g)\n", n);
+        return false;
+    }
+    return true;
+}
+//-----------------------------------------------------------------------------
+size_t Sweep::size() const {
+    if (ranges.empty()) return 0;
+    size_t n = 1;
+    for (const auto& r : ranges) n *= r.values.size();
+    return n;
+}
+
+bool Sweep::has_train(int id) const {
+    return train_ids.empty() || std::find(train_ids.begin(), train_ids.end(), id) != train_ids.end();
+}
+
+void Sweep::point(size_t k, std::vector<double>* values) const {
+    values->resize(ranges.size());
+    for (size_t i = ranges.size(); i-- > 0; ) {
+        size_t n = ranges[i].values.size();
+        (*values)[i] = ranges[i].values[k % n];
+        k /= n;
+    }
+}
+//-----------------------------------------------------------------------------
+// The motor is initialized with the force of the train after all values
+//-----------------------------------------------------------------------------
+void apply_params(Train& train, const std::vector<std::string>& keys, const std::vector<double>& values) {
+    std::shared_ptr<Motor> motor;
+    if (train.get_motor()) motor = std::make_shared<Motor>(*train.get_motor());
+    for (size_t i = 0; i < keys.size(); i++) {
+        const std::string& key = keys[i];
+        if (key == "dt") train.set_dt(values[i]);
+        else if (key.compare(0, 6, "motor.") == 0) {
+            if (motor) motor->set_value(key.substr(6), values[i]);
+        }
+        else train.set_value(key, values[i]);
+    }
+    if (motor) train.set_motor(motor);
+}
+
+void Sweep::apply(Train& train, const std::vector<double>& values) const {
+    std::vector<std::string> keys;
+    for (const auto& r : ranges) keys.push_back(r.key);
+    apply_params(train, keys, values);
+}
+//-----------------------------------------------------------------------------
+void print_sweep(FILE* fp, const Sweep& sweep, const std::vector<SweepStat>& stats) {
+    fprintf(fp, "point\ttrain");
+    for (const auto& r : sweep.ranges) fprintf(fp, "\t%s", r.key.c_str());
+    fprintf(fp, "\tcode\trun_time\tenergy\tstations\n");
+    std::vector<double> values;
+    for (const auto& s : stats) {
+        sweep.point(s.point, &values);
+        fprintf(fp, "%zu\t%d", s.point, s.train_id);
+        for (double x : values) fprintf(fp, "\t%g", x);
+        fprintf(fp, "\t%d\t%.3f\t%.1f\t%zu\n", s.code, s.run_time, s.energy, s.stations);
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * Parameter sweep declared by the "sweep" object of the parameter file.
+ * Each range has a key of a train ("WT", "acceleration", "spmargin", ...),
+ * of its motor ("motor.gear", ...) or "dt". The points of the sweep are the
+ * Cartesian product of the ranges; the last range changes fastest.
+ */
+#ifndef SWEEP_H
+#define SWEEP_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "nlohmann/json.hpp"
+#include "train.h"
+////////////////////////////////////////////////////////////////////////////////
+// Keys of a train, "motor.<key>" of its motor and "dt"
+bool valid_param_key(const std::string& key);
+// Set the values of the keys to the train. The train gets its own copy of
+// the motor (initialized again for the new values).
+void apply_params(Train& train, const std::vector<std::string>& keys, const std::vector<double>& values);
+////////////////////////////////////////////////////////////////////////////////
+struct SweepRange {
+    std::string key;
+    std::vector<double> values;
+};
+
+class Sweep {
+public:
+    std::vector<SweepRange> ranges;  // in the order of the keys
+    std::vector<int> train_ids;      // trains of the sweep (empty: all trains)
+    double max_time;                 // s: points over this by the preview are not run (0: all run)
+    double margin;                   // ratio added to max_time for the error of the preview
+public:
+    Sweep(): max_time(0), margin(0.05) {};
+    // "ranges": {"key": [values] or {"from", "to", "step" or "n"}, ...}, "trains": [ids],
+    // "max_time", "margin"
+    // Return false if a key or a range is invalid
+    bool read_json(const nlohmann::json& jdata);
+    // Number of points (0: no range)
+    size_t size() const;
+    bool has_train(int id) const;
+    // Values of the point k (one for each range)
+    void point(size_t k, std::vector<double>* values) const;
+    // Set the values of a point to the train (apply_params)
+    void apply(Train& train, const std::vector<double>& values) const;
+};
+// Result of a point of the sweep for a train
+struct SweepStat {
+    size_t point;       // index of the point (Sweep::point)
+    int train_id;
+    int code;           // 0: success, -1: train length, -2: no line, -3: low power,
+                        // -6: over max_time by the preview (not run)
+    double run_time;    // s (the estimate of the preview if -6)
+    double energy;      // kJ
+    size_t stations;    // number of stations reached
+    SweepStat(): point(0), train_id(0), code(0), run_time(0), energy(0), stations(0) {};
+};
+// Table of the points: the values, the code, the run time, the energy and the stations
+void print_sweep(FILE* fp, const Sweep& sweep, const std::vector<SweepStat>& stats);
+
+#endif
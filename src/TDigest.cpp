@@ -0,0 +1,125 @@
+#include "common.h"
+#include <limits>
+#include <algorithm>
+#include "TDigest.h"
+////////////////////////////////////////////////////////////////////////////////
+TDigest::TDigest(double compression) {
+    delta = (compression >= 10) ? compression : 10;
+    total = 0;
+    sum = 0;
+    vmin = std::numeric_limits<double>::infinity();
+    vmax = -std::numeric_limits<double>::infinity();
+}
+//-----------------------------------------------------------------------------
+// The buffer is merged when it has 5 delta values
+//-----------------------------------------------------------------------------
+void TDigest::add(double x, double w) {
+    if (!(w > 0) || std::isnan(x)) return;
+    buffer.push_back({x, w});
+    total += w;
+    sum += x * w;
+    if (x < vmin) vmin = x;
+    if (x > vmax) vmax = x;
+    if (buffer.size() >= (size_t)(5 * delta)) flush();
+}
+
+void TDigest::merge(const TDigest& d) {
+    for (const auto& c : d.centroids) buffer.push_back(c);
+    for (const auto& c : d.buffer) buffer.push_back(c);
+    total += d.total;
+    sum += d.sum;
+    vmin = std::min(vmin, d.vmin);
+    vmax = std::max(vmax, d.vmax);
+    flush();
+}
+//-----------------------------------------------------------------------------
+// A centroid grows while its right end q is within k(q_left) + 1
+//-----------------------------------------------------------------------------
+void TDigest::flush() {
+    if (buffer.empty()) return;
+    buffer.insert(buffer.end(), centroids.begin(), centroids.end());
+    std::sort(buffer.begin(), buffer.end(), [](const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+    centroids.clear();
+    double weight = 0;
+    for (const auto& c : buffer) weight += c.weight;
+    auto k = [this](double q) { return delta / (2 * M_PI) * std::asin(2 * q - 1); };
+    auto q_limit = [&](double q) {
+        double kx = k(q) + 1;
+        if (kx >= delta / 4) return 1.0;
+        return (std::sin(kx * 2 * M_PI / delta) + 1) / 2;
+    };
+    Centroid cur = buffer[0];
+    double w_done = 0;
+    double limit = weight * q_limit(0);
+    for (size_t i = 1; i < buffer.size(); i++) {
+        const Centroid& x = buffer[i];
+        if (w_done + cur.weight + x.weight <= limit) {
+            cur.mean += (x.mean - cur.mean) * x.weight / (cur.weight + x.weight);
+            cur.weight += x.weight;
+        } else {
+            w_done += cur.weight;
+            centroids.push_back(cur);
+            limit = weight * q_limit(w_done / weight);
+            cur = x;
+        }
+    }
+    centroids.push_back(cur);
+    buffer.clear();
+}
+//-----------------------------------------------------------------------------
+// Linear interpolation between the centers of the centroids (the min and
+// the max at the ends)
+//-----------------------------------------------------------------------------
+double TDigest::quantile(double q) {
+    flush();
+    if (centroids.empty()) return std::numeric_limits<double>::quiet_NaN();
+    if (q <= 0) return vmin;
+    if (q >= 1) return vmax;
+    double index = q * total;
+    const Centroid& first = centroids.front();
+    if (index < first.weight / 2) {
+        return vmin + (first.mean - vmin) * index / (first.weight / 2);
+    }
+    double center = first.weight / 2;
+    double cum = first.weight;
+    for (size_t i = 1; i < centroids.size(); i++) {
+        const Centroid& c = centroids[i];
+        double next_center = cum + c.weight / 2;
+        if (index < next_center) {
+            double r = (index - center) / (next_center - center);
+            return centroids[i - 1].mean + (c.mean - centroids[i - 1].mean) * r;
+        }
+        center = next_center;
+        cum += c.weight;
+    }
+    const Centroid& last = centroids.back();
+    double r = (index - center) / (total - center);
+    return last.mean + (vmax - last.mean) * std::min(1.0, r);
+}
+//-----------------------------------------------------------------------------
+// %.17g keeps the doubles exactly
+//-----------------------------------------------------------------------------
+void TDigest::write(FILE* fp) {
+    flush();
+    if (total <= 0) {
+        fprintf(fp, "0 0 0 0 0");
+        return;
+    }
+    fprintf(fp, "%.17g %.17g %.17g %.17g %zu", total, sum, vmin, vmax, centroids.size());
+    for (const auto& c : centroids) fprintf(fp, " %.17g %.17g", c.mean, c.weight);
+}
+
+bool TDigest::read(std::istream& in) {
+    size_t n;
+    if (!(in >> total >> sum >> vmin >> vmax >> n)) return false;
+    if (total <= 0) {
+        *this = TDigest(delta);
+        return n == 0;
+    }
+    centroids.resize(n);
+    buffer.clear();
+    for (auto& c : centroids) {
+        if (!(in >> c.mean >> c.weight)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+/**
+ * Streaming quantiles by a merging t-digest (Dunning).
+ * The values are buffered and merged into centroids whose sizes are
+ * limited by the scale function k(q) = delta / (2 pi) asin(2q - 1), so the
+ * tails are kept in small centroids. The memory is O(delta) whatever the
+ * number of values. A merge depends on the order, so digests are merged in
+ * a fixed order for the same result.
+ */
+#ifndef TDIGEST_H
+#define TDIGEST_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <istream>
+////////////////////////////////////////////////////////////////////////////////
+class TDigest {
+    struct Centroid {
+        double mean;
+        double weight;
+    };
+    double delta;                   // compression
+    std::vector<Centroid> centroids;// merged (sorted by mean)
+    std::vector<Centroid> buffer;   // not merged yet
+    double total;                   // weight of all values
+    double sum;
+    double vmin, vmax;
+public:
+    explicit TDigest(double compression = 200);
+    void add(double x, double w = 1.0);
+    void merge(const TDigest& d);
+    // Value at q (0 - 1). NaN if there is no value.
+    double quantile(double q);
+    double count() const { return total; };
+    double mean() const { return (total > 0) ? sum / total : 0.0; };
+    double min() const { return vmin; };
+    double max() const { return vmax; };
+    size_t size() const { return centroids.size() + buffer.size(); };
+    // "count sum min max n mean weight ..." (the buffer is merged first)
+    void write(FILE* fp);
+    // Read the values written by write. Return false if invalid.
+    bool read(std::istream& in);
+    // Merge the buffer into the centroids (as write does)
+    void flush();
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "Trace.h"
+////////////////////////////////////////////////////////////////////////////////
+namespace trace {
+
+bool recording = false;
+
+struct Buffer {
+    int tid;
+    const char* name;
+    int index;
+    std::vector<Event> events;
+};
+// The buffers live until the end of the program, so worker threads may exit
+// before the buffers are saved.
+static std::mutex buffers_mutex;
+static std::vector<std::unique_ptr<Buffer>> buffers;
+static thread_local Buffer* tl_buffer = nullptr;
+static std::chrono::steady_clock::time_point origin;
+
+static Buffer& local() {
+    if (tl_buffer == nullptr) {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.emplace_back(new Buffer());
+        tl_buffer = buffers.back().get();
+        tl_buffer->tid = (int)buffers.size();
+        tl_buffer->name = (buffers.size() == 1) ? "main" : "thread";
+        tl_buffer->index = -1;
+        tl_buffer->events.reserve(1024);
+    }
+    return *tl_buffer;
+}
+//-----------------------------------------------------------------------------
+void start() {
+    origin = std::chrono::steady_clock::now();
+    local();
+    recording = true;
+}
+
+int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void record(const char* name, const char* cat, int64_t ts, int64_t dur, int arg) {
+    local().events.push_back({name, cat, ts, dur, arg});
+}
+
+void set_thread_name(const char* name, int index) {
+    if (!recording) return;
+    Buffer& b = local();
+    b.name = name;
+    b.index = index;
+}
+//-----------------------------------------------------------------------------
+// "X" (complete) events in us and "M" events of the thread names
+//-----------------------------------------------------------------------------
+bool save(const char* fname) {
+    FILE* fp = fopen(fname, "wt");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot create file %s\n", fname);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"runrail\"}}");
+    for (const auto& b : buffers) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"", b->tid);
+        if (b->index >= 0) fprintf(fp, "%s %d\"}}", b->name, b->index);
+        else fprintf(fp, "%s\"}}", b->name);
+        for (const auto& e : b->events) {
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d",
+                e.name, e.cat, e.ts * 1e-3, e.dur * 1e-3, b->tid);
+            if (e.arg >= 0) fprintf(fp, ", \"args\": {\"train\": %d}}", e.arg);
+            else fprintf(fp, "}");
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return true;
+}
+
+}
@@ -0,0 +1,61 @@
+/**
+ * Timeline of spans saved in the Chrome trace-event format (--trace).
+ * The file can be opened by chrome://tracing or https://ui.perfetto.dev .
+ * Each thread appends the spans to its own buffer, so recording takes no
+ * lock. Nothing is recorded until start() is called; then a span costs two
+ * clock reads and a push_back.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+////////////////////////////////////////////////////////////////////////////////
+#include <stdint.h>
+////////////////////////////////////////////////////////////////////////////////
+namespace trace {
+
+struct Event {
+    const char* name;   // string literals only
+    const char* cat;
+    int64_t ts;         // start (ns from start())
+    int64_t dur;        // ns
+    int arg;            // train id (-1: none)
+};
+
+extern bool recording;
+// Start recording. Spans before start() are not recorded.
+void start();
+// Time from start() (ns)
+int64_t now();
+// Add a span to the buffer of this thread
+void record(const char* name, const char* cat, int64_t ts, int64_t dur, int arg);
+// Name of this thread in the timeline (string literals only)
+void set_thread_name(const char* name, int index);
+// Save all buffers. Returns false if the file cannot be created.
+bool save(const char* fname);
+
+class Span {
+    const char* name;
+    const char* cat;
+    int arg;
+    int64_t t0;
+    bool on;
+public:
+    Span(const char* name, const char* cat, int arg = -1) : name(name), cat(cat), arg(arg) {
+        on = recording;
+        t0 = on ? now() : 0;
+    }
+    ~Span() { end(); }
+    // Close the span before the end of the scope
+    void end() {
+        if (on) record(name, cat, t0, now() - t0, arg);
+        on = false;
+    }
+};
+
+}
+
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_SPAN(name, cat) trace::Span TRACE_CAT(trace_span_, __LINE__)(name, cat)
+#define TRACE_SPAN_ARG(name, cat, arg) trace::Span TRACE_CAT(trace_span_, __LINE__)(name, cat, arg)
+
+#endif
@@ -28,11 +28,14 @@ TrainBase::TrainBase() {
     start_resist = 3.0 * GRAV_ACC;  // 3kgf/t
     start_resist_sp = 3.0;     // until 3.0 km/h
     curve_resist_A = 600 * GRAV_ACC;
+    traction_factor = 1.0;
     //
     spmargin = 1.0;
     reaccel_speed = 4.0/3.6;
     b_fix_speed = false;
     b_reaccel = true;
+    b_brake_curve = false;
+    b_avg_resist = false;
     //
     n_traction_units = 1;
     speed_traction_index = 0;
@@ -82,6 +85,7 @@ bool TrainBase::read_json(const nlohmann::json& jdata) {
         if( jdata.contains("coasting") == true) coast = jdata.at("coasting");
         if( jdata.contains("jerk") == true) jerk = jdata.at("jerk");
         if( jdata.contains("nTractions") == true) n_traction_units = jdata.at("nTractions");
+        if( jdata.contains("tractionfactor") == true) traction_factor = jdata.at("tractionfactor");
         if( jdata.contains("resistance") == true) {
             std::string model_name = jdata["resistance"]["model"];
             std::vector<double> model_data = jdata["resistance"]["params"];
@@ -91,6 +95,8 @@ bool TrainBase::read_json(const nlohmann::json& jdata) {
             };
         }
         if( jdata.contains("lineindex") == true) line_index = jdata.at("lineindex");
+        if( jdata.contains("brakecurve") == true) b_brake_curve = jdata.at("brakecurve");
+        if( jdata.contains("averageresist") == true) b_avg_resist = jdata.at("averageresist");
 	} catch(nlohmann::json::exception& e) {
 		fprintf(stderr,"%s\n", e.what());
 		return false;
@@ -99,6 +105,68 @@ bool TrainBase::read_json(const nlohmann::json& jdata) {
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// The forces of ForceMethod::SIMPLE are updated for the new value
+//-----------------------------------------------------------------------------
+bool TrainBase::set_value(const std::string& key, double x) {
+    if (key == "maxspeed") max_speed = x;
+    else if (key == "length") length = x;
+    else if (key == "WM") {
+        WM = x;
+        weight = WM + WT;
+    }
+    else if (key == "WT") {
+        WT = x;
+        weight = WM + WT;
+    }
+    else if (key == "weight") weight = x;
+    else if (key == "nCars") nCars = (int)x;
+    else if (key == "acceleration") fixed_acc = x;
+    else if (key == "deceleration") dec = x;
+    else if (key == "coasting") coast = x;
+    else if (key == "jerk") jerk = x;
+    else if (key == "nTractions") n_traction_units = (int)x;
+    else if (key == "torquemaxspeed") torque_max_speed = x;
+    else if (key == "powermaxspeed") power_max_speed = x;
+    else if (key == "inertia") inertia = x;
+    else if (key == "spmargin") spmargin = x;
+    else if (key == "start_resist") start_resist = x;
+    else if (key == "curve_resist_A") curve_resist_A = x;
+    else if (key == "tractionfactor") traction_factor = x;
+    else if (key.size() == 4 && key.compare(0, 3, "res") == 0 && key[3] >= '0' && key[3] <= '5') {
+        res_coefs[key[3] - '0'] = x;
+    }
+    else return false;
+    set_simple_method();
+    return true;
+}
+
+bool TrainBase::get_value(const std::string& key, double* x) const {
+    if (key == "maxspeed") *x = max_speed;
+    else if (key == "length") *x = length;
+    else if (key == "WM") *x = WM;
+    else if (key == "WT") *x = WT;
+    else if (key == "weight") *x = weight;
+    else if (key == "nCars") *x = nCars;
+    else if (key == "acceleration") *x = fixed_acc;
+    else if (key == "deceleration") *x = dec;
+    else if (key == "coasting") *x = coast;
+    else if (key == "jerk") *x = jerk;
+    else if (key == "nTractions") *x = n_traction_units;
+    else if (key == "torquemaxspeed") *x = torque_max_speed;
+    else if (key == "powermaxspeed") *x = power_max_speed;
+    else if (key == "inertia") *x = inertia;
+    else if (key == "spmargin") *x = spmargin;
+    else if (key == "start_resist") *x = start_resist;
+    else if (key == "curve_resist_A") *x = curve_resist_A;
+    else if (key == "tractionfactor") *x = traction_factor;
+    else if (key.size() == 4 && key.compare(0, 3, "res") == 0 && key[3] >= '0' && key[3] <= '5') {
+        *x = res_coefs[key[3] - '0'];
+    }
+    else return false;
+    return true;
+}
+
 bool TrainBase::set_rolling_resistance(const std::string& model_name, const std::vector<double>& data) {
     if( model_name == "None") res_type = RollingResistance::None;
     else if( model_name == "Quadratic") {
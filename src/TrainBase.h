@@ -41,6 +41,7 @@ public: // Property values of this train
     double start_resist;     // Starting rolling resistance (N/t)
     double start_resist_sp;  // Maximum speed of the starting rolling resistance (km/h)
     double curve_resist_A;   // Paremeter of curve (R m) resist A/R (N/t)
+    double traction_factor;  // Ratio of the force to the speed-traction table
     double inertia;
 	double aux_power;      // power of auxiliary equipment
     ForceMethod force_method;
@@ -50,11 +51,20 @@ public:  // Calculation method
 	bool b_reaccel;        // Apply reaccel_speed if true
 	double reaccel_speed;  // Power on if the speed is lower than this (m/s)
 	double spmargin;       // Safety margin to the speed limitation (km/h)
+	bool b_brake_curve;    // Use the precomputed braking curve instead of the next segment
+	bool b_avg_resist;     // Gradient and curve resistance averaged over the train length
 
 
 public:
     TrainBase();
     bool read_json(const nlohmann::json& jdata);
+    // Set a numeric property by the key of the parameter file (and "weight",
+    // "inertia", "spmargin"). WM and WT also set weight = WM + WT.
+    // "res0" - "res5" are the coefficients of the rolling resistance.
+    // Return false if the key is unknown.
+    bool set_value(const std::string& key, double x);
+    // Value of a key of set_value. Return false if the key is unknown.
+    bool get_value(const std::string& key, double* x) const;
 private:
     bool set_rolling_resistance(const std::string& model_name, const std::vector<double>& data);
     void set_simple_method();
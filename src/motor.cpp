@@ -146,3 +146,20 @@ bool Motor::read_json(const nlohmann::json& jdata) {
 	return true;
 
 }
+//-----------------------------------------------------------------------------
+bool Motor::set_value(const std::string& key, double x) {
+    if (key == "power") max_power = x;
+    else if (key == "volt") Volt = x;
+    else if (key == "pole") n_pole = (int)x;
+    else if (key == "efficiency1") power_coef1 = x;
+    else if (key == "efficiency2") power_coef2 = x;
+    else if (key == "freq1") fb1 = x;
+    else if (key == "freq2") fb2 = x;
+    else if (key == "fslip1") fs1 = x;
+    else if (key == "fslip2") fs2 = x;
+    else if (key == "maxspeed") full_speed = x;
+    else if (key == "diameter") diameter = x;
+    else if (key == "gear") gear = x;
+    else return false;
+    return true;
+}
@@ -36,6 +36,9 @@ public:
     double getVelo1() const { return velo1; }
     double getVelo2() const { return velo2; }
     bool read_json(const nlohmann::json& jdata);
+    // Set a property by the key of the parameter file (call init after)
+    // Return false if the key is unknown.
+    bool set_value(const std::string& key, double x);
     void print();
 private:
     double torque(double fi, double fs);
@@ -5,15 +5,25 @@
 #include <stdio.h>
 #include <string>
 #include <memory>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #include <boost/program_options.hpp>
 //---------------------------------------------------------------------------
 #include "RailLine.h"
 #include "RunControl.h"
 #include "SVGConv.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "Shard.h"
 //---------------------------------------------------------------------------
 std::string ctrl_fname;
 std::string output_fname;
 std::string svg_fname;
+std::string metrics_fname;
+std::string trace_fname;
 /////////////////////////////////////////////////////////////////////////////
 void usage() {
 	printf("\nrunrail version %s-%s\n\n", VERSION, GITVERSION);
@@ -21,16 +31,60 @@ void usage() {
 	printf("  input : control file name\n");
 	printf("  output: output file name\n");
 }
+//---------------------------------------------------------------------------
+// Open the output, let fn print into it and close it
+//---------------------------------------------------------------------------
+bool write_output(const std::string& fname, const std::function<void(FILE*)>& fn) {
+	FILE* fp = fopen(fname.c_str(), "wt");
+	if (fp == NULL) {
+		printf("Cannot create file %s\n", fname.c_str());
+		return false;
+	}
+	fn(fp);
+	fclose(fp);
+	return true;
+}
 /////////////////////////////////////////////////////////////////////////////
 int main(int argc, char** argv) {
 	bool test_flag = false;
 	bool svg_flag = false;
+	bool batch_flag = false;
+	int n_threads = 0;
+	int shard = 0, n_shard = 1;
+	int status = 0;		// 1: a run failed (the metrics and the trace are still saved)
+	std::vector<std::string> positional;
 	using namespace boost::program_options;
     RunControl ctrl;
 	options_description description("Options");
 	description.add_options()
 		("svg,s", value<std::string>(), "SVG file name")
-		("test,t", "Calc speed-traction relationship");
+		("test,t", "Calc speed-traction relationship")
+		("coalesce,c", "Merge adjacent segments having the same attributes")
+		("batch,b", "Run all trains (output and SVG names are prefixes)")
+		("threads,j", value<int>(), "Number of worker threads (0: all cores)")
+		("metrics", value<std::string>(), "Save phase times and counters as JSON")
+		("perf", "Add hardware counters of each phase to the metrics (Linux)")
+		("trace", value<std::string>(), "Save the timeline as a Chrome trace (JSON)")
+		("progress", value<double>(), "Print the progress of -b, --sweep and --montecarlo every SEC seconds")
+		("status-file", value<std::string>(), "Update the progress of -b, --sweep and --montecarlo in a JSON file")
+		("mem-budget", value<std::string>(), "Memory budgets (e.g. trajectory=256M,svg=64M)")
+		("verify", value<std::string>(), "Compare a kernel (brakecurve) with the reference")
+		("tol", value<std::string>(), "Tolerances of --verify and --dt-study (e.g. speed=1,time=2,energy=0.01,step=10)")
+		("dt-study", value<int>(), "Run with dt halved N times and recommend dt")
+		("dt-max", value<double>(), "The largest dt of --dt-study (default 1 s)")
+		("sweep", "Run the points of the sweep of the parameter file")
+		("montecarlo", "Run the Monte Carlo samples of the parameter file")
+		("sens", "Derivatives of the running time and the energy by the parameters")
+		("sens-keys", value<std::string>(), "Parameters of --sens (e.g. weight,res0; default: weight, acceleration, deceleration, resistance)")
+		("calibrate", "Fit the train of the calibration of the parameter file to the measured traces")
+		("patterns", "Run the stopping patterns of the parameter file")
+		("matrix", "Minimum run times and energies between all the stations of each train")
+		("preview", "Run times of the kinematic preview against the full runs")
+		("surface", value<std::string>(), "Response surface file (built by the surface of the parameter file if not found)")
+		("query", value<std::string>(), "Answer the queries of the file by --surface")
+		("optimize", value<double>(), "Choose cruising and coasting for the least energy within run time x (1 + SLACK)")
+		("shard", value<std::string>(), "Run the shard i/N of -b, --sweep and --montecarlo")
+		("merge", "Merge shard files (runrail --merge output shard...)");
 
 	variables_map vm;
 	auto const parsing_result = parse_command_line(argc, argv, description);
@@ -38,6 +92,7 @@ int main(int argc, char** argv) {
 	notify(vm);
 	int check_counter = 0;
 	for (auto const& str : collect_unrecognized(parsing_result.options, include_positional)) {
+		positional.push_back(str);
 		if (check_counter == 0) ctrl_fname = str;
 		else if (check_counter == 1) output_fname = str;
 		check_counter++;
@@ -48,7 +103,70 @@ int main(int argc, char** argv) {
 		std::cout << description;
 		return(0);
 	}
+	if (vm.count("merge")) {
+		// the first name is the output
+		if (positional.size() < 2) {
+			usage();
+			return (-1);
+		}
+		std::vector<std::string> shards(positional.begin() + 1, positional.end());
+		if (!merge_shards(positional[0].c_str(), shards)) {
+			printf("Cannot merge the shards\n");
+			return (-1);
+		}
+		printf("%zu shards are merged into %s\n", shards.size(), positional[0].c_str());
+		return (0);
+	}
+	const char* modes[] = {"test", "batch", "sweep", "montecarlo", "sens", "calibrate", "patterns", "matrix", "preview",
+		"surface", "optimize", "dt-study", "verify"};
+	std::string chosen;
+	for (const char* m : modes) {
+		if (!vm.count(m)) continue;
+		if (!chosen.empty()) {
+			printf("--%s and --%s cannot be run together\n", chosen.c_str(), m);
+			return (-1);
+		}
+		chosen = m;
+	}
+	if (vm.count("shard")) {
+		if (!vm.count("batch") && !vm.count("sweep") && !vm.count("montecarlo")) {
+			printf("--shard is only for -b, --sweep and --montecarlo\n");
+			return (-1);
+		}
+		if (!parse_shard(vm["shard"].as<std::string>().c_str(), &shard, &n_shard)) {
+			printf("Invalid shard: %s (i/N)\n", vm["shard"].as<std::string>().c_str());
+			return (-1);
+		}
+		ctrl.set_shard(shard, n_shard);
+	}
 	if (vm.count("test")) test_flag = true;
+	if (vm.count("coalesce")) ctrl.set_coalesce(true);
+	if (vm.count("batch")) batch_flag = true;
+	if (vm.count("threads")) n_threads = vm["threads"].as<int>();
+	if (vm.count("metrics")) {
+		metrics_fname = vm["metrics"].as<std::string>();
+		if (!metrics::enabled()) printf("Metrics are not compiled in (make METRICS=1)\n");
+		if (vm.count("perf")) metrics::set_perf(true);
+	}
+	if (vm.count("progress") || vm.count("status-file")) {
+		if (!vm.count("batch") && !vm.count("sweep") && !vm.count("montecarlo")) {
+			printf("--progress and --status-file are only for -b, --sweep and --montecarlo\n");
+			return (-1);
+		}
+		double interval = vm.count("progress") ? vm["progress"].as<double>() : 0;
+		std::string status_file = vm.count("status-file") ? vm["status-file"].as<std::string>() : "";
+		ctrl.set_progress(interval, status_file);
+	}
+	if (vm.count("mem-budget")) {
+		if (!memory::parse_budgets(vm["mem-budget"].as<std::string>().c_str())) {
+			printf("Invalid memory budget: %s\n", vm["mem-budget"].as<std::string>().c_str());
+			return (-1);
+		}
+	}
+	if (vm.count("trace")) {
+		trace_fname = vm["trace"].as<std::string>();
+		trace::start();
+	}
 	if (vm.count("svg")) {
 		svg_fname = vm["svg"].as<std::string>();
 		svg_flag = true;
@@ -61,17 +179,298 @@ int main(int argc, char** argv) {
 	if (test_flag) {
 		ctrl.traction_test(output_fname.c_str());
 	}
+	else if (vm.count("sweep")) {
+		if (ctrl.sweep.size() == 0) {
+			printf("No sweep in %s\n", ctrl_fname.c_str());
+			return (-1);
+		}
+		int n_fail = ctrl.run_sweep(n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			if (n_shard > 1) print_shard_header(fp, shard, n_shard, "sweep", ctrl.shard_items);
+			print_sweep(fp, ctrl.sweep, ctrl.sweep_stats);
+		})) return (-1);
+		size_t n_filtered = 0;
+		for (const auto& s : ctrl.sweep_stats) {
+			if (s.code == -6) n_filtered++;
+		}
+		printf("%zu runs (%zu points), %d failed", ctrl.sweep_stats.size(), ctrl.sweep.size(), n_fail);
+		if (ctrl.sweep.max_time > 0) printf(", %zu over %g s by the preview", n_filtered, ctrl.sweep.max_time);
+		printf("\n");
+	}
+	else if (vm.count("montecarlo")) {
+		if (ctrl.montecarlo.samples == 0) {
+			printf("No montecarlo in %s\n", ctrl_fname.c_str());
+			return (-1);
+		}
+		int n_fail = ctrl.run_montecarlo(n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			if (n_shard > 1) {
+				print_shard_header(fp, shard, n_shard, "montecarlo", ctrl.shard_items);
+				save_montecarlo_sketch(fp, ctrl.mc_blocks, ctrl.montecarlo.quantiles);
+			}
+			else print_montecarlo(fp, ctrl.mc_stats, ctrl.montecarlo.quantiles);
+		})) return (-1);
+		for (auto& s : ctrl.mc_stats) {
+			if (s.code != 0) {
+				printf("Train %d: failed (code=%d)\n", s.train_id, s.code);
+				continue;
+			}
+			printf("Train %d: %.0f runs (%zu failed), run time %.3f s (median %.3f), energy %.1f kJ (median %.1f)\n",
+				s.train_id, s.run_time.count(), s.n_fail, s.run_time.mean(), s.run_time.quantile(0.5),
+				s.energy.mean(), s.energy.quantile(0.5));
+		}
+		if (n_fail > 0) printf("%d runs failed\n", n_fail);
+	}
+	else if (vm.count("sens")) {
+		std::vector<std::string> keys;
+		std::string str = vm.count("sens-keys") ? vm["sens-keys"].as<std::string>() : "";
+		size_t pos = 0;
+		while (pos < str.size()) {
+			size_t end = str.find(',', pos);
+			if (end == std::string::npos) end = str.size();
+			std::string key = str.substr(pos, end - pos);
+			if (!valid_sens_key(key)) {
+				printf("Unknown key of --sens: %s\n", key.c_str());
+				return (-1);
+			}
+			keys.push_back(key);
+			pos = end + 1;
+		}
+		int n_fail = ctrl.sensitivity(keys, n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_sensitivity(fp, ctrl.sens_stats);
+		})) return (-1);
+		for (const auto& s : ctrl.sens_stats) {
+			if (s.code != 0) printf("Train %d: failed (code=%d)\n", s.train_id, s.code);
+			else printf("Train %d: run time %.1f s (running %.1f s), energy %.1f kJ\n", s.train_id, s.run_time,
+				s.running_time, s.energy);
+		}
+		if (n_fail > 0) printf("%d trains failed\n", n_fail);
+	}
+	else if (vm.count("calibrate")) {
+		if (ctrl.calibration.traces.empty()) {
+			printf("No calibration in the parameter file\n");
+			return (-1);
+		}
+		int code = ctrl.calibrate(n_threads);
+		const CalibStat& s = ctrl.calib_stat;
+		if (code != 0) {
+			printf("Train %d: failed (code=%d)\n", s.train_id, code);
+			return (-1);
+		}
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_calibration(fp, s);
+		})) return (-1);
+		for (size_t j = 0; j < s.keys.size(); j++) {
+			printf("%s: %g -> %g (+- %g)\n", s.keys[j].c_str(), s.initial[j], s.fitted[j], s.std_err[j]);
+		}
+		printf("Train %d: RMS time %.3f -> %.3f s, speed %.3f -> %.3f km/h, %d iterations, %zu runs\n", s.train_id,
+			s.rms_time0, s.rms_time, s.rms_speed0, s.rms_speed, s.iterations, s.n_runs);
+	}
+	else if (vm.count("patterns")) {
+		if (ctrl.patterns.station_ids.empty()) {
+			printf("No patterns in %s\n", ctrl_fname.c_str());
+			return (-1);
+		}
+		int n_fail = ctrl.run_patterns(n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_patterns(fp, ctrl.patterns, ctrl.pattern_stats);
+		})) return (-1);
+		printf("%zu patterns: %zu sections run for %zu sections of the patterns, %d failed\n",
+			ctrl.pattern_stats.size(), ctrl.pattern_sections.size(), ctrl.pattern_uses, n_fail);
+		size_t pick = ctrl.patterns.pick(ctrl.pattern_stats);
+		if (pick < ctrl.pattern_stats.size()) printf("Within %g s: pattern %zu, %zu stops, %.1f s\n", ctrl.patterns.max_time,
+			pick, ctrl.pattern_stats[pick].stops, ctrl.pattern_stats[pick].run_time);
+		else if (ctrl.patterns.max_time > 0) printf("No pattern within %g s\n", ctrl.patterns.max_time);
+	}
+	else if (vm.count("matrix")) {
+		int n_fail = ctrl.run_matrix(n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_matrices(fp, ctrl.matrices);
+		})) return (-1);
+		size_t n_pair = 0, ticks = 0, pair_ticks = 0;
+		for (const auto& m : ctrl.matrices) {
+			if (m.code != 0) {
+				printf("Train %d: no line\n", m.train_id);
+				continue;
+			}
+			if (m.size() > 1) n_pair += m.size() * (m.size() - 1) / 2;
+			ticks += m.ticks;
+			pair_ticks += m.pair_ticks;
+		}
+		printf("%zu trains, %zu pairs of stations, %d failed: %zu time steps (%zu run one by one)\n",
+			ctrl.matrices.size(), n_pair, n_fail, ticks, pair_ticks);
+	}
+	else if (vm.count("preview")) {
+		int n_fail = ctrl.preview(n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_preview(fp, ctrl.preview_stats);
+		})) return (-1);
+		double max_err = 0, us = 0, run_us = 0;
+		size_t n_ok = 0;
+		for (const auto& s : ctrl.preview_stats) {
+			if (s.code != 0 || s.preview_time == HUGE_VAL) continue;
+			max_err = std::max(max_err, std::fabs((s.preview_time - s.run_time) / s.run_time));
+			us += s.preview_us;
+			run_us += s.run_us;
+			n_ok++;
+		}
+		if (n_ok > 0) {
+			printf("%zu trains: max error %.2f %%, preview %.1f us, full run %.1f us per train\n", n_ok, max_err * 100,
+				us / n_ok, run_us / n_ok);
+		}
+		if (n_fail > 0) printf("%d trains failed\n", n_fail);
+	}
+	else if (vm.count("surface")) {
+		std::string sfname = vm["surface"].as<std::string>();
+		FILE* fs = fopen(sfname.c_str(), "rb");
+		bool changed = (fs == NULL);
+		if (fs != NULL) {
+			fclose(fs);
+			if (!ctrl.load_surface(sfname.c_str())) return (-1);
+		}
+		else if (ctrl.surface.keys.empty()) {
+			printf("No surface in the parameter file\n");
+			return (-1);
+		}
+		for (const auto& node : ctrl.surface.nodes) {
+			if (node.state == 0) changed = true;
+		}
+		auto t0 = std::chrono::steady_clock::now();
+		int n_fail = ctrl.build_surface(n_threads);
+		if (n_fail < 0) return (-1);
+		if (changed) {
+			double el = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+			printf("Surface: %zu nodes (%d failed) in %.2f s\n", ctrl.surface.size(), n_fail, el);
+		}
+		if (vm.count("query")) {
+			std::vector<SurfaceQuery> queries;
+			if (!read_surface_queries(vm["query"].as<std::string>().c_str(), ctrl.surface.keys, &queries)) return (-1);
+			n_fail = ctrl.query_surface(queries, n_threads);
+			if (!write_output(output_fname, [&](FILE* fp) {
+				print_surface_answers(fp, ctrl.surface, queries, ctrl.surface_answers);
+			})) return (-1);
+			size_t n_src[3] = {0, 0, 0};
+			double us = 0;
+			for (const auto& a : ctrl.surface_answers) {
+				n_src[a.source + 1]++;
+				if (a.source == 0) us += a.usec;
+			}
+			printf("%zu queries: %zu from the surface (%.1f us each), %zu simulated, %zu failed; %zu refinements, %zu nodes\n",
+				queries.size(), n_src[1], (n_src[1] > 0) ? us / n_src[1] : 0.0, n_src[2], n_src[0],
+				ctrl.surface_refined, ctrl.surface.size());
+			if (ctrl.surface_refined > 0) changed = true;
+		}
+		else if (!write_output(output_fname, [&](FILE* fp) { print_surface_nodes(fp, ctrl.surface); })) return (-1);
+		if (changed && !ctrl.surface.save(sfname.c_str())) return (-1);
+	}
+	else if (vm.count("optimize")) {
+		double slack = vm["optimize"].as<double>();
+		if (slack < 0) {
+			printf("--optimize needs SLACK >= 0\n");
+			return (-1);
+		}
+		int n_fail = ctrl.optimize_driving(slack, n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_drive(fp, ctrl.drive_stats);
+		})) return (-1);
+		for (const auto& s : ctrl.drive_stats) {
+			if (s.code != 0) {
+				printf("Train %d: failed (code=%d)\n", s.train_id, s.code);
+				continue;
+			}
+			printf("Train %d: run time %.1f -> %.1f s (limit %.1f), energy %.1f -> %.1f kJ, %zu of %zu runs abandoned"
+				" (%zu by the preview), %zu dominated", s.train_id, s.base_total_time, s.total_time, s.time_limit,
+				s.base_total_energy, s.total_energy, s.n_abandoned, s.n_candidates, s.n_filtered, s.n_dominated);
+			if (s.n_fallback > 0) printf(", %zu sections back to full traction", s.n_fallback);
+			printf("\n");
+		}
+		if (n_fail > 0) printf("%d trains failed\n", n_fail);
+	}
+	else if (vm.count("dt-study")) {
+		VerifyTolerance tol;
+		if (vm.count("tol") && !tol.parse(vm["tol"].as<std::string>().c_str())) {
+			printf("Invalid tolerance: %s\n", vm["tol"].as<std::string>().c_str());
+			return (-1);
+		}
+		double dt_max = vm.count("dt-max") ? vm["dt-max"].as<double>() : 1.0;
+		int levels = vm["dt-study"].as<int>();
+		if (levels < 2 || levels > DT_STUDY_MAX_LEVELS || dt_max <= 0) {
+			printf("--dt-study needs 2 to %d levels and dt-max > 0\n", DT_STUDY_MAX_LEVELS);
+			return (-1);
+		}
+		double dt = ctrl.dt_study(dt_max, levels, tol, n_threads);
+		if (dt < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_dt_study(fp, ctrl.dt_stats);
+		})) return (-1);
+		for (const auto& s : ctrl.dt_stats) {
+			if (s.code != 0) {
+				printf("Train %d: failed (code=%d)\n", s.train_id, s.code);
+				continue;
+			}
+			printf("Train %d: run time %.3f s (order %.2f), energy %.1f kJ (order %.2f), dt = %g\n", s.train_id,
+				s.best_time, s.order_time, s.best_energy, s.order_energy, s.recommended);
+		}
+		if (dt <= 0) {
+			printf("No dt is within the tolerances (time %g s, energy %g)\n", tol.time, tol.energy);
+			status = 1;
+		}
+		else printf("Recommended dt: %g s\n", dt);
+	}
+	else if (vm.count("verify")) {
+		VerifyTolerance tol;
+		if (vm.count("tol") && !tol.parse(vm["tol"].as<std::string>().c_str())) {
+			printf("Invalid tolerance: %s\n", vm["tol"].as<std::string>().c_str());
+			return (-1);
+		}
+		std::string kernel = vm["verify"].as<std::string>();
+		int n_fail = ctrl.verify(kernel.c_str(), tol, n_threads);
+		if (n_fail < 0) return (-1);
+		if (!write_output(output_fname, [&](FILE* fp) {
+			print_verify(fp, ctrl.verify_stats);
+		})) return (-1);
+		for (const auto& s : ctrl.verify_stats) {
+			const Deviation& d = s.dev;
+			printf("Train %d [%s] %s: speed %.3f km/h, time %.3f s, energy %.1f kJ (max)\n", s.train_id, kernel.c_str(),
+				(s.code == 0 && s.ok) ? "ok" : "NG", d.max_speed, d.max_time, d.max_energy);
+		}
+		if (n_fail > 0) {
+			printf("%d trains are out of the tolerances (speed %g km/h, time %g s, energy %g)\n",
+				n_fail, tol.speed, tol.time, tol.energy);
+			status = 1;
+		}
+	}
+	else if (batch_flag) {
+		int n_fail = ctrl.run_batch(output_fname.c_str(), svg_flag ? svg_fname.c_str() : NULL, n_threads);
+		if (n_fail < 0) return (-1);
+		for (const auto& stat : ctrl.batch_stats) {
+			printf("Train %d: code=%d time=%.3f bytes=%ld\n", stat.train_id, stat.code, stat.sim_time, stat.bytes);
+		}
+		if (n_fail > 0) {
+			printf("%d trains failed\n", n_fail);
+			status = 1;
+		}
+	}
 	else {
 		// ctrl.print_data();
 		int ret = ctrl.run1(output_fname.c_str());
 		if (ret < 0) {
 			printf("%s\n", ctrl.errmsg.c_str());
 			printf("Error Code: %d\n", ret);
-			exit(1);
+			status = 1;
 		}
-		if (svg_flag) {
+		else if (svg_flag) {
 			SVGConvert svgc;
 			svgc.set_simplify(ctrl.svg_maxpt());
+			svgc.set_threads(n_threads);
 			// line->test_print();
 			svgc.read_rail(ctrl.present_line);
 
@@ -83,6 +482,8 @@ int main(int argc, char** argv) {
 			}
 		}
 	}
+	if (!metrics_fname.empty()) metrics::save(metrics_fname.c_str());
+	if (!trace_fname.empty()) trace::save(trace_fname.c_str());
 
-	return 0;
+	return status;
 }
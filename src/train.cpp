@@ -9,8 +9,11 @@
 #include "common.h"
 #include "train.h"
 #include "RailLine.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Sensitivity.h"
 ////////////////////////////////////////////////////////////////////////////////
-double Train::dt = 1.0/16.0;
+double Train::default_dt = 1.0/16.0;
 const int RunCode::Error = -100;
 const int RunCode::LessPower   = -1;
 const int RunCode::InSegment   = 0;
@@ -64,76 +67,86 @@ double SpeedTraction::traction(double sp) {
     return nUnit * midval(sp) * unit_conv_factor;
 }
 //-----------------------------------------------------------------------------
-// Set the maximum speed to the SegmentList considering breaking
+// Calculate the maximum speed of each segment considering breaking
 // If the maximum speed of the next segment is lower than that of the present
 // segment, this calculates the maximum allowed speed at the begining of the
 // current segment.
 // [Input]
+//    segs
 //    dec deceleration (m/s^2)
 //    train_length  the length of the train (m)
-// [Input/Output]
-//    segs
+// [Output]
+//    max_speed  the maximum speed of segs[i] (km/h)
 // [Return]
 //   0
 //-----------------------------------------------------------------------------
-int setsegspeed(SegmentList& segs, double dec, double train_length, double margin)
+int setsegspeed(const SegmentList& segs, double dec, double train_length, double margin,
+                std::vector<double>& max_speed)
 {
-    SegmentList::reverse_iterator it = segs.rbegin();
-    (*it).max_speed = (*it).speed - margin;
-    double sp1 = (*it).max_speed /3.6;  //segment speed is in km/h
+    max_speed.resize(segs.size());
+    if (segs.empty()) return 0;
+    size_t i = segs.size() - 1;
+    max_speed[i] = segs[i].speed - margin;
+    double sp1 = max_speed[i] /3.6;  //segment speed is in km/h
     double d2 = 0.0;  // for station segments
     // Assume that length > train_length
     // at stations, compare two consitions:
     // 1) stop at the center of segment, and 2) entrance speed
-    if ( (*it).type ==  SegmentType::Station ) {
+    if ( segs[i].type ==  SegmentType::Station ) {
         double d = 0.5*sp1*sp1/dec;
-        d2 = (*it).length/2 + train_length/2;
+        d2 = segs[i].length/2 + train_length/2;
         if( d > d2 ) {
-            /*
-            sp1 = 0.0;
-            (*it).max_speed = 0.0;
-            */
             sp1 = std::sqrt(2 * dec * d2);
-            (*it).max_speed = sp1;
+            max_speed[i] = sp1;
         } else d2 = 0.0;
     }
     double sp2 = sp1;
-    ++it;
-    while( it != segs.rend() ) {
-        (*it).max_speed = (*it).speed - margin;
-        sp1 = (*it).max_speed /3.6;
-        double length = (*it).length + d2;
+    while( i > 0 ) {
+        i--;
+        const Segment& seg = segs[i];
+        max_speed[i] = seg.speed - margin;
+        sp1 = max_speed[i] /3.6;
+        double length = seg.length + d2;
         if ( sp1 > sp2 ) {
             double d = 0.5*(sp1*sp1-sp2*sp2)/dec;
             if ( d > length ) {
                 sp1 = std::sqrt(2*dec*length + sp2*sp2);
-                (*it).max_speed = sp1 * 3.6;  // m/s --> km/h
+                max_speed[i] = sp1 * 3.6;  // m/s --> km/h
             }
         }
         d2 = 0.0;
         // start speed must 0 at station segments
-        if ( (*it).type == SegmentType::Station ) {
+        if ( seg.type == SegmentType::Station ) {
             double d = 0.5*sp1*sp1/dec;
-            d2 = (*it).length/2 + train_length/2;
+            d2 = seg.length/2 + train_length/2;
             if( d > d2 ) {
-                /*
-                sp1 = 0.0;
-                (*it).max_speed = 0.0;
-                */
                 sp1 = std::sqrt(2 * dec * d2);
-                (*it).max_speed = sp1;
+                max_speed[i] = sp1;
             } else d2 = 0.0;
         }
         sp2 = sp1;
-        ++it;
     }
     return 0;
 }
 //-----------------------------------------------------------------------------
+// Set the maximum speed to the SegmentList considering breaking
+// [Input/Output]
+//    segs  max_speed of each segment is overwritten
+//-----------------------------------------------------------------------------
+int setsegspeed(SegmentList& segs, double dec, double train_length, double margin)
+{
+    std::vector<double> max_speed;
+    int ret = setsegspeed(segs, dec, train_length, margin, max_speed);
+    for (size_t i = 0; i < segs.size(); i++) segs[i].max_speed = max_speed[i];
+    return ret;
+}
+//-----------------------------------------------------------------------------
 // Train Constructor
 //-----------------------------------------------------------------------------
 Train::Train() {
     line = nullptr;
+    sens = nullptr;
+    dt = default_dt;
     init();
     force_method = ForceMethod::SPEED_TRACTION;
 }
@@ -142,6 +155,8 @@ Train::Train() {
 //-----------------------------------------------------------------------------
 Train::Train(const SegmentList& segs) {
     line = nullptr;
+    sens = nullptr;
+    dt = default_dt;
     init(segs);
     force_method = ForceMethod::SPEED_TRACTION;
 }
@@ -153,6 +168,7 @@ void Train::init() {
     distance   = 0;
     speed      = 0;
     station_timer = 0.0;
+    n_stops = 0;
     force = 0;
     power = 0;
 }
@@ -188,7 +204,7 @@ bool Train::set_line(const std::shared_ptr<RailLine> r) {
 //-----------------------------------------------------------------------------
 // Train: Get the line pointer
 //-----------------------------------------------------------------------------
-std::shared_ptr<RailLine> Train::get_line() {
+std::shared_ptr<RailLine> Train::get_line() const {
     return line;
 }
 //-----------------------------------------------------------------------------
@@ -197,18 +213,22 @@ std::shared_ptr<RailLine> Train::get_line() {
 // Output: N (not kgf)
 //-----------------------------------------------------------------------------
 double Train::get_rolling_resist(double v) const {
-    double r = 0;
+    return get_rolling_resist(v, *this);
+}
+
+template <class T, class C> T Train::get_rolling_resist(const T& v, const C& c) const {
+    T r = 0;
     switch(res_type) {
         case RollingResistance::None:
             break;
         case RollingResistance::Quadratic:
-            r = res_coefs[0] + res_coefs[1] * v + res_coefs[2] * v*v;
+            r = c.res_coefs[0] + c.res_coefs[1] * v + c.res_coefs[2] * v*v;
             break;
         case RollingResistance::JNR_EMU:  // kgf -> N
-            r = ( (res_coefs[0]+res_coefs[1]*v)* weight + (res_coefs[2]+res_coefs[3]*(nCars-1))*v*v ) * GRAV_ACC;
+            r = ( (c.res_coefs[0]+c.res_coefs[1]*v)* c.weight + (c.res_coefs[2]+c.res_coefs[3]*(nCars-1))*v*v ) * GRAV_ACC;
             break;
         case RollingResistance::JNR_EMU_MT: // kgf -> N
-            r = ((res_coefs[0]+res_coefs[1]*v)*WM + (res_coefs[2]+res_coefs[3]*v)*WT + (res_coefs[4]+res_coefs[5]*(nCars-1))*v*v) * GRAV_ACC;
+            r = ((c.res_coefs[0]+c.res_coefs[1]*v)*c.WM + (c.res_coefs[2]+c.res_coefs[3]*v)*c.WT + (c.res_coefs[4]+c.res_coefs[5]*(nCars-1))*v*v) * GRAV_ACC;
             break;
         default:
             r = 0;
@@ -234,24 +254,28 @@ void Train::set_motor(std::shared_ptr<Motor> pt) {
 //  Resistance (Unit = N, NOT N/t)
 //-----------------------------------------------------------------------------
 double Train::get_regist(double v, double gradient, double radius) const {
-    double Rf, Rg, Rc;
+    return get_regist(v, gradient, radius, *this);
+}
+
+template <class T, class C> T Train::get_regist(const T& v, double gradient, double radius, const C& c) const {
+    T Rf, Rg, Rc;
     // Start resistance
     if ( v <  start_resist_sp ) {
-        double res_start = start_resist * weight;  // (N/t) x t
-        double res_end = get_rolling_resist(start_resist_sp);
+        T res_start = c.start_resist * c.weight;  // (N/t) x t
+        T res_end = get_rolling_resist(T(start_resist_sp), c);
         if (res_start > res_end)
             Rf = res_start - ((res_start - res_end) / start_resist_sp) * v;
-        else Rf = get_rolling_resist(v);
+        else Rf = get_rolling_resist(v, c);
     }
     else {
-        Rf = get_rolling_resist(v);  // (N)
+        Rf = get_rolling_resist(v, c);  // (N)
     }
     // Gradient resistance (gradient in percent)
     double gr0 = gradient/100;
-    Rg = gr0/std::sqrt(1+gr0*gr0) * (weight*1000) * GRAV_ACC;   // Mg sin(a)
+    Rg = gr0/std::sqrt(1+gr0*gr0) * (c.weight*1000) * GRAV_ACC;   // Mg sin(a)
     // Curvature resistance
     if ( radius > 0 ) {
-        Rc = (curve_resist_A/radius) * weight;  // (N/ton) * ton
+        Rc = (c.curve_resist_A/radius) * c.weight;  // (N/ton) * ton
     } else Rc = 0;
 
     return Rf + Rg + Rc;
@@ -262,17 +286,22 @@ double Train::get_regist(double v, double gradient, double radius) const {
 //   v   speed (km/h)
 //-----------------------------------------------------------------------------
 double Train::get_force(double v) const {
-    double F = 0.0;
-    if (force_method == ForceMethod::MOTOR) F = motor->tract(v) * n_traction_units;
+    return get_force(v, *this);
+}
+
+template <class T, class C> T Train::get_force(const T& v, const C& c) const {
+    using std::pow;
+    T F = 0.0;
+    if (force_method == ForceMethod::MOTOR) F = lift([this](double s) { return motor->tract(s); }, v) * n_traction_units;
     else if (force_method == ForceMethod::SIMPLE) {
-        if (v <= torque_max_speed) F = fixed_force;
+        if (v <= torque_max_speed) F = c.fixed_force;
         else if (power_max_speed > torque_max_speed && v > power_max_speed) {
-            F = simple_const / std::pow(v / 3.6, 2);
-        } else F = fixed_power / (v / 3.6);
+            F = c.simple_const / pow(v / 3.6, 2);
+        } else F = c.fixed_power / (v / 3.6);
     }
     else {
         assert(speed_traction);
-        F = speed_traction->traction(v);
+        F = lift([this](double s) { return speed_traction->traction(s); }, v) * traction_factor;
     }
     return F;
 }
@@ -288,10 +317,15 @@ double Train::get_force(double v) const {
 // return value is in m/s^2
 //-----------------------------------------------------------------------------
 double Train::df(double sp, double gradient, double radius, bool no_force = false) const {
-    double v = sp * 3.6;  // input (m/s) -> km/h for well-known formulaes
-    double f =  no_force ? 0.0: get_force(v);
-    f = f - get_regist(v,gradient,radius);
-    double M = weight * 1000 * ( 1 + inertia );  // ton -> kg
+    return df(sp, gradient, radius, no_force, *this);
+}
+
+template <class T, class C> T Train::df(const T& sp, double gradient, double radius, bool no_force, const C& c) const {
+    METRIC_INC(DfEvals);
+    T v = sp * 3.6;  // input (m/s) -> km/h for well-known formulaes
+    T f =  no_force ? T(0.0): get_force(v, c);
+    f = f - get_regist(v,gradient,radius,c);
+    T M = c.weight * 1000 * ( 1 + inertia );  // ton -> kg
     return f/M;
 }
 //-----------------------------------------------------------------------------
@@ -299,9 +333,13 @@ double Train::df(double sp, double gradient, double radius, bool no_force = fals
 // speed (km/h)
 //-----------------------------------------------------------------------------
 double Train::calc_need_force(double speed, double acceleration) const {
+    return calc_need_force(speed, acceleration, *this);
+}
+
+template <class T, class C> T Train::calc_need_force(const T& speed, const T& acceleration, const C& c) const {
     double inercia = 0.1;
-    double M = weight * 1000 * (1 + inercia);
-    double r = get_regist(speed, 0, 0);
+    T M = c.weight * 1000 * (1 + inercia);
+    T r = get_regist(speed, 0, 0, c);
     return (M * acceleration + r);
 }
 //-----------------------------------------------------------------------------
@@ -388,20 +426,26 @@ int Train::solve(const SegmentList& segs, double x0, double v0, double v1, VarSe
 void Train::step(double gradient, double radius,
         double* v, double* x, double* a, bool no_force) const
 {
-    double v1 = *v;
-    double x1 = *x;
+    step(gradient, radius, v, x, a, no_force, *this);
+}
+
+template <class T, class C> void Train::step(double gradient, double radius,
+        T* v, T* x, T* a, bool no_force, const C& c) const
+{
+    T v1 = *v;
+    T x1 = *x;
     // df (v1 is in m/s)
-    double h1 = df(v1,gradient,radius,no_force) ;
-    double k1 = v1 ;
+    T h1 = df(v1,gradient,radius,no_force,c) ;
+    T k1 = v1 ;
 //printf("[v= %f h=%f k=%f]", v1, h1, k1);
-    double h2 = df(v1+h1*dt/2,gradient,radius,no_force) ;
-    double k2 = (v1+h1*dt/2) ;
+    T h2 = df(v1+h1*dt/2,gradient,radius,no_force,c) ;
+    T k2 = (v1+h1*dt/2) ;
 
-    double h3 = df(v1+h2*dt/2,gradient,radius, no_force) ;
-    double k3 = (v1+h2*dt/2) ;
+    T h3 = df(v1+h2*dt/2,gradient,radius, no_force,c) ;
+    T k3 = (v1+h2*dt/2) ;
 
-    double h4 = df(v1+h3*dt,gradient,radius, no_force) ;
-    double k4 = (v1+h3*dt) ;
+    T h4 = df(v1+h3*dt,gradient,radius, no_force,c) ;
+    T k4 = (v1+h3*dt) ;
 
     *a = h1/6+h2/3+h3/3+h4/6;
     *v = v1 + (h1/6+h2/3+h3/3+h4/6) * dt;
@@ -415,6 +459,8 @@ void Train::step(double gradient, double radius,
  // status is acceleration
  //-----------------------------------------------------------------------------
 int Train::prepare_run() {
+    METRIC_PHASE(Prepare);
+    TRACE_SPAN_ARG("prepare_run", "run", id);
     seg_it = line->segs.begin();
     distance = seg_it->length/2 + length/2;
     while (seg_it != line->segs.end() && distance > seg_it->length) ++seg_it;
@@ -428,17 +474,43 @@ int Train::prepare_run() {
     tm1 = 0.0;
     total_power = 0.0;
     station_timer = 0.0;
+    n_stops = 0;
     entered = false;
-    setsegspeed(line->segs, dec, length, spmargin);
+    if (sens) sens->reset();
+    if (envelope_cache) envelope = envelope_cache->get(*line, dec, length, spmargin);
+    else envelope = std::make_shared<const SpeedEnvelope>(*line, dec, length, spmargin);
+    brake_curve.reset();
+    if (b_brake_curve) {
+        if (envelope_cache) brake_curve = envelope_cache->get_curve(*line, dec, length, spmargin, max_speed);
+        else brake_curve = std::make_shared<const BrakingCurve>(*line, *envelope, dec, length, max_speed);
+    }
     status = TrainStatus::Traction;
 /*
-for(const auto& item: line->segs) {
-    printf("SP=%g MAX=%g\n", item.speed, item.max_speed);
+for(size_t i = 0; i < line->segs.size(); i++) {
+    printf("SP=%g MAX=%g\n", line->segs[i].speed, envelope->max_speed[i]);
 }
 */
     return(0);
 }
 //-----------------------------------------------------------------------------
+// The segment of the run is kept by its index; the state of the run is not
+// changed.
+//-----------------------------------------------------------------------------
+int Train::continue_on(const std::shared_ptr<RailLine> r) {
+    size_t k = seg_it - line->segs.begin();
+    if (!r || k >= r->segs.size()) return (-1);
+    line = r;
+    seg_it = line->segs.begin() + k;
+    if (envelope_cache) envelope = envelope_cache->get(*line, dec, length, spmargin);
+    else envelope = std::make_shared<const SpeedEnvelope>(*line, dec, length, spmargin);
+    brake_curve.reset();
+    if (b_brake_curve) {
+        if (envelope_cache) brake_curve = envelope_cache->get_curve(*line, dec, length, spmargin, max_speed);
+        else brake_curve = std::make_shared<const BrakingCurve>(*line, *envelope, dec, length, max_speed);
+    }
+    return(0);
+}
+//-----------------------------------------------------------------------------
 // Get the maximum speed bitween the head and the tail of this train
 // x1: location of the tail
 // x2: location fo the head
@@ -448,8 +520,9 @@ for(const auto& item: line->segs) {
 // but that of departing is not the same
 //-----------------------------------------------------------------------------
 double Train::get_min_speed(double x1, double x2) const {
+    METRIC_INC(MinSpeedCalls);
 
-    if (!line || line->nSegment() == 0) return max_speed;
+    if (!line || line->nSegment() == 0 || !envelope) return max_speed;
 
     double result = max_speed;
     SegmentList& segs = line->segs;
@@ -458,21 +531,21 @@ double Train::get_min_speed(double x1, double x2) const {
         (x1 >= pre->distance && x1 < pre->distance + pre->length) ||
         (x2 > pre->distance && x2 <= pre->distance + pre->length)) {
         if (pre->type == SegmentType::Station) result = pre->speed; // station departure max
-        else result = pre->max_speed;
+        else result = seg_max_speed(pre);
     }
     for (auto it = std::next(pre); it != segs.end(); ++it) {
         if (x2 < it->distance) {
             if (pre->head_only == false)
             {
                 if (pre->type == SegmentType::Station) result = std::min(pre->speed, result);
-                else result = std::min(pre->max_speed, result);
+                else result = std::min(seg_max_speed(pre), result);
                 break;
             }
         }
         if (x1 < it->distance) {
             if (pre->head_only == false) {
                 if (pre->type == SegmentType::Station) result = std::min(pre->speed, result);
-                else result = std::min(pre->max_speed, result);
+                else result = std::min(seg_max_speed(pre), result);
             }
         }
         pre = it;
@@ -494,17 +567,23 @@ double Train::get_min_speed(double x1, double x2) const {
 //-----------------------------------------------------------------------------
 int Train::update() {
     int ret = RunCode::InSegment;
+    // state before the step (derivatives)
+    const double x0 = distance, v0 = speed;
+    SensMove move = MoveNone;
+    bool fore_traction = false;
     double start_dist = (*seg_it).distance;
     double gradient = (*seg_it).gradient;
     double radius = (*seg_it).radius;
+    // Gradient and curve between the tail and the head (prefix sums of the line)
+    if (b_avg_resist) line->average_profile(distance - length, distance, &gradient, &radius);
     // It is necessary to consider the speed lmitation
-    double limspeed = std::min((*seg_it).max_speed, max_speed) / 3.6;  //m/s
+    double limspeed = std::min(seg_max_speed(seg_it), max_speed) / 3.6;  //m/s
     SegmentList::const_iterator next_it = std::next(seg_it);
     bool bLastSeg = (next_it == line->segs.end()) ? true : false;
     double next_dist = start_dist + (*seg_it).length;  // distance of the next segment
                                                        // the same as: next_dist = (*next_it).distance;
     // next_max_speed (m/s)
-    double next_max_speed = bLastSeg ? 0 : std::min((*next_it).max_speed, max_speed) / 3.6 ;
+    double next_max_speed = bLastSeg ? 0 : std::min(seg_max_speed(next_it), max_speed) / 3.6 ;
     if (next_max_speed < 0) next_max_speed = 0;
     // If the train is in the station segment before the midpoint of the segment,
     // meaning that the train has not arrived at the station, the next point should be the midpoint
@@ -514,7 +593,7 @@ int Train::update() {
     }
     else {
         // The speed of the midpoint of the setion segment is zero.
-        if (!bLastSeg && next_it->type == SegmentType::Station && next_it->max_speed == 0)
+        if (!bLastSeg && next_it->type == SegmentType::Station && seg_max_speed(next_it) == 0)
             next_dist += next_it->length * 0.5;
     }
     // Considering the speed limit between the front and tail of the train
@@ -536,6 +615,14 @@ int Train::update() {
             status = TrainStatus::Traction;
         if (entered == false) limspeed = x;
     }
+    // Driving of the section: cruise speed and coasting point
+    bool coast_only = false;
+    if (n_stops < drive.size()) {
+        const DriveSection& ds = drive[n_stops];
+        if (ds.cruise > 0) limspeed = std::min(limspeed, ds.cruise / 3.6);
+        coast_only = (distance >= ds.coast_at) && (speed > 0);
+        if (coast_only && (status == TrainStatus::Traction || status == TrainStatus::Constant)) status = TrainStatus::Coasting;
+    }
     // Check if it is necessary to continue breaking
     /*
     if (status == TrainStatus::Breaking) {
@@ -548,6 +635,19 @@ int Train::update() {
         }
     }
     */
+    // The braking curve is looked up once at the present position.
+    // The target of braking is the governing point of the curve, which can be
+    // several segments ahead.
+    double brake_level = 0.0;
+    double brk_dist = next_dist;
+    double brk_speed = next_max_speed;
+    if (brake_curve) {
+        brake_level = brake_curve->get_level(distance);
+        if (brake_curve->target(distance, &brk_dist, &brk_speed) == false) {
+            brk_dist = next_dist;
+            brk_speed = next_max_speed;
+        }
+    }
     // In traction or coasting
 	if( status == TrainStatus::Traction || status == TrainStatus::Coasting || status == TrainStatus::Constant) {
 		// Consider braking if the present speed is lager than the next speed limit
@@ -558,6 +658,7 @@ int Train::update() {
         // For the safety side, forecast the situation of t+dt
         // train length is ignored
         if(status == TrainStatus::Traction) {
+            fore_traction = true;
             step(gradient, radius, &v, &x, &a, false);
             if (a <= 0) {
                 fprintf(stderr, "X=%g V=%g a=%g g=%g r=%g\n", x, v, a, gradient, radius);
@@ -567,7 +668,9 @@ int Train::update() {
         }
         if(status == TrainStatus::Coasting) {
             step(gradient,radius, &v,&x,&a, true);
-            if (x >= next_dist ) {
+            if (brake_curve) {
+                if (brake_curve->exceeds(brake_level, x, v)) status = TrainStatus::Breaking;
+            } else if (x >= next_dist ) {
                 if(v > next_max_speed) status = TrainStatus::Breaking;
             } else if (v > std::sqrt(next_max_speed * next_max_speed + 2 * dec * (next_dist - x))) {
                 status = TrainStatus::Breaking;
@@ -580,8 +683,10 @@ int Train::update() {
         // x + 0.5*(v*v-next_max_speed*next_max_speed)/dec
         // if the present speed is 0 and it will exceed the distance after the acceleration of dt,
         // it is assumed that the train has arrived.
-		if((speed > 0 ) && (v > next_max_speed)
-                && (x + 0.5*(v*v-next_max_speed*next_max_speed)/dec >= next_dist)) {
+        bool over;
+        if (brake_curve) over = brake_curve->exceeds(brake_level, x, v);
+        else over = (v > next_max_speed) && (x + 0.5*(v*v-next_max_speed*next_max_speed)/dec >= next_dist);
+		if((speed > 0 ) && over) {
             // Check if the distance exceeded
             status = TrainStatus::Breaking;
 		} else if (status == TrainStatus::Traction) { // in case of traction
@@ -593,6 +698,7 @@ int Train::update() {
             speed = v;
             distance = x;
             accel = a;
+            move = MoveTraction;
 			// Possibility to run for a while after the deceleration during traction?
             // Case when the speed becomes 0 during traction (such as steep slope)
             if( speed < 0 ) return RunCode::LessPower;
@@ -603,17 +709,19 @@ int Train::update() {
             }
 		} else if (status == TrainStatus::Coasting ) {
 			// In case of re-traction
-			if( b_reaccel && (speed <= limspeed - reaccel_speed)) {
+			if( b_reaccel && !coast_only && (speed <= limspeed - reaccel_speed)) {
                 force = get_force(speed*3.6);
                 power = force * speed / 1000; // J/s -> kW
                 step(gradient, radius, &speed, &distance, &accel);
 				status = TrainStatus::Traction;
-			} else if( b_fix_speed ) {
+                move = MoveTractionRK;
+			} else if( b_fix_speed && !coast_only ) {
                 // acceleration is 0 when the train speed is constant
                 accel = 0.0;
                 force = get_regist(speed,gradient,radius);
                 power = force * speed /1000; // J/s -> kW
                 distance += speed * dt;
+                move = MoveHold;
             } else {
                 distance = x;
                 accel = a;
@@ -625,19 +733,23 @@ int Train::update() {
                     force = get_regist(speed,gradient,radius);
                     power = force * speed /1000; // J/s -> kW
                     status = TrainStatus::Traction;
+                    move = MoveCoastStop;
                 } else if (v > speed) { // If speed increases due to the slope
                     force = get_regist(speed,gradient,radius); // This must be negative
                     power = force * speed /1000; // J/s -> kW
                     accel = 0;
+                    move = MoveSlope;
                 } else {
                     // Coasting
                     force = 0.0;
                     power = 0.0;
                     step(gradient, radius, &speed, &distance, &accel, true);
+                    move = MoveCoast;
                 }
             }
 		} else if (status == TrainStatus::Constant ) {
             distance = x;
+            move = MoveConstant;
         }
 	}
     // not else, because it is necessary to consider breaking during traction and coasting calculation
@@ -646,27 +758,29 @@ int Train::update() {
         if ( speed <= 0.0 ) {
             status = TrainStatus::Traction;
         }
-        else if (next_max_speed > speed) {
+        else if (brk_speed > speed) {
             // Breaking because of slope
-            assert(next_dist > distance);
-            accel = 0.5 * (next_max_speed * next_max_speed - speed * speed) / (next_dist - distance);
+            move = MoveBrake;
+            assert(brk_dist > distance);
+            accel = 0.5 * (brk_speed * brk_speed - speed * speed) / (brk_dist - distance);
             assert(accel > 0);
             force = calc_need_force(speed, accel);
             power = force * speed / 1000; // J/s -> kW
-            double d_tm = (next_max_speed - speed) / accel;
+            double d_tm = (brk_speed - speed) / accel;
             if (d_tm < dt) {
-                accel = (next_max_speed - speed) / dt;
+                accel = (brk_speed - speed) / dt;
             }
             double v = speed + accel * dt;
             double d = speed * dt + 0.5 * accel * dt * dt;
             speed = v;
-            distance = d;
+            distance += d;
         } 
         else {
             // Assume the deceleration is constant in case of breaking
             // accel = dec * (-1);
-            assert(next_dist > distance);
-            accel = 0.5 * (next_max_speed * next_max_speed - speed * speed) / (next_dist - distance);
+            move = MoveBrake;
+            assert(brk_dist > distance);
+            accel = 0.5 * (brk_speed * brk_speed - speed * speed) / (brk_dist - distance);
             assert(accel <= 0);
             force = calc_need_force(speed, accel);
             power = force * speed / 1000; // J/s -> kW
@@ -696,7 +810,7 @@ int Train::update() {
 	// Entering to the next segment is decided by the distance
 	if( distance >= next_dist) {
         // if the next segment is a station and the speed limit of the segment is not considered
-        if( !bLastSeg && next_it->type == SegmentType::Station && next_it->max_speed == 0) {
+        if( !bLastSeg && next_it->type == SegmentType::Station && seg_max_speed(next_it) == 0) {
             status = TrainStatus::Stop;
             ret = RunCode::NextStation;
         } else if( seg_it->type == SegmentType::Station && next_max_speed == 0) {
@@ -709,9 +823,144 @@ int Train::update() {
 		if( seg_it->head_only) entered = true;
         else entered = false; // need to consider the length of the train to determine the max speed
 	}
+    if (sens) track_sens(move, fore_traction, x0, v0, gradient, radius, limspeed, brk_dist, brk_speed, ret);
 	return ret;
 }
 //-----------------------------------------------------------------------------
+// Derivatives of the step of update (sens)
+// The step is repeated on Dual numbers with the driving (move) that update
+// has chosen. A change of the driving or of the segment is an event at the
+// time g = 0 of a condition g, which moves by -(dg/dp)/(dg/dt) with the
+// parameters; the derivatives jump by (before - after) x that move.
+//-----------------------------------------------------------------------------
+TrainStatus Train::sens_mode(int move) {
+    switch (move) {
+        case MoveTraction: case MoveTractionRK: return TrainStatus::Traction;
+        case MoveHold: case MoveConstant: return TrainStatus::Constant;
+        case MoveCoast: case MoveSlope: case MoveCoastStop: return TrainStatus::Coasting;
+        case MoveBrake: return TrainStatus::Breaking;
+        default: return TrainStatus::Stop;
+    }
+}
+
+void Train::track_sens(SensMove move, bool fore_traction, double x0, double v0,
+                       double gradient, double radius, double limspeed, double brk_dist, double brk_speed, int ret) {
+    TrainSens& s = *sens;
+    const TrainCoefs<SensDual>& c = s.coefs;
+    SensDual x = s.x, v = s.v, a;
+    x.v = x0;   // values of the real run
+    v.v = v0;
+    const SensDual xs = x, vs = v;
+    switch (move) {
+        case MoveTraction:  // speed by RK4, distance by the speed before the step
+            s.power = get_force(v * 3.6, c) * v / 1000;
+            step(gradient, radius, &v, &x, &a, false, c);
+            x = xs + vs * dt;
+            break;
+        case MoveTractionRK:
+            s.power = get_force(v * 3.6, c) * v / 1000;
+            step(gradient, radius, &v, &x, &a, false, c);
+            break;
+        case MoveHold:
+            s.power = get_regist(v, gradient, radius, c) * v / 1000;
+            x = x + v * dt;
+            break;
+        case MoveConstant:
+            x = x + v * dt;
+            break;
+        case MoveCoast:
+        case MoveSlope:
+        case MoveCoastStop: {
+            // the distance of the forecast of update
+            SensDual vf = v;
+            if (fore_traction) step(gradient, radius, &vf, &x, &a, false, c);
+            step(gradient, radius, &vf, &x, &a, true, c);
+            if (move == MoveCoast) {
+                s.power = 0.0;
+                step(gradient, radius, &v, &x, &a, true, c);
+            } else if (move == MoveSlope) {
+                s.power = get_regist(v, gradient, radius, c) * v / 1000;
+            } else {
+                x = x + 0.5 * v * dt;
+                v = 0.0;
+                s.power = 0.0;
+            }
+            break;
+        }
+        case MoveBrake: {
+            SensDual acc = 0.5 * (brk_speed * brk_speed - v * v) / (brk_dist - x);
+            s.power = calc_need_force(v, acc, c) * v / 1000;
+            if (brk_speed > v0) {
+                if ((brk_speed - v0) / acc.v < dt) acc = (brk_speed - v) / dt;
+            } else {
+                SensDual vn = v + acc * dt;
+                if (vn < 0) acc = -v / dt;
+                // the remaining time to the stop is the same on the way
+                else if (brk_speed == 0) s.arrive = 2 * (brk_dist - x) / v;
+            }
+            SensDual d = v * dt + 0.5 * acc * dt * dt;
+            if (d < 0) {
+                acc = -v / dt;
+                d = v * dt + 0.5 * acc * dt * dt;
+            }
+            v = (v + acc * dt < 0) ? SensDual(0.0) : v + acc * dt;
+            x = x + d;
+            break;
+        }
+        default:
+            break;
+    }
+    s.energy = s.energy + s.power * dt;
+    // Event between the last step and this step. The rates are those of the
+    // real steps (coasting moves the distance by the forecast and the step).
+    const double rx = (distance - x0) / dt, rv = (speed - v0) / dt;
+    size_t seg = seg_it - line->segs.begin();
+    if (move != MoveNone && s.move != MoveNone) {
+        TrainStatus m0 = sens_mode(s.move);
+        TrainStatus m1 = sens_mode(move);
+        SensDual te;
+        if (m1 == TrainStatus::Breaking && m0 != TrainStatus::Breaking) {
+            // start of braking: v^2 - vb^2 - 2 dec (xb - x) = 0
+            double gt = 2 * v0 * s.rate_v + 2 * dec * s.rate_x;
+            if (std::fabs(gt) > 1e-9) {
+                te = (vs * vs - brk_speed * brk_speed - 2 * c.dec * (brk_dist - xs)) * (-1 / gt);
+            }
+        }
+        else if (m0 == TrainStatus::Breaking ? (m1 != TrainStatus::Breaking) : (seg != s.seg || limspeed != s.limspeed)) {
+            // end of braking, a new segment or a new speed limit (head or tail): at a position
+            if (s.rate_x > 0) te = xs * (-1 / s.rate_x);
+        }
+        else if (m0 != m1 && std::fabs(s.rate_v) > 1e-9) {
+            // speed limit or reacceleration: at a speed
+            te = vs * (-1 / s.rate_v);
+        }
+        te.v = 0;
+        x = x + (s.rate_x - rx) * te;
+        v = v + (s.rate_v - rv) * te;
+        s.energy = s.energy + (s.rate_p - power) * te;
+    }
+    double running = s.run_time.v + dt;
+    if (ret == RunCode::NextStation) {
+        // stopped at the station: the distance and the speed do not move
+        s.run_time = s.run_time + s.arrive;
+        x = v = s.power = s.arrive = SensDual();
+    }
+    s.run_time.v = running;
+    s.x = x;
+    s.v = v;
+    s.x.v = distance;
+    s.v.v = speed;
+    if (ret == RunCode::NextStation) s.move = MoveNone;    // no event at the start
+    else if (move != MoveNone) {
+        s.move = move;
+        s.rate_x = rx;
+        s.rate_v = rv;
+        s.rate_p = power;
+    }
+    s.seg = seg;
+    s.limspeed = limspeed;
+}
+//-----------------------------------------------------------------------------
 // main body of the simulation
 // [Update]
 // - tm1
@@ -730,6 +979,8 @@ int Train::update() {
 int Train::main_run() {
 	int result;
     SegmentList::const_iterator next_it;
+    METRIC_INC(Ticks);
+    METRIC_STATUS(status);
 
 	if( station_timer > 0 ) {
 		station_timer -= dt;
@@ -756,7 +1007,10 @@ int Train::main_run() {
         exit(1);
     } else if( result == RunCode::NextSegment ) {// if the train arrived the next segment
         // The length of Point is 0. The head of train can be in the next next segment. 
-        while (seg_it != line->segs.end() && distance > seg_it->distance+seg_it->length) ++seg_it;
+        while (seg_it != line->segs.end() && distance > seg_it->distance+seg_it->length) {
+            ++seg_it;
+            METRIC_INC(SegAdvances);
+        }
         if(  seg_it == line->segs.end() ) return RunCode::EndOfLine;
 	} else if (result == RunCode::NextStation) {
         if (seg_it == line->segs.end() ) return RunCode::EndOfLine;
@@ -765,6 +1019,7 @@ int Train::main_run() {
         if( next_it == line->segs.end() ) return RunCode::EndOfLine; // The last station
         else if( next_it->type == SegmentType::Station) {
             ++seg_it;
+            METRIC_INC(SegAdvances);
             next_it = std::next(seg_it);
             if( next_it == line->segs.end() ) return RunCode::EndOfLine;
         }
@@ -778,8 +1033,10 @@ int Train::main_run() {
             exit(1);
         }
         // Start countin of the stoppint time at the station
-        if( seg_it->tm_stop > 0 ) station_timer = seg_it->tm_stop;
+        if( n_stops < dwell_times.size() ) station_timer = dwell_times[n_stops];
+        else if( seg_it->tm_stop > 0 ) station_timer = seg_it->tm_stop;
         else station_timer = Control::station_time;
+        n_stops++;
         // departure time is second digit
         if( total_time - floor(total_time) > 0) {
             station_timer += (1 - (total_time - floor(total_time)));
@@ -791,13 +1048,13 @@ int Train::main_run() {
 //-----------------------------------------------------------------------------
 // print out the output
 //-----------------------------------------------------------------------------
-void Train::run_print(FILE* fp) {
+int Train::run_print(FILE* fp) {
 /*
     int a = 0;
     if(entered) a = 1;
     printf("%d\t%.0f\t%.2f\t%.1f\t%.3f\t%.0f\t%d\n",static_cast<int>(status),
         total_time, distance, speed*3.6, accel,force,a);
 */
-    fprintf(fp, "%d\t%.3f\t%.2f\t%.1f\t%.3f\t%.0f\t%.1f\n",static_cast<int>(status),
+    return fprintf(fp, "%d\t%.3f\t%.2f\t%.1f\t%.3f\t%.0f\t%.1f\n",static_cast<int>(status),
         total_time, distance, speed*3.6, accel,force,power);
 }
@@ -1,6 +1,7 @@
 #ifndef TRAIN_H
 #define TRAIN_H
 ////////////////////////////////////////////////////////////////////////////////
+#include <cmath>
 #include <memory>
 #include <vector>
 #include <list>
@@ -9,11 +10,20 @@
 #include "Motor.h"
 #include "RailLine.h"
 #include "TrainBase.h"
+#include "Envelope.h"
 ////////////////////////////////////////////////////////////////////////////////
+struct TrainSens;
 using SegmentList = std::vector<Segment>;
 ////////////////////////////////////////////////////////////////////////////////
 enum class TrainStatus {Traction, Coasting, Breaking, Stop, Constant};
 //---------------------------------------------------------------------------
+// Driving of a section from the start or a stop to the next stop
+struct DriveSection {
+    double cruise;      // max speed of traction (km/h), 0: the speed limits only
+    double coast_at;    // no traction after this distance (m) unless stopped
+    DriveSection(): cruise(0), coast_at(HUGE_VAL) {};
+};
+//---------------------------------------------------------------------------
 struct RunCode {
     static const int Error;
 	static const int LessPower;
@@ -46,6 +56,8 @@ public:
 // Set the maximum speed considering the next segment
 ///////////////////////////////////////////////////////////////////////
 int setsegspeed(SegmentList& segs, double dec, double train_length, double margin);
+int setsegspeed(const SegmentList& segs, double dec, double train_length, double margin,
+                std::vector<double>& max_speed);
 
 //-----------------------------------------------------------------------------
 // A set of variables (time, speed, distance)
@@ -61,8 +73,13 @@ struct VarSet {
 //  This keeps an iterator of the belonging segment
 ////////////////////////////////////////////////////////////////////////////////
 class Train : public TrainBase {
+    friend class TrainBench;    // microbenchmarks (bench/microbench.cpp)
 public:
-    static double dt;       //step size of time (in second)
+    static double default_dt;   // step size of time of new trains (in second)
+    double dt;                  // step size of time (in second)
+    std::vector<double> dwell_times;  // stopping time (s) of the n-th stop (replaces tm_stop and Control::station_time)
+    std::vector<DriveSection> drive;  // driving of the n-th section (none: full traction)
+    TrainSens* sens;            // derivatives of the run (Sensitivity.h) if not null (not owned)
 private:
     // Time dependent variables
     double total_power;  // Total Work (acceleration only) from the beginning of the Simulation (J)
@@ -77,6 +94,7 @@ private:
     double cur_current;
     double tm1;          // Total time between stations
     double station_timer;  // remaining time
+    size_t n_stops;        // stops at stations from prepare_run
 	bool entered;
     TrainStatus status;
     SegmentList::const_iterator seg_it; // Current segment in which this train exist
@@ -85,6 +103,9 @@ private:
     std::shared_ptr<SpeedTraction> speed_traction;  // Speed-Traction relationship
     std::shared_ptr<RailLine> line;
     std::shared_ptr<Motor> motor;
+    std::shared_ptr<EnvelopeCache> envelope_cache;   // shared by trains (optional)
+    std::shared_ptr<const SpeedEnvelope> envelope;   // max speed of segments set in prepare_run
+    std::shared_ptr<const BrakingCurve> brake_curve; // set in prepare_run if b_brake_curve
 public:
     Train();
     Train(const SegmentList& segs);
@@ -92,31 +113,60 @@ public:
     void init(const SegmentList& segs);
     double get_speed() const { return speed; };
     double get_dist() const { return distance; };
+    double get_time() const { return total_time; };
+    double get_energy() const { return total_power; };  // kJ
     TrainStatus get_status() const { return status;};
+    size_t get_segment() const { return seg_it - line->segs.begin(); };  // index of the present segment
     // Functions for internal variables
     void set_speed_traction(std::shared_ptr<SpeedTraction> pt) {speed_traction = pt;};
     void set_motor(std::shared_ptr<Motor> pt);
+    std::shared_ptr<Motor> get_motor() const { return motor; };
+    void set_envelope_cache(std::shared_ptr<EnvelopeCache> pt) { envelope_cache = pt;};
+    std::shared_ptr<EnvelopeCache> get_envelope_cache() const { return envelope_cache; };
     void set_status(TrainStatus new_status) { status = new_status;};
     void set_dt(double d) { dt = d;};
+    double get_dt() const { return dt; };
     bool set_line(const std::shared_ptr<RailLine> r);
-    std::shared_ptr<RailLine> get_line();
+    std::shared_ptr<RailLine> get_line() const;
 protected:
     double get_rolling_resist(double v) const;
+    template <class T, class C> T get_rolling_resist(const T& v, const C& c) const;
 public:
     double get_regist(double v, double gradient, double radius) const;
     double get_force(double v) const;
     double df(double sp, double gradient, double radius, bool no_force) const;
     double get_power() const { return power;};
+private:
+    // The kernels on the scalar T (double or Dual) with the parameters c
+    // (the train itself or TrainCoefs of Sensitivity.h)
+    template <class T, class C> T get_regist(const T& v, double gradient, double radius, const C& c) const;
+    template <class T, class C> T get_force(const T& v, const C& c) const;
+    template <class T, class C> T df(const T& sp, double gradient, double radius, bool no_force, const C& c) const;
+    template <class T, class C> T calc_need_force(const T& speed, const T& acceleration, const C& c) const;
+    template <class T, class C> void step(double gradient, double radius, T* v, T* x, T* a, bool no_force, const C& c) const;
 public:
     int solve(const SegmentList& segs, double x0, double v0, double v_max, VarSet* var) const;
 public:
     int prepare_run();
+    // Continue the run on the line r, whose segments are those of the line
+    // up to the present segment (the same start and another end).
+    // The envelope is set for r. [Return] -1 if the segment is not in r
+    int continue_on(const std::shared_ptr<RailLine> r);
     int main_run();
-    void run_print(FILE* fp);
+    int run_print(FILE* fp);
 private:
+    // Driving of a step in update (for the derivatives)
+    enum SensMove { MoveNone, MoveTraction, MoveTractionRK, MoveHold, MoveConstant,
+                    MoveCoast, MoveSlope, MoveCoastStop, MoveBrake };
     void step(double gradient, double radius, double* v, double* x, double* a, bool no_force=false) const;
     int update();
+    static TrainStatus sens_mode(int move);
+    void track_sens(SensMove move, bool fore_traction, double x0, double v0,
+                    double gradient, double radius, double limspeed, double brk_dist, double brk_speed, int ret);
     double get_min_speed(double x1, double x2) const;
+    double seg_max_speed(SegmentList::const_iterator it) const {
+        return envelope->max_speed[it - line->segs.begin()];
+    };
     double calc_need_force(double speed, double acceleration) const;
 };
 
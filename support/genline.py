@@ -0,0 +1,181 @@
+"""
+Generate a synthetic line file (loadsegdata format) and a params file
+with N trains for scale testing.
+The output is reproducible for the same arguments and seed.
+
+Usage: python genline.py [options] output_prefix
+  -> output_prefix.data and output_prefix.json
+"""
+import sys
+import math
+import json
+import random
+import argparse
+
+# Speed-traction relationship of data/params.json
+SPEED_TRACTION = [
+    [0, 348880], [30, 348880], [35, 325360], [40, 299880], [50, 239120],
+    [60, 192080], [67, 162680], [70, 150920], [75, 141120], [80, 123480],
+    [90, 94080], [100, 64680]
+]
+
+HEADER = """# Lines starting with "#" are isnored (comment lines)
+# Generated by genline.py: {args}
+# Colums are:
+# 1st: id
+# 2nd: distance(m)
+# 3rd: length(m)
+# 4th: type (0=normal, 1=station, 2=switch)
+# 5th: maximum speed(km/h)
+# 6th: gradient(%)
+# 7th: curvature(m), 0 means straight line
+"""
+
+
+def round5(v):
+    return int(5 * round(v / 5.0))
+
+
+def curve_speed(radius, line_speed):
+    # Rough limit of curves: V = 4.0 * sqrt(R) (km/h)
+    if radius <= 0:
+        return line_speed
+    return max(25, min(line_speed, round5(4.0 * math.sqrt(radius))))
+
+
+def make_section(rnd, args, length):
+    """Segments between two stations: list of [length, type, speed, gradient, radius]"""
+    segs = []
+    mean_len = 1000.0 / args.density
+    rest = length
+    gradient = 0.0
+    while rest > 0:
+        d = max(20.0, round(rnd.expovariate(1.0 / mean_len)))
+        if rest - d < 20.0:
+            d = rest
+        # gradient: mostly level, otherwise a random walk around the previous one
+        if rnd.random() < args.level_rate:
+            gradient = 0.0
+        else:
+            gradient = gradient + rnd.gauss(0, args.grade_sigma)
+            gradient = max(-args.max_grade, min(args.max_grade, gradient))
+            gradient = round(gradient, 1)
+        radius = 0
+        if rnd.random() < args.curve_rate:
+            radius = rnd.choice([150, 200, 300, 400, 600, 800, 1200, 2000])
+        speed = curve_speed(radius, args.line_speed)
+        # temporary speed restrictions
+        if rnd.random() < args.restriction_rate:
+            speed = min(speed, round5(rnd.uniform(25, args.line_speed)))
+        segs.append([d, 0, speed, gradient, radius])
+        rest -= d
+    return segs
+
+
+def make_line(rnd, args):
+    total = args.length * 1000.0
+    station_len = args.station_length
+    segs = []
+    pos = 0.0
+    while True:
+        segs.append([station_len, 1, args.station_speed, 0.0, 0])
+        pos += station_len
+        if pos >= total - station_len:
+            break
+        spacing = rnd.gauss(args.spacing * 1000.0, 0.25 * args.spacing * 1000.0)
+        spacing = max(args.min_spacing * 1000.0, spacing)
+        rest = total - pos - station_len
+        if rest - spacing < args.min_spacing * 1000.0 + station_len:
+            # no room for another station: the last section reaches the end
+            spacing = max(rest, args.min_spacing * 1000.0)
+        if args.switch_rate > 0 and rnd.random() < args.switch_rate:
+            segs.append([0, 2, round5(rnd.uniform(35, 45)), 0.0, 0])
+        segs.extend(make_section(rnd, args, round(spacing)))
+        pos += round(spacing)
+    return segs
+
+
+def write_line(fname, segs, args):
+    with open(fname, "w") as f:
+        f.write(HEADER.format(args=" ".join(sys.argv[1:])))
+        dist = 0.0
+        for i, (length, stype, speed, gradient, radius) in enumerate(segs):
+            f.write("%d\t%.0f\t%.0f\t%d\t%d\t%g\t%d\n" %
+                    (i + 1, dist, length, stype, speed, gradient, radius))
+            dist += length
+    return dist
+
+
+def make_params(rnd, args, line_fname):
+    trains = []
+    for i in range(args.trains):
+        cars = rnd.choice([4, 6, 8, 10])
+        wm = round(cars * rnd.uniform(18, 22) * 0.5, 1)
+        wt = round(cars * rnd.uniform(24, 28) * 0.5, 1)
+        trains.append({
+            "id": i + 1,
+            "name": "Train %d" % (i + 1),
+            "maxspeed": rnd.choice([70, 80, 90, 100]),
+            "jerk": 0.6,
+            "length": cars * 20,
+            "WM": wm,
+            "WT": wt,
+            "nCars": cars,
+            "acceleration": round(rnd.uniform(0.7, 1.0), 2),
+            "deceleration": round(rnd.uniform(0.9, 1.1), 2),
+            "sptrindex": 1,
+            "lineindex": 1,
+            "resistance": {
+                "model": "JNR_EMU",
+                "params": [1.32, 0.0164, 0.028, 0.0078]
+            }
+        })
+    return {
+        "line": [{"id": 1, "type": "file", "fname": line_fname}],
+        "speedtraction": [{
+            "id": 1,
+            "name": "Speed-tration Test data",
+            "labels": ["speed", "traction"],
+            "units": ["km/s", "kgf"],
+            "data": SPEED_TRACTION
+        }],
+        "train": trains
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a synthetic line and trains")
+    parser.add_argument("output", help="output prefix (.data and .json are added)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--length", type=float, default=100, help="line length (km)")
+    parser.add_argument("--density", type=float, default=5, help="segments per km")
+    parser.add_argument("--spacing", type=float, default=2.5, help="mean station spacing (km)")
+    parser.add_argument("--min-spacing", type=float, default=0.8, help="minimum station spacing (km)")
+    parser.add_argument("--station-length", type=float, default=250, help="length of stations (m)")
+    parser.add_argument("--station-speed", type=float, default=30, help="speed limit of stations (km/h)")
+    parser.add_argument("--line-speed", type=float, default=90, help="line speed (km/h)")
+    parser.add_argument("--level-rate", type=float, default=0.6, help="rate of level segments")
+    parser.add_argument("--grade-sigma", type=float, default=0.5, help="sigma of gradient changes (%%)")
+    parser.add_argument("--max-grade", type=float, default=2.5, help="maximum gradient (%%)")
+    parser.add_argument("--curve-rate", type=float, default=0.2, help="rate of curved segments")
+    parser.add_argument("--restriction-rate", type=float, default=0.05, help="rate of speed restrictions")
+    parser.add_argument("--switch-rate", type=float, default=0.0, help="rate of switches at stations")
+    parser.add_argument("--trains", type=int, default=1, help="number of trains")
+    args = parser.parse_args()
+
+    # The line and the trains use independent streams
+    line_rnd = random.Random(args.seed)
+    train_rnd = random.Random(args.seed * 7919 + 1)
+    segs = make_line(line_rnd, args)
+    line_fname = args.output + ".data"
+    total = write_line(line_fname, segs, args)
+    params = make_params(train_rnd, args, line_fname)
+    with open(args.output + ".json", "w") as f:
+        json.dump(params, f, indent="\t")
+    n_station = sum(1 for s in segs if s[1] == 1)
+    print("%s: %.1f km, %d segments, %d stations, %d trains" %
+          (line_fname, total / 1000.0, len(segs), n_station, args.trains))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,300 @@
+/**
+ * Unit tests of the numerical helpers and the shard files.
+ * Usage: unittest (in a writable directory; the temporary files are removed)
+ * The failed checks are printed; the exit code is the number of failures.
+ * The errors of the merges that must fail are printed by merge_shards too.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include "TDigest.h"
+#include "Simulate.h"
+#include "Calibration.h"
+#include "ResultFile.h"
+#include "MonteCarlo.h"
+#include "Shard.h"
+#include "Surface.h"
+///////////////////////////////////////////////////////////////////////////////
+static int n_check = 0;
+static int n_fail = 0;
+
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static void check(bool ok, const char* expr, const char* file, int line) {
+    n_check++;
+    if (ok) return;
+    n_fail++;
+    printf("%s:%d: failed: %s\n", file, line, expr);
+}
+
+static std::string read_all(const char* fname) {
+    std::ifstream fi(fname, std::ios::binary);
+    std::stringstream ss;
+    ss << fi.rdbuf();
+    return ss.str();
+}
+
+static void write_all(const char* fname, const std::string& str) {
+    FILE* fp = fopen(fname, "wb");
+    if (fp == NULL) return;
+    fwrite(str.data(), 1, str.size(), fp);
+    fclose(fp);
+}
+//-----------------------------------------------------------------------------
+// t-digest: the quantiles of uniform values, merge and write/read
+//-----------------------------------------------------------------------------
+static void test_tdigest() {
+    std::mt19937 rnd(1);
+    std::uniform_real_distribution<double> u(0, 1);
+    std::vector<double> xs(100000);
+    for (auto& x : xs) x = u(rnd);
+    TDigest all;
+    std::vector<TDigest> parts(10);
+    for (size_t i = 0; i < xs.size(); i++) {
+        all.add(xs[i]);
+        parts[i % parts.size()].add(xs[i]);
+    }
+    CHECK(all.count() == xs.size());
+    CHECK(std::fabs(all.mean() - 0.5) < 0.01);
+    for (double q : {0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 0.999}) {
+        double tol = (q < 0.05 || q > 0.95) ? 0.001 : 0.01;
+        CHECK(std::fabs(all.quantile(q) - q) < tol);
+    }
+    CHECK(all.quantile(0) == all.min());
+    CHECK(all.quantile(1) == all.max());
+    CHECK(all.size() < 1000);
+    // merged in the same order: the same digest
+    TDigest m1, m2;
+    for (auto& p : parts) {
+        p.flush();
+        m1.merge(p);
+    }
+    for (auto& p : parts) m2.merge(p);
+    CHECK(m1.count() == xs.size());
+    for (double q : {0.01, 0.5, 0.99}) {
+        CHECK(std::fabs(m1.quantile(q) - q) < 0.01);
+        CHECK(m1.quantile(q) == m2.quantile(q));
+    }
+    // write and read keep the digest exactly
+    const char* fname = "unittest-digest.tmp";
+    FILE* fp = fopen(fname, "wt");
+    m1.write(fp);
+    fclose(fp);
+    std::ifstream fi(fname);
+    TDigest r;
+    CHECK(r.read(fi));
+    fi.close();
+    remove(fname);
+    CHECK(r.count() == m1.count());
+    for (double q : {0.01, 0.5, 0.99}) CHECK(r.quantile(q) == m1.quantile(q));
+    TDigest empty;
+    CHECK(std::isnan(empty.quantile(0.5)));
+}
+//-----------------------------------------------------------------------------
+// Richardson extrapolation of q(h) = q0 + c h^p with h = 1, 1/2, 1/4, ...
+//-----------------------------------------------------------------------------
+static void test_richardson() {
+    for (double p : {1.0, 2.0}) {
+        std::vector<double> q;
+        for (int i = 0; i < 4; i++) q.push_back(3.0 + 0.5 * std::pow(0.5, p * i));
+        std::vector<double> err;
+        double order;
+        double qx = richardson(q, &err, &order);
+        CHECK(std::fabs(qx - 3.0) < 1e-12);
+        CHECK(std::fabs(order - p) < 1e-9);
+        CHECK(err.size() == q.size());
+        CHECK(std::fabs(err[0] - 0.5) < 1e-12);
+    }
+    // no clear order: first order
+    std::vector<double> noisy = {1.0, 1.1, 0.9};
+    double order;
+    richardson(noisy, nullptr, &order);
+    CHECK(order == 1.0);
+    std::vector<double> one = {2.0};
+    CHECK(richardson(one, nullptr, nullptr) == 2.0);
+}
+//-----------------------------------------------------------------------------
+static void test_solve_linear() {
+    std::vector<double> a = {2, 1, -1, -3, -1, 2, -2, 1, 2};
+    std::vector<double> b = {8, -11, -3};
+    std::vector<double> x;
+    CHECK(solve_linear(a, b, 3, &x));
+    CHECK(x.size() == 3 && std::fabs(x[0] - 2) < 1e-12 && std::fabs(x[1] - 3) < 1e-12 && std::fabs(x[2] + 1) < 1e-12);
+    // a zero pivot needs the exchange of rows
+    std::vector<double> a2 = {0, 1, 1, 0};
+    std::vector<double> b2 = {2, 3};
+    CHECK(solve_linear(a2, b2, 2, &x) && std::fabs(x[0] - 3) < 1e-12 && std::fabs(x[1] - 2) < 1e-12);
+    std::vector<double> s = {1, 2, 2, 4};
+    CHECK(!solve_linear(s, b2, 2, &x));
+}
+//-----------------------------------------------------------------------------
+// The rows are the same on any number of threads (chunks cut at any place)
+//-----------------------------------------------------------------------------
+static void test_parse_result_rows() {
+    std::string text;
+    const size_t rows = 40000;
+    char buf[128];
+    for (size_t i = 0; i < rows; i++) {
+        snprintf(buf, sizeof(buf), "%d\t%.3f\t%.2f\t%.1f\t%.3f\t%.0f\t%.1f\n", (int)(i % 4), i / 16.0, i * 1.5,
+            60 + 20 * std::sin(i / 300.0), 0.1, 1000.0 + i, 100.0);
+        text += buf;
+    }
+    CHECK(text.size() > 4 * 256 * 1024);
+    ResultColumns ref;
+    CHECK(parse_result_rows(text.data(), text.data() + text.size(), &ref, 1));
+    CHECK(ref.size() == rows);
+    CHECK(ref.status[5] == 1 && ref.time[16] == 1.0 && ref.force[rows - 1] == 1000.0 + rows - 1);
+    for (int nt : {2, 3, 4, 7, 16}) {
+        ResultColumns c;
+        CHECK(parse_result_rows(text.data(), text.data() + text.size(), &c, nt));
+        CHECK(c.size() == rows && c.time == ref.time && c.distance == ref.distance && c.force == ref.force
+            && c.status == ref.status);
+    }
+    // the last row without a newline
+    std::string cut = text.substr(0, text.size() - 1);
+    ResultColumns c;
+    CHECK(parse_result_rows(cut.data(), cut.data() + cut.size(), &c, 4));
+    CHECK(c.size() == rows && c.power.back() == 100.0);
+    // an invalid row in the middle fails on any number of threads
+    std::string bad = text;
+    size_t nl = bad.rfind('\n', bad.size() / 2 + 7);
+    bad.replace(nl + 1, 1, "x");
+    for (int nt : {1, 4}) CHECK(!parse_result_rows(bad.data(), bad.data() + bad.size(), &c, nt) && c.size() == 0);
+    std::string empty_line = "0 0 0 0 0 0 0\n\n0 0 0 0 0 0 0\n";
+    CHECK(!parse_result_rows(empty_line.data(), empty_line.data() + empty_line.size(), &c, 1));
+}
+//-----------------------------------------------------------------------------
+// The shards of a sweep and of a Monte Carlo run merge into the file of a
+// single run; a missing row fails and keeps the output
+//-----------------------------------------------------------------------------
+static void test_merge_shards() {
+    const int N = 3;
+    const size_t items = 7;
+    std::vector<std::string> fnames;
+    for (int i = 0; i < N; i++) fnames.push_back("unittest-shard-" + std::to_string(i) + ".tmp");
+    const char* out = "unittest-merged.tmp";
+    std::string single = "point\ttrain\tcode\n";
+    std::vector<std::string> shards(N);
+    for (int i = 0; i < N; i++) shards[i] = "# runrail shard " + std::to_string(i) + "/3 sweep 7\npoint\ttrain\tcode\n";
+    for (size_t k = 0; k < items; k++) {
+        std::string row = std::to_string(k) + "\t1\t0\n";
+        single += row;
+        shards[k % N] += row;
+    }
+    for (int i = 0; i < N; i++) write_all(fnames[i].c_str(), shards[i]);
+    // in any order
+    std::vector<std::string> order = {fnames[2], fnames[0], fnames[1]};
+    CHECK(merge_shards(out, order));
+    CHECK(read_all(out) == single);
+    std::string last = shards[0].substr(0, shards[0].rfind('\n', shards[0].size() - 2) + 1);
+    write_all(fnames[0].c_str(), last);
+    CHECK(!merge_shards(out, fnames));
+    CHECK(read_all(out) == single);
+    std::vector<std::string> two = {fnames[0], fnames[1]};
+    CHECK(!merge_shards(out, two));
+    // Monte Carlo: 2 trains of 4 blocks
+    std::mt19937 rnd(2);
+    std::normal_distribution<double> g(100, 5);
+    std::vector<MonteCarloStat> blocks(8);
+    for (size_t k = 0; k < blocks.size(); k++) {
+        MonteCarloStat& b = blocks[k];
+        b.train_id = (int)(k / 4) + 1;
+        b.block = k;
+        b.arrivals.resize(2);
+        for (size_t s = 0; s < MONTECARLO_BLOCK; s++) {
+            b.run_time.add(g(rnd));
+            b.energy.add(g(rnd) * 10);
+            b.arrivals[0].add(g(rnd) / 2);
+            b.arrivals[1].add(g(rnd));
+        }
+        b.flush();
+    }
+    std::vector<double> quantiles = {0.05, 0.5, 0.95};
+    std::vector<MonteCarloStat> stats;
+    merge_montecarlo_blocks(blocks, &stats);
+    CHECK(stats.size() == 2 && stats[0].run_time.count() == 4 * MONTECARLO_BLOCK);
+    const char* single_fname = "unittest-single.tmp";
+    FILE* fp = fopen(single_fname, "wt");
+    print_montecarlo(fp, stats, quantiles);
+    fclose(fp);
+    for (int i = 0; i < N; i++) {
+        std::vector<MonteCarloStat> bs;
+        for (size_t k = i; k < blocks.size(); k += N) bs.push_back(blocks[k]);
+        fp = fopen(fnames[i].c_str(), "wt");
+        print_shard_header(fp, i, N, "montecarlo", blocks.size());
+        save_montecarlo_sketch(fp, bs, quantiles);
+        fclose(fp);
+    }
+    CHECK(merge_shards(out, order));
+    CHECK(read_all(out) == read_all(single_fname));
+    remove(single_fname);
+    for (const auto& f : fnames) remove(f.c_str());
+    remove(out);
+}
+//-----------------------------------------------------------------------------
+// A surface of a linear function is interpolated exactly, with no error,
+// and keeps its nodes after an insertion
+//-----------------------------------------------------------------------------
+static void test_surface() {
+    Surface s;
+    nlohmann::json j = {{"ranges", {{"WT", {200, 300, 400}}, {"spmargin", {0, 5, 10}}}}};
+    CHECK(s.read_json(j));
+    CHECK(s.size() == 9);
+    auto f = [](const std::vector<double>& v) { return 100 + 0.1 * v[0] + 2 * v[1]; };
+    auto fill = [&](size_t k) {
+        std::vector<double> v;
+        s.point(k, &v);
+        SurfaceNode& node = s.nodes[k];
+        node.state = 1;
+        node.arrival = {0, f(v)};
+        node.departure = {0, f(v)};
+        node.energy = {0, 10 * f(v)};
+    };
+    for (size_t k = 0; k < s.size(); k++) fill(k);
+    std::vector<double> q = {250, 2.5};
+    SurfaceValue r;
+    CHECK(s.interpolate(q, 0, 1, &r));
+    CHECK(std::fabs(r.time - f(q)) < 1e-9 && std::fabs(r.energy - 10 * f(q)) < 1e-9);
+    CHECK(r.err_time < 1e-9 && s.trusted(r));
+    std::vector<double> out = {500, 2.5};
+    CHECK(!s.interpolate(out, 0, 1, &r));
+    CHECK(!s.interpolate(q, 1, 1, &r));
+    // a new value: the old nodes keep their values, the new ones are not run
+    CHECK(s.insert(0, 250));
+    CHECK(!s.insert(0, 250));
+    CHECK(s.size() == 12 && s.axes[0].size() == 4);
+    std::vector<double> v;
+    size_t n_new = 0;
+    for (size_t k = 0; k < s.size(); k++) {
+        s.point(k, &v);
+        if (v[0] == 250) {
+            CHECK(s.nodes[k].state == 0);
+            n_new++;
+        }
+        else CHECK(s.nodes[k].state == 1 && s.nodes[k].arrival[1] == f(v));
+    }
+    CHECK(n_new == 3);
+    CHECK(!s.interpolate(q, 0, 1, &r));
+    for (size_t k = 0; k < s.size(); k++) {
+        if (s.nodes[k].state == 0) fill(k);
+    }
+    CHECK(s.interpolate(q, 0, 1, &r) && std::fabs(r.time - f(q)) < 1e-9);
+    s.max_nodes = 12;
+    CHECK(!s.insert(1, 7.5));
+}
+///////////////////////////////////////////////////////////////////////////////
+int main() {
+    test_tdigest();
+    test_richardson();
+    test_solve_linear();
+    test_parse_result_rows();
+    test_merge_shards();
+    test_surface();
+    printf("%d checks, %d failed\n", n_check, n_fail);
+    return n_fail;
+}